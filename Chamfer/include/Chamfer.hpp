@@ -19,11 +19,23 @@
 #ifndef __ChamferMatcher_h__
 #define __ChamferMatcher_h__
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <map>
+#include <memory>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <utility>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include "Executor.hpp"
+#include "PerfCounters.hpp"
+#include "QueryImageLoader.hpp"
+#include "TemplateCostReport.hpp"
+#include "TraceRecorder.hpp"
 
 #define DEBUG 0
 
@@ -65,6 +77,105 @@ struct less_than_area {
   }
 };
 
+/*
+ * Cost bound shared by the scoring threads in the top-K mode: the K-th best cost among the best cost
+ * found so far for each template (initialized with distanceThresh).
+ * Reading the bound is lock free, it only decreases.
+ */
+class TopKBound {
+public:
+  TopKBound(const size_t k, const float initialBound)
+  : m_k(k), m_bound(initialBound), m_initialBound(initialBound), m_mapOfBestCosts(), m_mutex() {
+  }
+
+  inline float get() const {
+    return m_bound.load(std::memory_order_relaxed);
+  }
+
+  void update(const int templateId, const float cost) {
+    if(cost >= get()) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<int, float>::iterator it = m_mapOfBestCosts.find(templateId);
+    if(it != m_mapOfBestCosts.end() && it->second <= cost) {
+      return;
+    }
+    m_mapOfBestCosts[templateId] = cost;
+
+    if(m_k > 0 && m_mapOfBestCosts.size() >= m_k) {
+      std::vector<float> costs;
+      costs.reserve(m_mapOfBestCosts.size());
+      for(it = m_mapOfBestCosts.begin(); it != m_mapOfBestCosts.end(); ++it) {
+        costs.push_back(it->second);
+      }
+
+      std::nth_element(costs.begin(), costs.begin() + (m_k-1), costs.end());
+      m_bound.store(std::min(m_initialBound, costs[m_k-1]), std::memory_order_relaxed);
+    }
+  }
+
+private:
+  //! Number of templates to retrieve.
+  size_t m_k;
+  //! Current bound.
+  std::atomic<float> m_bound;
+  //! Initial bound (distanceThresh).
+  float m_initialBound;
+  //! Key: template id - Value: best cost.
+  std::map<int, float> m_mapOfBestCosts;
+  //! Protect m_mapOfBestCosts.
+  std::mutex m_mutex;
+};
+
+/*
+ * Deadline and cancellation token of an anytime detection: the detection stops when the deadline is
+ * reached or when cancel() is called (e.g. by another thread) and returns the best detections found so far.
+ */
+class DetectionDeadline {
+public:
+  /*
+   * No deadline, only cancel() stops the detection.
+   */
+  DetectionDeadline()
+  : m_hasDeadline(false), m_deadline(), m_cancelled(false) {
+  }
+
+  /*
+   * Deadline in budgetMs milliseconds from now.
+   */
+  explicit DetectionDeadline(const double budgetMs)
+  : m_hasDeadline(true), m_deadline(std::chrono::steady_clock::now() +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(budgetMs))),
+    m_cancelled(false) {
+  }
+
+  explicit DetectionDeadline(const std::chrono::steady_clock::time_point &deadline)
+  : m_hasDeadline(true), m_deadline(deadline), m_cancelled(false) {
+  }
+
+  inline void cancel() {
+    m_cancelled.store(true, std::memory_order_relaxed);
+  }
+
+  inline bool isExpired() const {
+    return m_cancelled.load(std::memory_order_relaxed) ||
+        (m_hasDeadline && std::chrono::steady_clock::now() >= m_deadline);
+  }
+
+private:
+  DetectionDeadline(const DetectionDeadline &);
+  DetectionDeadline& operator=(const DetectionDeadline &);
+
+  //! False if only cancel() can stop the detection.
+  bool m_hasDeadline;
+  //! Deadline.
+  std::chrono::steady_clock::time_point m_deadline;
+  //! Set by cancel().
+  std::atomic<bool> m_cancelled;
+};
+
 struct Line_info_t {
   double m_length;
   cv::Point m_pointEnd;
@@ -83,13 +194,129 @@ struct Line_info_t {
   }
 };
 
+/*
+ * Compressed sparse row storage of a list of lists (e.g. the points of each contour): the elements of all
+ * the rows are stored contiguously, row i is [m_offsets[i] ; m_offsets[i+1]).
+ */
+template<typename T>
+struct CSRArray_t {
+  //! Elements of all the rows.
+  std::vector<T> m_data;
+  //! Index of the first element of each row, followed by the total number of elements.
+  std::vector<size_t> m_offsets;
+
+  CSRArray_t() : m_data(), m_offsets(1, 0) {
+  }
+
+  explicit CSRArray_t(const std::vector<std::vector<T> > &rows) : m_data(), m_offsets(1, 0) {
+    assign(rows);
+  }
+
+  void assign(const std::vector<std::vector<T> > &rows) {
+    clear();
+    m_offsets.reserve(rows.size()+1);
+
+    size_t nbElements = 0;
+    for(typename std::vector<std::vector<T> >::const_iterator it = rows.begin(); it != rows.end(); ++it) {
+      nbElements += it->size();
+    }
+    m_data.reserve(nbElements);
+
+    for(typename std::vector<std::vector<T> >::const_iterator it = rows.begin(); it != rows.end(); ++it) {
+      m_data.insert(m_data.end(), it->begin(), it->end());
+      endRow();
+    }
+  }
+
+  /*
+   * Keep the capacity.
+   */
+  inline void clear() {
+    m_data.clear();
+    m_offsets.resize(1);
+    m_offsets[0] = 0;
+  }
+
+  /*
+   * Add an element to the current row, the row is closed with endRow().
+   */
+  inline void push_back(const T &element) {
+    m_data.push_back(element);
+  }
+
+  inline void endRow() {
+    m_offsets.push_back(m_data.size());
+  }
+
+  inline const T* row(const size_t i) const {
+    return m_data.empty() ? NULL : &m_data[0] + m_offsets[i];
+  }
+
+  inline size_t rowSize(const size_t i) const {
+    return m_offsets[i+1] - m_offsets[i];
+  }
+
+  /*
+   * Number of rows.
+   */
+  inline size_t size() const {
+    return m_offsets.size() - 1;
+  }
+
+  /*
+   * Total number of elements.
+   */
+  inline size_t nbElements() const {
+    return m_data.size();
+  }
+
+  /*
+   * Bytes allocated by the arrays.
+   */
+  inline size_t getMemorySize() const {
+    return m_data.capacity() * sizeof(T) + m_offsets.capacity() * sizeof(size_t);
+  }
+
+  void toVectors(std::vector<std::vector<T> > &rows) const {
+    rows.resize(size());
+    for(size_t i = 0; i < size(); i++) {
+      rows[i].assign(m_data.begin() + m_offsets[i], m_data.begin() + m_offsets[i+1]);
+    }
+  }
+};
+
+/*
+ * Grid descriptor rejection parameters of a template at one scale, set by ChamferMatcher::calibrateRejection.
+ * When not calibrated, the global parameters of the matcher are used.
+ */
+struct RejectionParams_t {
+  //! Maximal distance transform error to match two reference points.
+  float m_maxDescriptorDistanceError;
+  //! Maximal orientation error to match two reference points.
+  float m_maxDescriptorOrientationError;
+  //! Minimal number of matched descriptors to keep the location (-1 if not calibrated).
+  int m_minNbDescriptorMatches;
+  //! Fraction of the positive sample locations kept with these parameters.
+  float m_recall;
+  //! Fraction of the negative sample locations rejected with these parameters.
+  float m_rejectionRate;
+
+  RejectionParams_t() : m_maxDescriptorDistanceError(-1.0f), m_maxDescriptorOrientationError(-1.0f),
+    m_minNbDescriptorMatches(-1), m_recall(-1.0f), m_rejectionRate(-1.0f) {
+  }
+
+  inline bool isCalibrated() const {
+    return m_minNbDescriptorMatches >= 0;
+  }
+};
+
 struct Template_info_t {
   //! List of contours, each contour is a list of points.
-  std::vector<std::vector<cv::Point> > m_contours;
+  CSRArray_t<cv::Point> m_contours;
   //! Distance transform image.
   cv::Mat m_distImg;
   //! Corresponding edge orientation for each point for each contour.
-  std::vector<std::vector<float> > m_edgesOrientation;
+  CSRArray_t<float> m_edgesOrientation;
   //! Descriptors.
   std::vector<std::pair<float, float> > m_gridDescriptors;
   //! Location of the descriptor on the grid.
@@ -105,24 +332,44 @@ struct Template_info_t {
   cv::Mat m_mask;
   //! Query ROI: rectangle in the query image where we want to search the template.
   cv::Rect m_queryROI;
+  //! Calibrated rejection parameters.
+  RejectionParams_t m_rejectionParams;
   //! Template location in the query image, used when dealing with template poses (one location = one pose).
   cv::Rect m_templateLocation;
   //! Vector of contours approximated by lines.
-  std::vector<std::vector<Line_info_t> > m_vectorOfContourLines;
-
-  Template_info_t(const std::vector<std::vector<cv::Point> > &contours, const cv::Mat &dist,
-      const std::vector<std::vector<float> > &edgesOri, const cv::Size &gridDescriptorSize,
-      const cv::Mat &edgeOriImg, const cv::Mat &mask, const std::vector<std::vector<Line_info_t> > &contourLines)
-  : m_contours(contours), m_distImg(dist), m_edgesOrientation(edgesOri), m_gridDescriptors(), m_gridDescriptorsLocations(),
-    m_gridDescriptorsSize(gridDescriptorSize), m_mapOfEdgeOrientation(edgeOriImg), m_mask(mask),
-    m_queryROI(0,0,-1,-1), m_templateLocation(0,0,-1,-1), m_vectorOfContourLines(contourLines) {
+  CSRArray_t<Line_info_t> m_vectorOfContourLines;
+  //! Template size, the dense maps (m_distImg, m_mapOfEdgeOrientation, m_mask) are empty when not used by the
+  //! matching type (see ChamferMatcher::setUseCompactTemplates).
+  cv::Size m_size;
+
+  /*
+   * The contour data are moved, not copied.
+   */
+  Template_info_t(CSRArray_t<cv::Point> &&contours, const cv::Mat &dist,
+      CSRArray_t<float> &&edgesOri, const cv::Size &gridDescriptorSize,
+      const cv::Mat &edgeOriImg, const cv::Mat &mask, CSRArray_t<Line_info_t> &&contourLines)
+  : m_contours(std::move(contours)), m_distImg(dist), m_edgesOrientation(std::move(edgesOri)), m_gridDescriptors(),
+    m_gridDescriptorsLocations(), m_gridDescriptorsSize(gridDescriptorSize), m_mapOfEdgeOrientation(edgeOriImg),
+    m_mask(mask), m_queryROI(0,0,-1,-1), m_rejectionParams(), m_templateLocation(0,0,-1,-1),
+    m_vectorOfContourLines(std::move(contourLines)), m_size(dist.size()) {
     computeGridLocations();
   }
 
   Template_info_t()
   : m_contours(), m_distImg(), m_edgesOrientation(), m_gridDescriptors(), m_gridDescriptorsLocations(),
-    m_gridDescriptorsSize(4,4), m_mapOfEdgeOrientation(), m_mask(), m_queryROI(0,0,-1,-1),
-    m_templateLocation(0,0,-1,-1), m_vectorOfContourLines() {
+    m_gridDescriptorsSize(4,4), m_mapOfEdgeOrientation(), m_mask(), m_queryROI(0,0,-1,-1), m_rejectionParams(),
+    m_templateLocation(0,0,-1,-1), m_vectorOfContourLines(), m_size() {
+  }
+
+  /*
+   * Bytes of the images and arrays (the cv::Mat shared with other templates are counted).
+   */
+  inline size_t getMemorySize() const {
+    return m_contours.getMemorySize() + m_distImg.total() * m_distImg.elemSize() +
+        m_edgesOrientation.getMemorySize() + m_gridDescriptors.capacity() * sizeof(std::pair<float, float>) +
+        m_gridDescriptorsLocations.capacity() * sizeof(cv::Point) +
+        m_mapOfEdgeOrientation.total() * m_mapOfEdgeOrientation.elemSize() + m_mask.total() * m_mask.elemSize() +
+        m_vectorOfContourLines.getMemorySize();
   }
 
 private:
@@ -152,11 +399,11 @@ private:
 
 struct Query_info_t {
   //! List of contours, each contour is a list of points.
-  std::vector<std::vector<cv::Point> > m_contours;
+  CSRArray_t<cv::Point> m_contours;
   //! Distance transform image.
   cv::Mat m_distImg;
   //! Corresponding edge orientation for each point for each contour.
-  std::vector<std::vector<float> > m_edgesOrientation;
+  CSRArray_t<float> m_edgesOrientation;
   //! Query Image.
   cv::Mat m_img;
   //! Integral distance transform image.
@@ -171,15 +418,19 @@ struct Query_info_t {
   //! Image mask.
   cv::Mat m_mask;
   //! Vector of contours approximated by lines.
-  std::vector<std::vector<Line_info_t> > m_vectorOfContourLines;
+  CSRArray_t<Line_info_t> m_vectorOfContourLines;
 
-  Query_info_t(const std::vector<std::vector<cv::Point> > &contours, const cv::Mat &dist, const cv::Mat &img,
+  /*
+   * The contour data are moved, not copied.
+   */
+  Query_info_t(CSRArray_t<cv::Point> &&contours, const cv::Mat &dist, const cv::Mat &img,
       const cv::Mat &integralDistImg, const cv::Mat &integralEdgeOrientation, const cv::Mat &edgeOriImg,
-      const std::vector<std::vector<float> > &edgesOri, const cv::Mat &labels, const cv::Mat &mask,
-      const std::vector<std::vector<Line_info_t> > &contourLines)
-  : m_contours(contours), m_distImg(dist), m_edgesOrientation(edgesOri), m_img(img), m_integralDistImg(integralDistImg),
-    m_integralEdgeOrientation(integralEdgeOrientation), m_mapOfEdgeOrientation(edgeOriImg), m_mapOfLabels(labels),
-    m_mask(mask), m_vectorOfContourLines(contourLines) {
+      CSRArray_t<float> &&edgesOri, const cv::Mat &labels, const cv::Mat &mask,
+      CSRArray_t<Line_info_t> &&contourLines)
+  : m_contours(std::move(contours)), m_distImg(dist), m_edgesOrientation(std::move(edgesOri)), m_img(img),
+    m_integralDistImg(integralDistImg), m_integralEdgeOrientation(integralEdgeOrientation),
+    m_mapOfEdgeOrientation(edgeOriImg), m_mapOfLabels(labels), m_mask(mask),
+    m_vectorOfContourLines(std::move(contourLines)) {
   }
 
   Query_info_t()
@@ -188,6 +439,313 @@ struct Query_info_t {
   }
 };
 
+/*
+ * Contour points and grid descriptors of a template at one scale, obtained by scaling the points of the
+ * prepared template at 100% around its center (see ChamferMatcher::setUsePointSetScaling).
+ */
+struct ScaledPointSet_t {
+  //! Scale as percentage.
+  int m_scale;
+  //! Size of the scaled template.
+  cv::Size m_size;
+  //! Contour points, same order as the points (and orientations) of the template at 100%.
+  std::vector<cv::Point> m_points;
+  //! Location of the grid descriptors.
+  std::vector<cv::Point> m_gridLocations;
+  //! Distance transform value of the grid descriptors.
+  std::vector<float> m_gridDistances;
+
+  ScaledPointSet_t() : m_scale(100), m_size(), m_points(), m_gridLocations(), m_gridDistances() {
+  }
+};
+
+/*
+ * Query prepared once (edges, distance transform, edge orientations, ...) and reused by several detections,
+ * e.g. with different lambda, distanceThresh, matching types or matchers with other templates.
+ * It depends only on the image and on the Canny threshold. Never modified once prepared: can be shared by
+ * concurrent detections.
+ */
+struct PreparedQuery_t {
+  //! Canny threshold of the preparation, must match the one of the matcher that detects.
+  double m_cannyThreshold;
+  //! Query information at the regular resolution.
+  Query_info_t m_queryInfo;
+  //! Query information at the half resolution, used by the pyramid.
+  Query_info_t m_halfQueryInfo;
+  //! True if m_halfQueryInfo is prepared.
+  bool m_hasHalfResolution;
+
+  PreparedQuery_t() : m_cannyThreshold(-1.0), m_queryInfo(), m_halfQueryInfo(), m_hasHalfResolution(false) {
+  }
+};
+
+
+//! Key: scale - Value: template information.
+typedef std::map<int, Template_info_t> TemplateScales_t;
+
+/*
+ * Prepared template library. A published library is never modified: the updates build a new library
+ * and swap it (see ChamferMatcher::setTemplateLibrary), the detections keep the library they started with.
+ * The templates at all the scales are shared between the libraries (copying a library does not copy them),
+ * an update replaces the TemplateScales_t of a template instead of modifying it.
+ */
+struct TemplateLibrary_t {
+  //! Key: template id - Value: template information at all the scales.
+  std::map<int, std::shared_ptr<const TemplateScales_t> > m_mapOfTemplate_info;
+  //! Key: template id - Value: template image.
+  std::map<int, cv::Mat> m_mapOfTemplateImages;
+  //! Sorted scales to use for the detectMultiScale.
+  std::vector<int> m_scaleVector;
+
+  TemplateLibrary_t() : m_mapOfTemplate_info(), m_mapOfTemplateImages(), m_scaleVector() {
+  }
+};
+
+
+/*
+ * Accumulated time in ms of the detection stages, filled in DetectionWorkspace::m_stageTimings
+ * when ChamferMatcher::setUseStageTimings is enabled. With setPerfCounters, the hardware counters are also
+ * read around each stage; they count the thread that created the PerfCounters object only, the chunks of
+ * the parallel loops run by the other threads of the executor are missing (use a SerialExecutor).
+ */
+struct StageTimings_t {
+  enum Stage {
+    //! Query decoding (QueryImageLoader).
+    decodeStage,
+    //! prepareQuery substages.
+    cannyStage,
+    distanceTransformStage,
+    edgeOrientationStage,
+    queryMaskStage,
+    contourLinesStage,
+    integralDistanceTransformStage,
+    //! Grid descriptor rejection, half resolution rejection mask.
+    rejectionStage,
+    //! Chamfer maps (with the rejection for the template groups and the point set scaling).
+    scoringStage,
+    //! Minima of the Chamfer maps.
+    extractionStage,
+    groupingStage,
+    nbStages
+  };
+
+  double m_times[nbStages];
+  //! Hardware counters of each stage (not available without setPerfCounters).
+  PerfCounterValues_t m_counters[nbStages];
+  //! Query pixels prepared.
+  double m_nbPixels;
+  //! Template windows of the Chamfer maps (locations of the 5x5 grid, all the templates and scales).
+  double m_nbWindows;
+  //! Counters read around the stages, not owned.
+  const PerfCounters *m_perfCounters;
+
+  StageTimings_t() : m_nbPixels(0.0), m_nbWindows(0.0), m_perfCounters(NULL) {
+    clear();
+  }
+
+  inline void add(const Stage stage, const double ms) {
+    m_times[stage] += ms;
+  }
+
+  inline void add(const StageTimings_t &timings) {
+    for(int i = 0; i < nbStages; i++) {
+      m_times[i] += timings.m_times[i];
+      m_counters[i].add(timings.m_counters[i]);
+    }
+    m_nbPixels += timings.m_nbPixels;
+    m_nbWindows += timings.m_nbWindows;
+  }
+
+  /*
+   * Reset the measures, the counters set with setPerfCounters are kept.
+   */
+  inline void clear() {
+    std::fill(m_times, m_times + nbStages, 0.0);
+    for(int i = 0; i < nbStages; i++) {
+      m_counters[i].clear();
+    }
+    m_nbPixels = 0.0;
+    m_nbWindows = 0.0;
+  }
+
+  /*
+   * Read the counters around each stage (NULL to stop), counters must outlive the detections.
+   */
+  inline void setPerfCounters(const PerfCounters *counters) {
+    m_perfCounters = counters != NULL && counters->isAvailable() ? counters : NULL;
+  }
+
+  static const char* getStageName(const Stage stage);
+
+  inline double getTotal() const {
+    double total = 0.0;
+    for(int i = 0; i < nbStages; i++) {
+      total += m_times[i];
+    }
+
+    return total;
+  }
+};
+
+class RetainedCostMaps;
+
+/*
+ * Buffers kept by the caller across the detect calls (e.g. the frames of a video): the query information,
+ * the Chamfer map and the rejection mask (sized to the largest requested), the coarse masks and the
+ * detection vectors, and the top-K hit history. A workspace must not be used by concurrent detect calls.
+ * Only the stage timings and the retained cost maps of the last detection are read by the caller.
+ */
+class DetectionWorkspace {
+public:
+  DetectionWorkspace()
+  : m_stageTimings(), m_queryInfo(), m_halfQueryInfo(), m_edges(), m_mapOfHalfRejectionMasks(),
+    m_rawDetections(), m_currentDetections(), m_templateDetections(), m_templateOrder(), m_mapOfCoarseCosts(),
+    m_mapOfTemplateHits(), m_templateGroups(), m_groupChamferMaps(), m_groupRejectionMasks(), m_scaledPointSets(),
+    m_scaleOrder(), m_isAnchorScale(), m_library(), m_retainedCostMaps(), m_chamferMapBuffer(),
+    m_rejectionMaskBuffer(), m_allocator(NULL) {
+  }
+
+  /*
+   * Cost maps of the last detection (see ChamferMatcher::setRetainCostMaps), NULL if not retained.
+   */
+  inline std::shared_ptr<const RetainedCostMaps> getRetainedCostMaps() const {
+    return m_retainedCostMaps;
+  }
+
+  //! Stage timings of the last detection (see ChamferMatcher::setUseStageTimings).
+  StageTimings_t m_stageTimings;
+
+private:
+  friend class ChamferMatcher;
+
+  inline cv::MatAllocator* getAllocator() const {
+    return m_allocator;
+  }
+
+  /*
+   * Allocator of the query planes and of the Chamfer map / rejection mask buffers, used at their next reallocation.
+   */
+  void setAllocator(cv::MatAllocator *allocator) {
+    if(allocator == m_allocator) {
+      return;
+    }
+
+    m_allocator = allocator;
+    setAllocator(m_queryInfo, allocator);
+    setAllocator(m_halfQueryInfo, allocator);
+    m_edges.allocator = allocator;
+    m_chamferMapBuffer.allocator = allocator;
+    m_rejectionMaskBuffer.allocator = allocator;
+  }
+
+  /*
+   * Chamfer map of the given size, view on a buffer grown to the largest size requested.
+   */
+  inline cv::Mat getChamferMap(const int rows, const int cols) {
+    return getView(m_chamferMapBuffer, rows, cols, CV_32F);
+  }
+
+  /*
+   * Rejection mask of the given size, view on a buffer grown to the largest size requested.
+   */
+  inline cv::Mat getRejectionMask(const int rows, const int cols) {
+    return getView(m_rejectionMaskBuffer, rows, cols, CV_8U);
+  }
+
+  static void setAllocator(Query_info_t &query_info, cv::MatAllocator *allocator) {
+    query_info.m_distImg.allocator = allocator;
+    query_info.m_integralDistImg.allocator = allocator;
+    query_info.m_integralEdgeOrientation.allocator = allocator;
+    query_info.m_mapOfEdgeOrientation.allocator = allocator;
+    query_info.m_mapOfLabels.allocator = allocator;
+    query_info.m_mask.allocator = allocator;
+  }
+
+  static cv::Mat getView(cv::Mat &buffer, const int rows, const int cols, const int type) {
+    if(buffer.rows < rows || buffer.cols < cols || buffer.type() != type) {
+      buffer.create(std::max(rows, buffer.rows), std::max(cols, buffer.cols), type);
+    }
+
+    return buffer(cv::Rect(0, 0, cols, rows));
+  }
+
+  //! Query information at the regular resolution.
+  Query_info_t m_queryInfo;
+  //! Query information at the half resolution.
+  Query_info_t m_halfQueryInfo;
+  //! Edge image of the query.
+  cv::Mat m_edges;
+  //! Key: template at the regular resolution - Value: (computed for the current query, half resolution mask).
+  std::map<const Template_info_t*, std::pair<bool, cv::Mat> > m_mapOfHalfRejectionMasks;
+  //! Detections before grouping.
+  std::vector<Detection_t> m_rawDetections;
+  //! Detections for one template at one scale.
+  std::vector<Detection_t> m_currentDetections;
+  //! Detections for one template.
+  std::vector<Detection_t> m_templateDetections;
+  //! Template ids in the processing order.
+  std::vector<int> m_templateOrder;
+  //! Key: template id - Value: best cost at the half resolution, the most promising templates are processed first.
+  std::map<int, float> m_mapOfCoarseCosts;
+  //! Key: template id - Value: number of times the template was in the top-K, to process first the likely templates.
+  std::map<int, int> m_mapOfTemplateHits;
+  //! Groups of template ids scanned location-major.
+  std::vector<std::vector<int> > m_templateGroups;
+  //! Chamfer maps of the templates of the current group.
+  std::vector<cv::Mat> m_groupChamferMaps;
+  //! Rejection masks of the templates of the current group.
+  std::vector<cv::Mat> m_groupRejectionMasks;
+  //! Point sets of the current template at each scale of the point set scaling.
+  std::vector<ScaledPointSet_t> m_scaledPointSets;
+  //! Scale indexes in the processing order.
+  std::vector<size_t> m_scaleOrder;
+  //! Anchor scales, processed before the intermediate ones.
+  std::vector<bool> m_isAnchorScale;
+  //! Template library of the last detection, the buffers keyed by template are dropped when it changes.
+  std::shared_ptr<const TemplateLibrary_t> m_library;
+  //! Cost maps of the last detection, a new object per detection (the caller can keep the previous one).
+  std::shared_ptr<RetainedCostMaps> m_retainedCostMaps;
+  //! Chamfer map buffer.
+  cv::Mat m_chamferMapBuffer;
+  //! Rejection mask buffer.
+  cv::Mat m_rejectionMaskBuffer;
+  //! Allocator of the buffers (NULL for the OpenCV default allocator).
+  cv::MatAllocator *m_allocator;
+};
+
+/*
+ * Query of a detection: the source of the query image (an image, a lazily decoded query or a prepared query),
+ * the buffers reused between the detections and the deadline of an anytime detection.
+ */
+struct DetectionQuery_t {
+  //! Query image, or NULL.
+  const cv::Mat *m_image;
+  //! Lazily decoded query, or NULL: with a pyramid, the half resolution is decoded directly and the regular
+  //! resolution only if the half resolution does not reject every location.
+  QueryImageLoader *m_loader;
+  //! Query prepared with ChamferMatcher::createPreparedQuery(), or NULL: no edge / distance transform computation.
+  const PreparedQuery_t *m_preparedQuery;
+  //! Buffers reused between the detections, e.g. the frames of a video (NULL for buffers of the call).
+  DetectionWorkspace *m_workspace;
+  //! Deadline of an anytime detection (NULL for no deadline).
+  const DetectionDeadline *m_deadline;
+
+  explicit DetectionQuery_t(const cv::Mat &image, DetectionWorkspace *workspace=NULL,
+      const DetectionDeadline *deadline=NULL)
+  : m_image(&image), m_loader(NULL), m_preparedQuery(NULL), m_workspace(workspace), m_deadline(deadline) {
+  }
+
+  explicit DetectionQuery_t(QueryImageLoader &loader, DetectionWorkspace *workspace=NULL,
+      const DetectionDeadline *deadline=NULL)
+  : m_image(NULL), m_loader(&loader), m_preparedQuery(NULL), m_workspace(workspace), m_deadline(deadline) {
+  }
+
+  explicit DetectionQuery_t(const PreparedQuery_t &prepared_query, DetectionWorkspace *workspace=NULL,
+      const DetectionDeadline *deadline=NULL)
+  : m_image(NULL), m_loader(NULL), m_preparedQuery(&prepared_query), m_workspace(workspace), m_deadline(deadline) {
+  }
+};
+
 
 class ChamferMatcher {
 public:
@@ -226,8 +784,30 @@ public:
   ChamferMatcher(const std::map<int, cv::Mat> &mapOfTemplateImages,
       const std::map<int, std::pair<cv::Rect, cv::Rect> > &mapOfTemplateRois);
 
+  /*
+   * Calibrate the grid descriptor rejection of each template and scale to reject at least targetRejectionRate
+   * of the negative locations while keeping at least targetRecall of the positive locations.
+   * The positive locations are the locations of the positive images whose Chamfer cost is below distanceThresh.
+   * The negative locations are all the locations of the negative images (or, without negative images,
+   * the locations of the positive images above distanceThresh).
+   * The pyramid half scales are calibrated on the images reduced by 2, as they are matched in the detection.
+   * The parameters are stored with the prepared templates (a new template library is published) and are
+   * lost when the templates are prepared again (setTemplateImages, loadTemplateData).
+   */
+  void calibrateRejection(const std::vector<cv::Mat> &positiveImages, const std::vector<cv::Mat> &negativeImages,
+      const float targetRejectionRate=0.9f, const float targetRecall=0.99f, const bool useOrientation=true,
+      const float distanceThresh=50.0f, const float lambda=5.0f, const float weight_forward=1.0f,
+      const float weight_backward=1.0f);
+
   static void computeCanny(const cv::Mat &img, cv::Mat &edges, const double threshold);
 
+  /*
+   * Prepare the query once, with the current Canny threshold, for several detect / detectMultiScale calls.
+   * The half resolution (pyramid) is prepared if halfResolution.
+   */
+  std::shared_ptr<const PreparedQuery_t> createPreparedQuery(const cv::Mat &img_query,
+      const bool halfResolution=true) const;
+
   static void computeDistanceTransform(const cv::Mat &img, cv::Mat &dist_img, cv::Mat &labels);
 
   /*
@@ -243,6 +823,9 @@ public:
   static void createMapOfEdgeOrientations(const cv::Mat &img, const cv::Mat &labels, cv::Mat &mapOfEdgeOrientations,
       std::vector<std::vector<cv::Point> > &contours, std::vector<std::vector<float> > &edges_orientation);
 
+  static void createMapOfEdgeOrientations(const cv::Mat &img, const cv::Mat &labels, cv::Mat &mapOfEdgeOrientations,
+      CSRArray_t<cv::Point> &contours, CSRArray_t<float> &edges_orientation);
+
   /*
    * Create a LUT that maps an angle in degree to the corresponding index.
    */
@@ -257,15 +840,42 @@ public:
       const bool useOrientation, const float distanceThresh=50.0f, const float lambda=5.0f,
       const float weight_forward=1.0f, const float weight_backward=1.0f, const bool useGroupDetections=true);
 
+  /*
+   * Detect on the query image of query, with its workspace and its deadline if given.
+   * Anytime detection: the templates are processed from the most promising (best cost at the half resolution
+   * with a pyramid, most hits in the top-K mode) and the detection stops when the deadline expires.
+   * Return false if the search is incomplete, detections then holds the best detections found so far.
+   */
+  bool detect(const DetectionQuery_t &query, std::vector<Detection_t> &detections, const bool useOrientation,
+      const float distanceThresh=50.0f, const float lambda=5.0f, const float weight_forward=1.0f,
+      const float weight_backward=1.0f, const bool useGroupDetections=true);
+
   void detectMultiScale(const cv::Mat &img_query, std::vector<Detection_t> &detections,
       const bool useOrientation, const float distanceThresh=50.0f, const float lambda=5.0f,
       const float weight_forward=1.0f, const float weight_backward=1.0f,
       const bool useNonMaximaSuppression=true, const bool useGroupDetections=true);
 
+  /*
+   * Detect on multiple scales on the query image of query (see detect(const DetectionQuery_t &, ...)).
+   * The templates are processed from the most promising and, for each template, the scales from coarse to fine
+   * (one every m_scalePruningStride first, then the intermediate ones).
+   * Return false if the search is incomplete, detections then holds the best detections found so far.
+   */
+  bool detectMultiScale(const DetectionQuery_t &query, std::vector<Detection_t> &detections,
+      const bool useOrientation, const float distanceThresh=50.0f, const float lambda=5.0f,
+      const float weight_forward=1.0f, const float weight_backward=1.0f, const bool useNonMaximaSuppression=true,
+      const bool useGroupDetections=true);
+
   void displayTemplateData(const int tempo=0);
 
   static void filterSingleContourPoint(std::vector<std::vector<cv::Point> > &contours, const size_t min=3);
 
+  /*
+   * Merge the detections that overlap more than overlapPercentage (intersection over union).
+   */
+  static void groupDetections(const std::vector<Detection_t> &detections, std::vector<Detection_t> &groupedDetections,
+      const double overlapPercentage=0.5);
+
   /*
    * Get the list of contour points.
    */
@@ -279,6 +889,8 @@ public:
   static void getContoursOrientation(const std::vector<std::vector<cv::Point> > &contours,
       std::vector<std::vector<float> > &contoursOrientation);
 
+  static void getContoursOrientation(const CSRArray_t<cv::Point> &contours, CSRArray_t<float> &contoursOrientation);
+
   inline double getCannyThreshold() const {
     return m_cannyThreshold;
   }
@@ -308,7 +920,15 @@ public:
   }
 
   inline size_t getNbTemplates() const {
-    return m_mapOfTemplate_info.size();
+    return getTemplateLibrary()->m_mapOfTemplate_info.size();
+  }
+
+  /*
+   * Current template library, kept alive as long as the returned pointer is held. Lock-free,
+   * can be called while another thread updates the templates.
+   */
+  inline std::shared_ptr<const TemplateLibrary_t> getTemplateLibrary() const {
+    return std::atomic_load(&m_library);
   }
 
   inline PyramidType getPyramidType() const {
@@ -319,14 +939,34 @@ public:
     return m_rejectionType;
   }
 
+  inline bool getUseCompactTemplates() const {
+    return m_useCompactTemplates;
+  }
+
   void loadTemplateData(const std::string &filename);
 
+  /*
+   * Read the template images and rois (template location, query ROI) of a file written by saveTemplateData,
+   * without preparing them.
+   */
+  static bool readTemplateData(const std::string &filename, std::map<int, cv::Mat> &mapOfTemplateImages,
+      std::map<int, std::pair<cv::Rect, cv::Rect> > &mapOfTemplateRois);
+
   void saveTemplateData(const std::string &filename, const bool saveSingleFile=true);
 
   inline void setCannyThreshold(const double threshold) {
     m_cannyThreshold = threshold;
   }
 
+  /*
+   * Executor of the parallel loops (e.g. SerialExecutor::getInstance() when the caller runs one detection per core,
+   * a CallbackExecutor on the pool of the application), NULL for Executor::getDefault().
+   * The executor must outlive the matcher.
+   */
+  inline void setExecutor(Executor *executor) {
+    m_executor = executor;
+  }
+
   inline void setGridDescritorSize(const cv::Size &size) {
     if(size.width > 0 && size.height > 0) {
       m_gridDescriptorSize = size;
@@ -335,6 +975,15 @@ public:
     }
   }
 
+  /*
+   * Allocator of the query planes, distance transform and Chamfer maps of the detection workspaces
+   * (e.g. PooledMatAllocator::getInstance()), NULL for the OpenCV default allocator.
+   * The allocator must outlive the workspaces.
+   */
+  inline void setMatAllocator(cv::MatAllocator *allocator) {
+    m_matAllocator = allocator;
+  }
+
   inline void setMatchingStrategyType(const MatchingStrategyType &type) {
     m_matchingStrategyType = type;
   }
@@ -362,6 +1011,13 @@ public:
     }
   }
 
+  /*
+   * Maximal number of threads of a parallel loop (calling thread included), 0 for the concurrency of the executor.
+   */
+  inline void setMaxParallelism(const int nb) {
+    m_maxParallelism = std::max(0, nb);
+  }
+
   inline void setMinNbDescriptorMatches(const int nb) {
     if(nb > 0 && nb <= m_gridDescriptorSize.width*m_gridDescriptorSize.height) {
       m_minNbDescriptorMatches = nb;
@@ -380,11 +1036,135 @@ public:
     m_rejectionType = type;
   }
 
+  /*
+   * Keep the cost maps of each template and scale of the detections in the workspace, in a compact form
+   * (see RetainedCostMaps), to extract the detections again with another threshold, grouping overlap or top-K
+   * without matching again (DetectionWorkspace::getRetainedCostMaps).
+   */
+  inline void setRetainCostMaps(const bool retain) {
+    m_retainCostMaps = retain;
+  }
+
+  /*
+   * Top-K / best-template mode: detect and detectMultiScale return at most the best detection of the
+   * k best templates. The scoring threads share the current k-th best cost to stop the computation of
+   * a location as soon as it cannot enter the top-k. The workspace keeps the templates often in the top-k
+   * to process them first in the next detections. 0 to disable.
+   */
+  inline void setTopK(const int k) {
+    if(k >= 0) {
+      m_topK = k;
+    } else {
+      std::cerr << "K cannot be negative !" << std::endl;
+    }
+  }
+
+  /*
+   * Prepare the templates with only the data read by the current matching type: the distance transform, edge
+   * orientation and mask images of the templates are released when not used (edgeMatching reads only the contour
+   * points and orientations). Set it and the matching type before preparing the templates (setTemplateImages,
+   * loadTemplateData); the templates must be prepared again to use another matching type.
+   */
+  inline void setUseCompactTemplates(const bool use) {
+    m_useCompactTemplates = use;
+  }
+
+  /*
+   * In detectMultiScale with the point set scaling, skip the locations of the intermediate scales whose cost
+   * cannot be below distanceThresh (or the top-K bound): the cost computed at the neighbouring anchor scales
+   * (see setScalePruningStride) bounds it from below, the detections are unchanged.
+   * No effect without setUsePointSetScaling: the templates prepared at each scale have their own contours.
+   */
+  inline void setUseScalePruning(const bool use) {
+    m_useScalePruning = use;
+  }
+
+  /*
+   * Time the stages of each detection in DetectionWorkspace::m_stageTimings.
+   */
+  inline void setUseStageTimings(const bool use) {
+    m_useStageTimings = use;
+  }
+
+  /*
+   * Record the spans of the detections, of the stages, of the (template, scale) jobs and of the chunks of rows
+   * run by each thread (NULL to stop). The recorder is shared by the copies of the matcher and must outlive
+   * the detections.
+   */
+  inline void setTraceRecorder(TraceRecorder *recorder) {
+    m_traceRecorder = recorder;
+  }
+
+  /*
+   * Accumulate the cost of each (template, scale) over the detections (NULL to stop). The report is shared by
+   * the copies of the matcher and must outlive the detections.
+   */
+  inline void setCostReport(TemplateCostReport *report) {
+    m_costReport = report;
+  }
+
+  /*
+   * In detect, scan location-major the templates of the same size, grid descriptor size and query ROI
+   * (e.g. a library of poses): at each location, the grid descriptors of the query are read once and all the
+   * templates of the group are scored while the distance transform neighbourhood is in the cache.
+   */
+  inline void setUseTemplateGroups(const bool use) {
+    m_useTemplateGroups = use;
+  }
+
+  /*
+   * In detectMultiScale, obtain the scales by scaling the contour points and the grid descriptors of the
+   * template at 100% around its center instead of preparing a template per scale: a single sweep of the
+   * window centers scores all the scales against the same distance transform neighbourhood and the
+   * templates at the other scales are not prepared. Used with edgeMatching, without pyramid.
+   */
+  inline void setUsePointSetScaling(const bool use) {
+    m_usePointSetScaling = use;
+    //Recompute the scale
+    setScale(m_scaleMin, m_scaleMax, m_scaleStep);
+  }
+
   void setScale(const int min, const int max, const int step);
 
+  /*
+   * Number of scales between two anchor scales, the anchors bound the cost of the others (see setUseScalePruning).
+   */
+  inline void setScalePruningStride(const int stride) {
+    if(stride > 1) {
+      m_scalePruningStride = stride;
+    } else {
+      std::cerr << "The stride should be > 1 !" << std::endl;
+    }
+  }
+
   void setTemplateImages(const std::map<int, cv::Mat> &mapOfTemplateImages,
       const std::map<int, std::pair<cv::Rect, cv::Rect> > &mapOfTemplateRois, const bool deepCopy=true);
 
+  /*
+   * Prepare the templates at all the scales in library as setTemplateImages does, without publishing it
+   * (see TemplateStore). Return false if a template has no rois.
+   */
+  bool buildTemplateLibrary(const std::map<int, cv::Mat> &mapOfTemplateImages,
+      const std::map<int, std::pair<cv::Rect, cv::Rect> > &mapOfTemplateRois, const bool deepCopy,
+      TemplateLibrary_t &library);
+
+  /*
+   * Atomically replace the template library. The detections in progress finish with the previous library.
+   * setTemplateImages, setScale and loadTemplateData build the new library aside and publish it with this
+   * method: they can run while other threads detect, but the updates must not run concurrently.
+   */
+  inline void setTemplateLibrary(const std::shared_ptr<const TemplateLibrary_t> &library) {
+    std::atomic_store(&m_library, library);
+  }
+
+  /*
+   * Deep copy of the current library written by a thread of the NUMA node, so that its pages are local to the
+   * workers pinned on this node (see NumaTopology). Return the current library on a single node machine.
+   * Give it with setTemplateLibrary to the copies of the matcher of these workers; a library published later
+   * (setTemplateImages, setScale, loadTemplateData) is not replicated.
+   */
+  std::shared_ptr<const TemplateLibrary_t> createTemplateLibraryReplica(const int node) const;
+
 #if DEBUG
   //DEBUG:
   bool m_debug;
@@ -393,8 +1173,16 @@ public:
 
 private:
 
-  void approximateContours(const std::vector<std::vector<cv::Point> > &contours,
-      std::vector<std::vector<Line_info_t> > &lines, const double epsilon=3.0);
+  inline Executor& getExecutor() const {
+    return m_executor != NULL ? *m_executor : *Executor::getDefault();
+  }
+
+  inline StageTimings_t* getStageTimings(DetectionWorkspace &workspace) const {
+    return m_useStageTimings ? &workspace.m_stageTimings : NULL;
+  }
+
+  void approximateContours(const CSRArray_t<cv::Point> &contours, CSRArray_t<Line_info_t> &lines,
+      const double epsilon=3.0) const;
 
   double computeChamferDistance(const Template_info_t &template_info, const Query_info_t &query_info,
       const int offsetX, const int offsetY,
@@ -402,7 +1190,8 @@ private:
       cv::Mat &img_res,
 #endif
       const bool useOrientation=false, const float lambda=5.0f,
-      const float weight_forward=1.0f, const float weight_backward=1.0f);
+      const float weight_forward=1.0f, const float weight_backward=1.0f,
+      const float maxCost=std::numeric_limits<float>::max());
 
   double computeFullChamferDistance(const Template_info_t &template_info, const Query_info_t &query_info,
       const int offsetX, const int offsetY,
@@ -411,29 +1200,162 @@ private:
 #endif
       const bool useOrientation=false, const float lambda=5.0f);
 
-  void computeMatchingMap(const Template_info_t &template_info, const Query_info_t &query_info, cv::Mat &chamferMap,
+  /*
+   * Return false if the deadline expired before the end, the remaining locations are left at the maximal cost.
+   */
+  bool computeMatchingMap(const Template_info_t &template_info, const Query_info_t &query_info, cv::Mat &chamferMap,
       cv::Mat &rejection_mask, const bool useOrientation=false, const int xStep=5, const int yStep=5,
-      const float lambda=5.0f, const float weight_forward=1.0f, const float weight_backward=1.0f);
+      const float lambda=5.0f, const float weight_forward=1.0f, const float weight_backward=1.0f,
+      TopKBound *topKBound=NULL, const int templateId=-1, const DetectionDeadline *deadline=NULL,
+      StageTimings_t *timings=NULL);
+
+  /*
+   * Compute the scale vector from [m_scaleMin ; m_scaleMax] and the template information of all the scales.
+   */
+  void computeScales(TemplateLibrary_t &library);
+
+  bool computeHalfRejectionMask(const Template_info_t &half_template_info, const Query_info_t &half_query_info,
+      const int half_scale, DetectionWorkspace &workspace, cv::Mat &half_rejection_mask, const bool useOrientation, const float distanceThresh,
+      const float lambda, const float weight_forward, const float weight_backward, const bool useGroupDetections,
+      float *bestCost=NULL);
+
+  /*
+   * Location-major matching of a group of templates of the same size, grid descriptor size and query ROI.
+   * Return false if the deadline expired before the end, the remaining locations are left at the maximal cost.
+   */
+  bool computeGroupMatchingMaps(const std::vector<const Template_info_t*> &templates,
+      const std::vector<int> &templateIds, const Query_info_t &query_info, std::vector<cv::Mat> &chamferMaps,
+      std::vector<cv::Mat> &rejection_masks, const bool useOrientation, const int xStep, const int yStep,
+      const float lambda, const float weight_forward, const float weight_backward, TopKBound *topKBound,
+      const DetectionDeadline *deadline);
+
+  /*
+   * Chamfer maps of all the scales of a template from its point set at 100% (see setUsePointSetScaling).
+   * With useScalePruning, the locations of the intermediate scales that cannot be below distanceThresh are left
+   * at the maximal cost (see setUseScalePruning).
+   * Return false if the deadline expired before the end, the remaining locations are left at the maximal cost.
+   */
+  bool computeScaledMatchingMaps(const Template_info_t &template_info, const int templateId,
+      const std::vector<ScaledPointSet_t> &pointSets, const Query_info_t &query_info,
+      std::vector<cv::Mat> &chamferMaps, const bool useOrientation, const int xStep, const int yStep,
+      const float lambda, const float weight_forward, const bool useScalePruning, const float distanceThresh,
+      TopKBound *topKBound, const DetectionDeadline *deadline);
+
+  /*
+   * Chamfer cost at one location, for the current matching type.
+   */
+  double computeLocationCost(const Template_info_t &template_info, const Query_info_t &query_info,
+      const int offsetX, const int offsetY, const bool useOrientation, const float lambda,
+      const float weight_forward, const float weight_backward,
+      const float maxCost=std::numeric_limits<float>::max());
 
   void computeRejectionMask(const Template_info_t &template_info, const Query_info_t &query_info,
       cv::Mat &rejection_mask, const int startI, const int endI, const int yStep, const int startJ,
       const int endJ, const int xStep);
 
-  void detect_impl(const Template_info_t &template_info, const Query_info_t &query_info, const int scale,
-      std::vector<Detection_t> &currentDetections, cv::Mat &rejection_mask, const bool useOrientation,
+  /*
+   * Detection on the query of the loader or on the prepared query (one of them is NULL).
+   */
+  bool detectQuery(QueryImageLoader *query_loader, const PreparedQuery_t *prepared_query,
+      DetectionWorkspace &workspace, const DetectionDeadline &deadline, std::vector<Detection_t> &detections,
+      const bool useOrientation, const float distanceThresh, const float lambda, const float weight_forward,
+      const float weight_backward, const bool useGroupDetections);
+
+  bool detectMultiScaleQuery(QueryImageLoader *query_loader, const PreparedQuery_t *prepared_query,
+      DetectionWorkspace &workspace, const DetectionDeadline &deadline, std::vector<Detection_t> &detections,
+      const bool useOrientation, const float distanceThresh, const float lambda, const float weight_forward,
+      const float weight_backward, const bool useNonMaximaSuppression, const bool useGroupDetections);
+
+  /*
+   * Return false if the deadline expired before the end of the matching.
+   */
+  bool detect_impl(const Template_info_t &template_info, const Query_info_t &query_info, const int scale,
+      DetectionWorkspace &workspace, std::vector<Detection_t> &currentDetections, cv::Mat &rejection_mask, const bool useOrientation,
       const float distanceThresh, const float lambda=5.0f, const float weight_forward=1.0f,
-      const float weight_backward=1.0f, const bool useGroupDetections=true);
+      const float weight_backward=1.0f, const bool useGroupDetections=true, TopKBound *topKBound=NULL,
+      const int templateId=-1, const DetectionDeadline *deadline=NULL);
 
-  void groupDetections(const std::vector<Detection_t> &detections, std::vector<Detection_t> &groupedDetections,
-      const double overlapPercentage=0.5);
+  /*
+   * Extract the detections (minima of the Chamfer map below distanceThresh), the Chamfer map is modified.
+   */
+  void extractDetections(const cv::Size &templateSize, cv::Mat &chamferMap, const int scale,
+      DetectionWorkspace &workspace, std::vector<Detection_t> &currentDetections, cv::Mat &rejection_mask,
+      const float distanceThresh, const bool useGroupDetections, const int templateId=-1);
+
+  /*
+   * Groups of template ids processed together in detect, in the processing order of their first template.
+   * Without m_useTemplateGroups, one group per template.
+   */
+  void getTemplateGroups(const TemplateLibrary_t &library, const std::vector<int> &templateOrder, const int scale,
+      std::vector<std::vector<int> > &templateGroups) const;
+
+  /*
+   * Scale the contour points and the grid descriptors of the template at 100% around its center.
+   */
+  static void getScaledPointSets(const Template_info_t &template_info, const std::vector<int> &scaleVector,
+      std::vector<ScaledPointSet_t> &pointSets);
+
+  /*
+   * Template ids in the processing order: by increasing best cost at the half resolution when known
+   * (mapOfCoarseCosts), then by decreasing number of hits (mapOfTemplateHits) in the top-K mode.
+   */
+  void getTemplateOrder(const TemplateLibrary_t &library, const std::map<int, float> &mapOfCoarseCosts,
+      const std::map<int, int> &mapOfTemplateHits, std::vector<int> &templateOrder) const;
+
+  /*
+   * Number of windows of the step grid scanned for a template on a Chamfer map of the given size.
+   */
+  double countQueryWindows(const Template_info_t &template_info, const cv::Size &mapSize, const int xStep=5,
+      const int yStep=5) const;
+
+  /*
+   * Add to the cost report the Chamfer map of a template at a scale.
+   */
+  void addTemplateCost(const Template_info_t &template_info, const int templateId, const int scale,
+      const cv::Size &mapSize, const double nbScoredWindows, const size_t nbPoints, const double time,
+      const size_t nbDetections) const;
+
+  /*
+   * Number of template points scored per window: contour points, or lines with the line matching types.
+   */
+  size_t getNbPoints(const Template_info_t &template_info) const;
+
+  /*
+   * Rejection mask of a template at the regular resolution: the half resolution mask if computed, all ones otherwise.
+   */
+  void initRejectionMask(const DetectionWorkspace &workspace, const Template_info_t &template_info,
+      cv::Mat &rejection_mask) const;
+
+  /*
+   * Keep the best detection of each template and the K best overall, update the hit history of the workspace.
+   */
+  void retainTopK(DetectionWorkspace &workspace, std::vector<Detection_t> &detections) const;
 
   void retainDetections(std::vector<Detection_t> &bbDetections, const float threshold);
 
   void nonMaximaSuppression(const std::vector<Detection_t> &detections, std::vector<Detection_t> &maximaDetections);
 
-  Query_info_t prepareQuery(const cv::Mat &img_query);
+  const Query_info_t* getQueryInfo(QueryImageLoader *query_loader, const PreparedQuery_t *prepared_query,
+      DetectionWorkspace &workspace, const int reduction) const;
+
+  Query_info_t prepareQuery(const cv::Mat &img_query) const;
+  /*
+   * Prepare the query in place, reusing the buffers of query_info. The substages are timed if timings is not NULL.
+   */
+  void prepareQuery(const cv::Mat &img_query, Query_info_t &query_info, cv::Mat &edge_query,
+      StageTimings_t *timings=NULL) const;
   Template_info_t prepareTemplate(const cv::Mat &img_template);
 
+  /*
+   * Release the template images not used by the matching type.
+   */
+  void compactTemplate(Template_info_t &template_info) const;
+
+  /*
+   * False if the templates of the library were prepared compact for another matching type.
+   */
+  bool hasTemplateMaps(const TemplateLibrary_t &library) const;
+
 
   //! Threshold for Canny edge detection.
   double m_cannyThreshold;
@@ -452,16 +1374,10 @@ private:
   //! Structure that contains all the information about the query images.
   //  Query_info_t m_query_info;
 
-  //XXX: just for saving video
-public:
-  //! Map that contains all the information about the template images and at different scales.
-  std::map<int, std::map<int, Template_info_t> > m_mapOfTemplate_info;
-
-  //! Map that contains as a key the template id and as a value the template image.
-  std::map<int, cv::Mat> m_mapOfTemplateImages;
-private:
-
-  //! LUT that maps an angle in degree to a cluster index.
+  //! Template library (template information at the different scales, template images, scales), never
+  //  modified once published: use getTemplateLibrary / setTemplateLibrary.
+  std::shared_ptr<const TemplateLibrary_t> m_library;
+  //! LUT that maps an angle in degree to a cluster index, built by the constructors and read-only afterwards.
   std::vector<int> m_orientationLUT;
   //! Pyramid type to use.
   PyramidType m_pyramidType;
@@ -473,8 +1389,32 @@ private:
   int m_scaleMin;
   //! Scale step as percentage (10 for example).
   int m_scaleStep;
-  //! Vector of scales to use for the detectMultiScale.
-  std::vector<int> m_scaleVector;
+  //! Number of scales between two anchor scales.
+  size_t m_scalePruningStride;
+  //! Skip the locations of the intermediate scales whose cost bounded from the anchor scales is too high.
+  bool m_useScalePruning;
+  //! Scan location-major the templates of the same size in detect.
+  bool m_useTemplateGroups;
+  //! Score the scales of detectMultiScale from the point set of the template at 100%.
+  bool m_usePointSetScaling;
+  //! Keep the cost maps of the detections in the workspace.
+  bool m_retainCostMaps;
+  //! Time the detection stages in the workspace.
+  bool m_useStageTimings;
+  //! Spans of the detections, not owned.
+  TraceRecorder *m_traceRecorder;
+  //! Cost of each (template, scale), not owned.
+  TemplateCostReport *m_costReport;
+  //! Number of templates to retrieve in the top-K mode (0 if disabled).
+  size_t m_topK;
+  //! Allocator of the workspace buffers (NULL for the OpenCV default allocator).
+  cv::MatAllocator *m_matAllocator;
+  //! Executor of the parallel loops (NULL for Executor::getDefault()).
+  Executor *m_executor;
+  //! Maximal number of threads of a parallel loop (0 for the concurrency of the executor).
+  int m_maxParallelism;
+  //! Release the template images not used by the matching type.
+  bool m_useCompactTemplates;
 };
 
 #endif
@@ -0,0 +1,135 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __DetectionWriter_h__
+#define __DetectionWriter_h__
+
+#include <condition_variable>
+#include <istream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Chamfer.hpp"
+
+
+/*
+ * Detections found in one image.
+ */
+struct DetectionRecord_t {
+  //! Image name (path, frame id, ...).
+  std::string m_source;
+  //! Image index in the processed sequence.
+  int m_frame;
+  //! Detections.
+  std::vector<Detection_t> m_detections;
+  //! Optional timing statistics in ms (name, time).
+  std::vector<std::pair<std::string, double> > m_timings;
+
+  DetectionRecord_t() : m_source(), m_frame(-1), m_detections(), m_timings() {
+  }
+
+  DetectionRecord_t(const std::string &source, const int frame, const std::vector<Detection_t> &detections)
+  : m_source(source), m_frame(frame), m_detections(detections), m_timings() {
+  }
+};
+
+/*
+ * Structured output sink for the detections.
+ * The records are serialized by the caller and written to the output by a background thread,
+ * so writing never waits on the disk or the pipe.
+ *
+ * binaryFormat: header (magic "CHDT", version) then length-prefixed records, host byte order:
+ *   int payloadLength | int frame | int sourceLength | source | int nbDetections |
+ *   nbDetections x (int x, int y, int width, int height, float chamferDist, int scale, int templateIndex) |
+ *   int nbTimings | nbTimings x (int nameLength, name, double time)
+ * ndjsonFormat: one JSON object per line:
+ *   {"source":"...","frame":0,"detections":[{"x":0,"y":0,"width":0,"height":0,"dist":0,"scale":100,"template":1}],
+ *    "timings":{"detect":12.3}}
+ */
+class DetectionWriter {
+public:
+  enum FormatType {
+    binaryFormat,
+    ndjsonFormat
+  };
+
+  static const int binaryMagic = 0x54444843; //"CHDT"
+  static const int binaryVersion = 1;
+
+  DetectionWriter();
+  ~DetectionWriter();
+
+  /*
+   * Flush the pending records and stop the background thread.
+   */
+  void close();
+
+  inline FormatType getFormat() const {
+    return m_format;
+  }
+
+  inline bool isOpen() const {
+    return m_fd >= 0;
+  }
+
+  /*
+   * Open the output file ("-" for the standard output) and start the background thread.
+   * maxPendingBytes bounds the memory used when the output is slower than the producers:
+   * above this size write() waits for the background thread.
+   */
+  bool open(const std::string &filename, const FormatType &format, const size_t maxPendingBytes=64*1024*1024);
+
+  /*
+   * Read the next record of a binary stream (the header must have been read with readBinaryHeader).
+   */
+  static bool readBinaryHeader(std::istream &stream);
+  static bool readBinaryRecord(std::istream &stream, DetectionRecord_t &record);
+
+  static void serialize(const DetectionRecord_t &record, const FormatType &format, std::string &buffer);
+
+  /*
+   * Thread safe.
+   */
+  void write(const DetectionRecord_t &record);
+
+private:
+  void writerLoop();
+
+  //! Output format.
+  FormatType m_format;
+  //! Output file descriptor.
+  int m_fd;
+  //! True if m_fd must be closed (not the standard output).
+  bool m_ownFd;
+  //! Serialized records waiting to be written.
+  std::string m_pending;
+  //! Maximal size of m_pending before write() waits.
+  size_t m_maxPendingBytes;
+  //! Protect m_pending and m_stop.
+  std::mutex m_mutex;
+  //! Signal new data to the writer thread / free space to the producers.
+  std::condition_variable m_condition;
+  //! Ask the writer thread to flush and exit.
+  bool m_stop;
+  //! Background writer thread.
+  std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,138 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __Executor_h__
+#define __Executor_h__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*
+ * Runs the parallel loops of ChamferMatcher and HOGDetector.
+ * parallelFor splits the range in chunks processed by the calling thread and by up to maxParallelism-1
+ * tasks submitted to the executor; a task that finds no chunk left returns immediately, so the call does not
+ * depend on the availability of the executor threads. A parallelFor called from a chunk (nested loop, e.g. the
+ * scales of HOGDetector::detectMultiScale around the locations of detect_impl) runs on the calling thread.
+ */
+class Executor {
+public:
+  virtual ~Executor();
+
+  /*
+   * Number of threads that can run the submitted tasks.
+   */
+  virtual int getConcurrency() const = 0;
+
+  /*
+   * Call func(first, last) on consecutive sub-ranges covering [begin, end) and return when all are done.
+   * maxParallelism: maximal number of threads (calling thread included), 0 for the concurrency of the executor.
+   * If func (or submit) throws, the chunks not started are skipped and the first exception is rethrown once no
+   * thread runs func anymore.
+   */
+  void parallelFor(const int begin, const int end, const std::function<void(int, int)> &func,
+      const int maxParallelism=0);
+
+  /*
+   * Shared thread pool with one thread per core, never destroyed.
+   */
+  static Executor* getDefault();
+
+protected:
+  /*
+   * Run the task on another thread.
+   */
+  virtual void submit(const std::function<void()> &task) = 0;
+};
+
+/*
+ * Everything runs on the calling thread, e.g. when the caller already runs one detection per core.
+ */
+class SerialExecutor : public Executor {
+public:
+  virtual int getConcurrency() const;
+
+  /*
+   * Shared instance, never destroyed.
+   */
+  static SerialExecutor* getInstance();
+
+protected:
+  virtual void submit(const std::function<void()> &task);
+};
+
+/*
+ * Built-in thread pool.
+ */
+class ThreadPoolExecutor : public Executor {
+public:
+  /*
+   * nbThreads: number of threads, 0 for the number of cores.
+   */
+  explicit ThreadPoolExecutor(const int nbThreads=0);
+
+  virtual ~ThreadPoolExecutor();
+
+  virtual int getConcurrency() const;
+
+protected:
+  virtual void submit(const std::function<void()> &task);
+
+private:
+  ThreadPoolExecutor(const ThreadPoolExecutor &);
+  ThreadPoolExecutor& operator=(const ThreadPoolExecutor &);
+
+  void run();
+
+  std::vector<std::thread> m_threads;
+  //! Tasks waiting for a thread.
+  std::deque<std::function<void()> > m_tasks;
+  //! Protect m_tasks and m_stop.
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  bool m_stop;
+};
+
+/*
+ * Tasks submitted to a thread pool of the application (e.g. the pool of a service).
+ */
+class CallbackExecutor : public Executor {
+public:
+  typedef std::function<void(const std::function<void()> &)> SubmitFunction_t;
+
+  /*
+   * submit: enqueue a task in the application pool.
+   * concurrency: number of threads of the application pool to use.
+   */
+  CallbackExecutor(const SubmitFunction_t &submit, const int concurrency);
+
+  virtual int getConcurrency() const;
+
+protected:
+  virtual void submit(const std::function<void()> &task);
+
+private:
+  SubmitFunction_t m_submit;
+  int m_concurrency;
+};
+
+#endif
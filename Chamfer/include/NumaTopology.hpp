@@ -0,0 +1,83 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __NumaTopology_h__
+#define __NumaTopology_h__
+
+#include <functional>
+#include <vector>
+
+
+/*
+ * NUMA nodes and their CPUs (Linux sysfs, restricted to the CPUs the process may run on), to pin the workers
+ * and to place their data on their node by first touch (the default Linux memory policy allocates a page on
+ * the node of the thread that writes it first). Without sysfs or with a single node, there is one node and
+ * pinning does nothing.
+ */
+class NumaTopology {
+public:
+  /*
+   * Topology detected at the first call.
+   */
+  static const NumaTopology& getInstance();
+
+  inline int getNbNodes() const {
+    return (int) m_nodeCpus.size();
+  }
+
+  /*
+   * True with more than one node.
+   */
+  inline bool isNuma() const {
+    return m_nodeCpus.size() > 1;
+  }
+
+  /*
+   * CPUs of the node (empty for the single node fallback).
+   */
+  inline const std::vector<int>& getNodeCpus(const int node) const {
+    return m_nodeCpus[node];
+  }
+
+  /*
+   * Node of the worker of the given index: the workers are spread round robin over the nodes.
+   */
+  inline int getWorkerNode(const int worker) const {
+    return worker % getNbNodes();
+  }
+
+  /*
+   * Restrict the calling thread to the CPUs of the node. Return false if the affinity cannot be set,
+   * true without doing anything on a single node machine.
+   */
+  bool pinCurrentThread(const int node) const;
+
+  /*
+   * Run func on a thread pinned to the node and wait for it, so that the memory it writes first is allocated
+   * on the node. On a single node machine, run func on the calling thread.
+   */
+  void runOnNode(const int node, const std::function<void()> &func) const;
+
+private:
+  NumaTopology();
+
+  //! CPUs of each node.
+  std::vector<std::vector<int> > m_nodeCpus;
+};
+
+#endif
@@ -0,0 +1,184 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __ParameterSweep_h__
+#define __ParameterSweep_h__
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "Chamfer.hpp"
+
+
+struct SweepConfig_t {
+  //! Canny threshold of the templates and the queries.
+  double m_cannyThreshold;
+  ChamferMatcher::MatchingType m_matchingType;
+  float m_lambda;
+  float m_distanceThresh;
+
+  SweepConfig_t()
+    : m_cannyThreshold(50.0), m_matchingType(ChamferMatcher::edgeMatching), m_lambda(5.0f), m_distanceThresh(50.0f) {
+  }
+};
+
+/*
+ * Parameter grid: every combination of the values is evaluated.
+ */
+struct SweepGrid_t {
+  std::vector<double> m_cannyThresholds;
+  std::vector<ChamferMatcher::MatchingType> m_matchingTypes;
+  std::vector<float> m_lambdas;
+  std::vector<float> m_distanceThresholds;
+
+  SweepGrid_t() : m_cannyThresholds(), m_matchingTypes(), m_lambdas(), m_distanceThresholds() {
+  }
+
+  /*
+   * Combinations ordered by Canny threshold (the configurations that share the prepared artifacts are contiguous).
+   * An empty list of values takes the default value of SweepConfig_t.
+   */
+  std::vector<SweepConfig_t> getConfigs() const;
+};
+
+struct SweepSample_t {
+  //! Image path, for the report.
+  std::string m_path;
+  cv::Mat m_img;
+  //! Ground truth bounding boxes.
+  std::vector<cv::Rect> m_groundTruth;
+
+  SweepSample_t() : m_path(), m_img(), m_groundTruth() {
+  }
+};
+
+struct SweepResult_t {
+  SweepConfig_t m_config;
+  int m_nbImages;
+  int m_nbGroundTruth;
+  //! Ground truth boxes matched by at least one detection.
+  int m_nbFound;
+  int m_nbDetections;
+  //! Detections that match a ground truth box.
+  int m_nbTruePositives;
+  //! Detection latency per image in ms (the query preparation is shared and not included).
+  double m_meanTime;
+  double m_p95Time;
+  double m_maxTime;
+
+  SweepResult_t()
+    : m_config(), m_nbImages(0), m_nbGroundTruth(0), m_nbFound(0), m_nbDetections(0), m_nbTruePositives(0),
+      m_meanTime(0.0), m_p95Time(0.0), m_maxTime(0.0) {
+  }
+
+  inline double getPrecision() const {
+    return m_nbDetections > 0 ? m_nbTruePositives / (double) m_nbDetections : 0.0;
+  }
+
+  inline double getRecall() const {
+    return m_nbGroundTruth > 0 ? m_nbFound / (double) m_nbGroundTruth : 0.0;
+  }
+};
+
+/*
+ * Evaluate a parameter grid on a dataset without preparing the same artifacts for every configuration:
+ * the templates are prepared once per Canny threshold and the queries once per image and Canny threshold,
+ * the other parameters (matching type, lambda, distance threshold) only change the matching.
+ * The configurations of a Canny threshold run in parallel, each on its own copy of the matcher
+ * (the template library is shared) and its own DetectionWorkspace.
+ * The other settings (scales, pyramid, rejection, top-K, ...) are taken from the prototype matcher.
+ * With several threads, the matchers run their parallel loops serially (SerialExecutor). With compact templates
+ * (setUseCompactTemplates), the grid must keep the matching type of the prototype.
+ */
+class ParameterSweep {
+public:
+  explicit ParameterSweep(const ChamferMatcher &prototype);
+
+  /*
+   * Evaluate the configurations of the grid on the samples with the templates of templateFilename
+   * (loadTemplateData). One result per configuration, in the order of grid.getConfigs().
+   */
+  bool run(const std::string &templateFilename, const std::vector<SweepSample_t> &samples, const SweepGrid_t &grid,
+      std::vector<SweepResult_t> &results);
+
+  /*
+   * Count the ground truth boxes matched by a detection and the detections that match a ground truth box
+   * (intersection over union >= minOverlap).
+   */
+  static void evaluate(const std::vector<Detection_t> &detections, const std::vector<cv::Rect> &groundTruth,
+      const double minOverlap, int &nbFound, int &nbTruePositives);
+
+  /*
+   * Query preparation time (all the images and Canny thresholds) of the last run in ms.
+   */
+  inline double getQueryPreparationTime() const {
+    return m_queryPreparationTime;
+  }
+
+  /*
+   * Template preparation time (all the Canny thresholds) of the last run in ms.
+   */
+  inline double getTemplatePreparationTime() const {
+    return m_templatePreparationTime;
+  }
+
+  /*
+   * Number of images prepared and kept in memory at the same time (a prepared query holds
+   * the integral distance transforms, ~100 bytes per pixel).
+   */
+  inline void setChunkSize(const int size) {
+    m_chunkSize = std::max(1, size);
+  }
+
+  inline void setMinOverlap(const double overlap) {
+    m_minOverlap = overlap;
+  }
+
+  inline void setMultiScale(const bool multiScale) {
+    m_multiScale = multiScale;
+  }
+
+  /*
+   * Number of threads, 0 for the number of cores.
+   */
+  inline void setNbWorkers(const int nb) {
+    m_nbWorkers = std::max(0, nb);
+  }
+
+  inline void setUseGroupDetections(const bool use) {
+    m_useGroupDetections = use;
+  }
+
+  inline void setUseOrientation(const bool use) {
+    m_useOrientation = use;
+  }
+
+private:
+  //! Matcher whose settings are used for every configuration.
+  ChamferMatcher m_prototype;
+  int m_chunkSize;
+  double m_minOverlap;
+  bool m_multiScale;
+  int m_nbWorkers;
+  double m_queryPreparationTime;
+  double m_templatePreparationTime;
+  bool m_useGroupDetections;
+  bool m_useOrientation;
+};
+
+#endif
@@ -0,0 +1,103 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __PerfCounters_h__
+#define __PerfCounters_h__
+
+#include <algorithm>
+
+
+/*
+ * Values of the hardware counters, scaled when the kernel multiplexed them (< 0 if not available).
+ */
+struct PerfCounterValues_t {
+  enum Counter {
+    cyclesCounter,
+    instructionsCounter,
+    //! Last level cache misses.
+    cacheMissesCounter,
+    //! dTLB read misses.
+    dtlbMissesCounter,
+    branchMissesCounter,
+    nbCounters
+  };
+
+  double m_values[nbCounters];
+
+  PerfCounterValues_t() {
+    clear();
+  }
+
+  /*
+   * Add end - start of the counters available in both.
+   */
+  inline void addDelta(const PerfCounterValues_t &start, const PerfCounterValues_t &end) {
+    for(int i = 0; i < nbCounters; i++) {
+      if(start.m_values[i] >= 0.0 && end.m_values[i] >= 0.0) {
+        m_values[i] = std::max(m_values[i], 0.0) + (end.m_values[i] - start.m_values[i]);
+      }
+    }
+  }
+
+  inline void add(const PerfCounterValues_t &values) {
+    for(int i = 0; i < nbCounters; i++) {
+      if(values.m_values[i] >= 0.0) {
+        m_values[i] = std::max(m_values[i], 0.0) + values.m_values[i];
+      }
+    }
+  }
+
+  inline void clear() {
+    std::fill(m_values, m_values + nbCounters, -1.0);
+  }
+
+  static const char* getCounterName(const Counter counter);
+};
+
+/*
+ * Linux perf_event_open counters of the thread that created the object, counting in user space.
+ * The counters that cannot be opened (other OS, perf_event_paranoid, no PMU in a virtual machine) are reported
+ * as not available, the measure goes on with the others. The object must be read from its creation thread.
+ */
+class PerfCounters {
+public:
+  PerfCounters();
+
+  ~PerfCounters();
+
+  /*
+   * True if at least one counter is available.
+   */
+  bool isAvailable() const;
+
+  bool isAvailable(const PerfCounterValues_t::Counter counter) const;
+
+  /*
+   * Current values since the creation.
+   */
+  void read(PerfCounterValues_t &values) const;
+
+private:
+  PerfCounters(const PerfCounters &);
+  PerfCounters& operator=(const PerfCounters &);
+
+  //! File descriptor of each counter, -1 if not available.
+  int m_fds[PerfCounterValues_t::nbCounters];
+};
+
+#endif
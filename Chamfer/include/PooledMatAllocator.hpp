@@ -0,0 +1,88 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __PooledMatAllocator_h__
+#define __PooledMatAllocator_h__
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+
+/*
+ * cv::MatAllocator that returns 64-byte aligned buffers and keeps the released buffers in a pool
+ * to reuse them for the next allocation of the same rounded size (e.g. the query planes of the next frame).
+ * Buffers of at least 2 MB are aligned on 2 MB and advised as transparent huge pages (MADV_HUGEPAGE)
+ * to reduce the TLB misses of the scattered distance transform reads.
+ * The allocator must outlive the matrices it allocated, use getInstance() unless the lifetime is controlled.
+ */
+class PooledMatAllocator : public cv::MatAllocator {
+public:
+#if CV_MAJOR_VERSION >= 4
+  typedef cv::AccessFlag AccessFlag_t;
+#else
+  typedef int AccessFlag_t;
+#endif
+
+  /*
+   * maxCachedBytes: maximal size of the released buffers kept in the pool.
+   */
+  explicit PooledMatAllocator(const size_t maxCachedBytes=512*1024*1024);
+
+  virtual ~PooledMatAllocator();
+
+  virtual cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AccessFlag_t flags,
+      cv::UMatUsageFlags usageFlags) const;
+
+  virtual bool allocate(cv::UMatData* data, AccessFlag_t accessflags, cv::UMatUsageFlags usageFlags) const;
+
+  virtual void deallocate(cv::UMatData* data) const;
+
+  /*
+   * Size of the released buffers currently kept in the pool.
+   */
+  size_t getCachedBytes() const;
+
+  /*
+   * Shared allocator, never destroyed.
+   */
+  static PooledMatAllocator* getInstance();
+
+  /*
+   * Free the buffers kept in the pool.
+   */
+  void releaseCachedBuffers();
+
+private:
+  PooledMatAllocator(const PooledMatAllocator &);
+  PooledMatAllocator& operator=(const PooledMatAllocator &);
+
+  static size_t roundSize(const size_t size);
+
+  //! Key: rounded size - Value: released buffers.
+  mutable std::map<size_t, std::vector<uchar*> > m_mapOfFreeBuffers;
+  //! Size of the buffers in m_mapOfFreeBuffers.
+  mutable size_t m_cachedBytes;
+  //! Maximal size of the buffers in m_mapOfFreeBuffers.
+  size_t m_maxCachedBytes;
+  //! Protect m_mapOfFreeBuffers and m_cachedBytes.
+  mutable std::mutex m_mutex;
+};
+
+#endif
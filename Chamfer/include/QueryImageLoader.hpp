@@ -0,0 +1,73 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __QueryImageLoader_h__
+#define __QueryImageLoader_h__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+
+/*
+ * Lazily decode a query image at the resolutions requested by the detection.
+ * The reduced levels (1/2, 1/4, 1/8) are decoded directly with cv::IMREAD_REDUCED_*
+ * (DCT scaling for JPEG) instead of decoding the full resolution and calling cv::pyrDown.
+ * The full resolution is decoded only if getImage(1) is called.
+ */
+class QueryImageLoader {
+public:
+  /*
+   * Decode from a file.
+   */
+  explicit QueryImageLoader(const std::string &filename, const bool grayscale=false);
+
+  /*
+   * Decode from an encoded buffer (JPEG, PNG, ...).
+   */
+  explicit QueryImageLoader(const std::vector<uchar> &buffer, const bool grayscale=false);
+
+  /*
+   * Already decoded image: the reduced levels are computed with cv::pyrDown.
+   */
+  explicit QueryImageLoader(const cv::Mat &img);
+
+  /*
+   * Return the image reduced by the given factor (1, 2, 4 or 8), empty if the image cannot be decoded.
+   */
+  const cv::Mat& getImage(const int reduction=1);
+
+  inline bool isDecoded(const int reduction) const {
+    return m_mapOfLevels.find(reduction) != m_mapOfLevels.end();
+  }
+
+private:
+  cv::Mat decode(const int flags) const;
+
+  //! Image filename (empty if decoded from m_buffer or given as a cv::Mat).
+  std::string m_filename;
+  //! Encoded image.
+  std::vector<uchar> m_buffer;
+  //! Decode in grayscale instead of color.
+  bool m_grayscale;
+  //! Key: reduction factor - Value: decoded image.
+  std::map<int, cv::Mat> m_mapOfLevels;
+};
+
+#endif
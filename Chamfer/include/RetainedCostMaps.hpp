@@ -0,0 +1,106 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __RetainedCostMaps_h__
+#define __RetainedCostMaps_h__
+
+#include <vector>
+#include "Chamfer.hpp"
+
+
+/*
+ * Chamfer map of one template at one scale, stored by blocks of stride x stride locations:
+ * the minimal cost of each block and the position of this minimum in the block.
+ */
+struct RetainedCostMap_t {
+  int m_templateIndex;
+  //! Scale as percentage.
+  int m_scale;
+  cv::Size m_templateSize;
+  //! Size of the Chamfer map.
+  cv::Size m_mapSize;
+  //! Minimal cost of each block (CV_32F).
+  cv::Mat m_blockCosts;
+  //! Position of the minimum in the block, dy*stride + dx (CV_8U).
+  cv::Mat m_blockOffsets;
+
+  RetainedCostMap_t()
+    : m_templateIndex(-1), m_scale(100), m_templateSize(), m_mapSize(), m_blockCosts(), m_blockOffsets() {
+  }
+};
+
+/*
+ * Cost maps of a detection (see ChamferMatcher::setRetainCostMaps), to extract the detections again
+ * with another distance threshold, another grouping overlap or a top-K without matching again.
+ * detect and detectMultiScale compute the Chamfer map every 5 locations (one location per 5x5 block),
+ * the compact form is then lossless with stride=5 and 25 times smaller than the Chamfer maps.
+ * The locations rejected during the detection (pyramid, scale pruning, top-K bound) are at the maximal cost:
+ * a threshold above the one of the detection may miss detections, detect with the largest threshold of interest.
+ */
+class RetainedCostMaps {
+public:
+  /*
+   * distanceThresh: threshold of the detection.
+   * stride: block size (<= 16).
+   */
+  explicit RetainedCostMaps(const float distanceThresh=50.0f, const int stride=5);
+
+  /*
+   * Compact and add the Chamfer map (not modified) of a template at a scale.
+   */
+  void add(const int templateIndex, const int scale, const cv::Size &templateSize, const cv::Mat &chamferMap);
+
+  /*
+   * Detections below distanceThresh, as extracted by detect / detectMultiScale: minima of each map, grouped
+   * with groupOverlap if useGroupDetections, sorted by increasing cost. With topK > 0, only the best detection
+   * of the topK best templates.
+   */
+  void detect(const float distanceThresh, std::vector<Detection_t> &detections, const bool useGroupDetections=true,
+      const double groupOverlap=0.5, const int topK=0) const;
+
+  inline const std::vector<RetainedCostMap_t>& getCostMaps() const {
+    return m_costMaps;
+  }
+
+  /*
+   * Chamfer map of the given index in getCostMaps(), the locations not computed are at the maximal cost.
+   */
+  void getCostMap(const size_t index, cv::Mat &chamferMap) const;
+
+  inline float getDistanceThreshold() const {
+    return m_distanceThresh;
+  }
+
+  /*
+   * Size of the retained maps in bytes.
+   */
+  size_t getMemorySize() const;
+
+  inline int getStride() const {
+    return m_stride;
+  }
+
+private:
+  //! Threshold of the detection.
+  float m_distanceThresh;
+  //! Block size.
+  int m_stride;
+  std::vector<RetainedCostMap_t> m_costMaps;
+};
+
+#endif
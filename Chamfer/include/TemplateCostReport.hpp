@@ -0,0 +1,96 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __TemplateCostReport_h__
+#define __TemplateCostReport_h__
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/*
+ * Cost of a template at a scale accumulated over the detections.
+ */
+struct TemplateCost_t {
+  int m_templateIndex;
+  //! Scale as percentage.
+  int m_scale;
+  //! Number of Chamfer maps computed.
+  long long m_nbCalls;
+  //! Template windows of the 5x5 grid in the query ROI.
+  double m_nbWindows;
+  //! Windows whose cost was computed (not rejected).
+  double m_nbScoredWindows;
+  //! Template points (or lines with the line matching types) of the scored windows.
+  double m_nbPoints;
+  //! Time in ms (shared equally by the templates of a group or the scales of a point set).
+  double m_time;
+  //! Detections after the grouping, before the non maxima suppression between the templates and scales.
+  long long m_nbDetections;
+
+  TemplateCost_t() : m_templateIndex(-1), m_scale(100), m_nbCalls(0), m_nbWindows(0.0), m_nbScoredWindows(0.0),
+    m_nbPoints(0.0), m_time(0.0), m_nbDetections(0) {
+  }
+
+  inline double getRejectionRate() const {
+    return m_nbWindows > 0.0 ? 1.0 - m_nbScoredWindows / m_nbWindows : 0.0;
+  }
+};
+
+/*
+ * Per (template, scale) cost accounting of the detections (see ChamferMatcher::setCostReport), shared by
+ * the copies of the matcher, to find the templates and scales that dominate the runtime without producing
+ * detections and prune or re-tune them.
+ */
+class TemplateCostReport {
+public:
+  TemplateCostReport();
+
+  /*
+   * Thread safe.
+   */
+  void add(const int templateIndex, const int scale, const double nbWindows, const double nbScoredWindows,
+      const double nbPoints, const double time, const size_t nbDetections);
+
+  void clear();
+
+  /*
+   * Costs by decreasing time.
+   */
+  void getCosts(std::vector<TemplateCost_t> &costs) const;
+
+  double getTotalTime() const;
+
+  /*
+   * Write the costs by decreasing time as a tab separated table, "-" for stdout.
+   */
+  bool write(const std::string &filename) const;
+
+private:
+  TemplateCostReport(const TemplateCostReport &);
+  TemplateCostReport& operator=(const TemplateCostReport &);
+
+  //! Key: (template index, scale).
+  std::map<std::pair<int, int>, TemplateCost_t> m_mapOfCosts;
+  mutable std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,148 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __TemplateStore_h__
+#define __TemplateStore_h__
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Chamfer.hpp"
+
+
+/*
+ * Memory capped store of the prepared templates, for the libraries whose templates prepared at all the scales
+ * do not fit in memory. The template images and rois of all the templates are kept (a small part of the
+ * prepared templates); the templates prepared at all the scales are kept for the most recently used templates
+ * within the memory cap and prepared again on a miss. The detections run on the library of a subset of the
+ * templates given by getLibrary, which shares the prepared templates with the store: the evicted templates
+ * still used by a library count in the memory cap until the library is released. Thread safe.
+ *
+ * The cache is least recently used: detect all the images on a batch of templates before the next batch,
+ * cycling over the batches for each image misses every batch once the library exceeds the cap.
+ */
+class TemplateStore {
+public:
+  /*
+   * maxMemory: maximal number of bytes of the prepared templates (see Template_info_t::getMemorySize).
+   */
+  explicit TemplateStore(const size_t maxMemory);
+
+  /*
+   * Drop the prepared templates, needed after changing the scales, the Canny threshold or the matching type
+   * of the matcher given to getLibrary.
+   */
+  void clear();
+
+  /*
+   * Templates of a file written by ChamferMatcher::saveTemplateData, prepared on demand.
+   */
+  bool loadTemplateData(const std::string &filename);
+
+  void setTemplateImages(const std::map<int, cv::Mat> &mapOfTemplateImages,
+      const std::map<int, std::pair<cv::Rect, cv::Rect> > &mapOfTemplateRois, const bool deepCopy=true);
+
+  /*
+   * Library of the given templates at all the scales, the missing ones are prepared with the matcher (its scales,
+   * Canny threshold and matching type). Give it to the matcher with setTemplateLibrary. The templates are
+   * shared, not copied. The unknown ids are ignored.
+   */
+  std::shared_ptr<const TemplateLibrary_t> getLibrary(ChamferMatcher &matcher, const std::vector<int> &templateIds);
+
+  /*
+   * Ids of all the templates of the store, prepared or not.
+   */
+  void getTemplateIds(std::vector<int> &templateIds) const;
+
+  inline size_t getMaxMemory() const {
+    return m_maxMemory;
+  }
+
+  /*
+   * Bytes of the prepared templates kept, and of the evicted ones still used by a library.
+   */
+  inline size_t getMemorySize() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_memorySize;
+  }
+
+  inline size_t getNbEvictions() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nbEvictions;
+  }
+
+  inline size_t getNbHits() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nbHits;
+  }
+
+  inline size_t getNbMisses() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_nbMisses;
+  }
+
+  /*
+   * Number of prepared templates kept.
+   */
+  size_t size() const;
+
+private:
+  TemplateStore(const TemplateStore &);
+  TemplateStore& operator=(const TemplateStore &);
+
+  struct Entry_t {
+    int m_id;
+    //! Template at all the scales, shared with the libraries.
+    std::shared_ptr<const TemplateScales_t> m_templates;
+    //! Bytes of the template at all the scales.
+    size_t m_memorySize;
+  };
+
+  void evict();
+
+  //! Maximal number of bytes of the prepared templates.
+  size_t m_maxMemory;
+  //! Key: template id - Value: template image.
+  std::map<int, cv::Mat> m_mapOfTemplateImages;
+  //! Key: template id - Value: (template location, query ROI).
+  std::map<int, std::pair<cv::Rect, cv::Rect> > m_mapOfTemplateRois;
+  //! Prepared templates, the most recently used first.
+  std::list<Entry_t> m_entries;
+  //! Key: template id - Value: entry in m_entries.
+  std::map<int, std::list<Entry_t>::iterator> m_mapOfEntries;
+  //! Scales of the last preparation.
+  std::vector<int> m_scaleVector;
+  //! Evicted templates still used by a library (weak reference, bytes).
+  std::list<std::pair<std::weak_ptr<const TemplateScales_t>, size_t> > m_heldTemplates;
+  //! Bytes of the entries and of m_heldTemplates.
+  size_t m_memorySize;
+  //! Number of templates found prepared.
+  size_t m_nbHits;
+  //! Number of templates prepared.
+  size_t m_nbMisses;
+  //! Number of prepared templates dropped for the memory cap.
+  size_t m_nbEvictions;
+  //! Protect all the members but m_maxMemory.
+  mutable std::mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,135 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __TraceRecorder_h__
+#define __TraceRecorder_h__
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/*
+ * Span of a thread. The names are not copied: string literals only.
+ */
+struct TraceEvent_t {
+  static const int MAX_ARGS = 2;
+
+  const char *m_name;
+  const char *m_category;
+  //! Start and duration in microseconds since the creation of the recorder.
+  long long m_start;
+  long long m_duration;
+  //! Small thread index (0 for the first thread that recorded a span).
+  int m_threadId;
+  const char *m_argNames[MAX_ARGS];
+  int m_argValues[MAX_ARGS];
+  int m_nbArgs;
+
+  TraceEvent_t() : m_name(""), m_category(""), m_start(0), m_duration(0), m_threadId(0), m_nbArgs(0) {
+  }
+};
+
+/*
+ * Spans of the detection stages and jobs of all the threads (see ChamferMatcher::setTraceRecorder),
+ * written as Chrome trace-event JSON (chrome://tracing, Perfetto UI).
+ */
+class TraceRecorder {
+public:
+  TraceRecorder();
+
+  /*
+   * Thread safe.
+   */
+  void add(const TraceEvent_t &event);
+
+  void clear();
+
+  size_t getNbEvents() const;
+
+  /*
+   * Index of the calling thread in the trace.
+   */
+  static int getThreadId();
+
+  /*
+   * Microseconds since the creation of the recorder.
+   */
+  inline long long now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_origin).count();
+  }
+
+  /*
+   * Write the spans in the Chrome trace-event format, "-" for stdout.
+   */
+  bool write(const std::string &filename) const;
+
+private:
+  TraceRecorder(const TraceRecorder &);
+  TraceRecorder& operator=(const TraceRecorder &);
+
+  std::chrono::steady_clock::time_point m_origin;
+  std::vector<TraceEvent_t> m_events;
+  mutable std::mutex m_mutex;
+};
+
+/*
+ * Record the span until stop() or the destruction, nothing (one test) if the recorder is NULL.
+ */
+class TraceSpan {
+public:
+  TraceSpan(TraceRecorder *recorder, const char *name, const char *category)
+    : m_recorder(recorder), m_event() {
+    if(m_recorder != NULL) {
+      m_event.m_name = name;
+      m_event.m_category = category;
+      m_event.m_start = m_recorder->now();
+    }
+  }
+
+  ~TraceSpan() {
+    stop();
+  }
+
+  inline void addArg(const char *name, const int value) {
+    if(m_recorder != NULL && m_event.m_nbArgs < TraceEvent_t::MAX_ARGS) {
+      m_event.m_argNames[m_event.m_nbArgs] = name;
+      m_event.m_argValues[m_event.m_nbArgs] = value;
+      m_event.m_nbArgs++;
+    }
+  }
+
+  inline void stop() {
+    if(m_recorder != NULL) {
+      m_event.m_duration = m_recorder->now() - m_event.m_start;
+      m_event.m_threadId = TraceRecorder::getThreadId();
+      m_recorder->add(m_event);
+      m_recorder = NULL;
+    }
+  }
+
+private:
+  TraceSpan(const TraceSpan &);
+  TraceSpan& operator=(const TraceSpan &);
+
+  TraceRecorder *m_recorder;
+  TraceEvent_t m_event;
+};
+
+#endif
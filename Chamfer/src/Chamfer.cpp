@@ -17,12 +17,199 @@
  *
  *****************************************************************************/
 #include "../include/Chamfer.hpp"
+#include "../include/NumaTopology.hpp"
+#include "../include/RetainedCostMaps.hpp"
 #include "../include/Utils.hpp"
 #include <limits>
 #include <fstream>
 #include <opencv2/highgui/highgui.hpp>
 
+//Display intermediate images, disabled for the headless tools
+#ifndef DEBUG_LIGHT
 #define DEBUG_LIGHT 1
+#endif
+
+namespace {
+  //Number of orientation clusters of the integral distance transforms and of the orientation LUT
+  const int nbOrientationClusters = 12;
+
+  double elapsedMs(const int64 start) {
+    return ((double) cv::getTickCount() - start) / cv::getTickFrequency() * 1000.0;
+  }
+
+  //Candidate rejection parameters explored by the calibration (4 > pi: orientation ignored)
+  const float calibrationDistanceErrors[] = {1.0f, 2.0f, 3.0f, 5.0f, 7.0f, 10.0f, 15.0f, 20.0f, 30.0f, 50.0f};
+  const float calibrationOrientationErrors[] = {0.1f, 0.2f, 0.35f, 0.5f, 0.75f, 1.0f, 1.5f, 4.0f};
+
+  /*
+   * Number of calibration locations by number of matched descriptors, for each candidate
+   * (distance error, orientation error).
+   */
+  struct RejectionHistogram_t {
+    //! Index: (distance error * nb orientation errors + orientation error) * (nb descriptors+1) + nb matches.
+    std::vector<int> m_positives;
+    std::vector<int> m_negatives;
+    int m_nbPositives;
+    int m_nbNegatives;
+
+    explicit RejectionHistogram_t(const size_t size) : m_positives(size, 0), m_negatives(size, 0), m_nbPositives(0),
+      m_nbNegatives(0) {
+    }
+  };
+
+  /*
+   * Order of the calibration candidates: first reach the target recall, then the target rejection rate,
+   * then keep as many positives as possible (or reject as many negatives as possible if the target
+   * rejection rate cannot be reached).
+   */
+  bool isBetterRejection(const float recall, const float rejectionRate, const float bestRecall,
+      const float bestRejectionRate, const float targetRecall, const float targetRejectionRate) {
+    bool meetsRecall = recall >= targetRecall, bestMeetsRecall = bestRecall >= targetRecall;
+    if(meetsRecall != bestMeetsRecall) {
+      return meetsRecall;
+    }
+
+    if(!meetsRecall) {
+      return recall > bestRecall || (recall == bestRecall && rejectionRate > bestRejectionRate);
+    }
+
+    bool meetsRejection = rejectionRate >= targetRejectionRate;
+    bool bestMeetsRejection = bestRejectionRate >= targetRejectionRate;
+    if(meetsRejection != bestMeetsRejection) {
+      return meetsRejection;
+    }
+
+    if(meetsRejection) {
+      return recall > bestRecall || (recall == bestRecall && rejectionRate > bestRejectionRate);
+    }
+
+    return rejectionRate > bestRejectionRate || (rejectionRate == bestRejectionRate && recall > bestRecall);
+  }
+
+  /*
+   * Template images read by the costs of a matching type (see ChamferMatcher::computeChamferDistance).
+   */
+  void getTemplateImagesUsed(const ChamferMatcher::MatchingType type, bool &useDistImg, bool &useEdgeOrientationImg,
+      bool &useMask) {
+    useDistImg = type == ChamferMatcher::edgeForwardBackwardMatching || type == ChamferMatcher::fullMatching ||
+        type == ChamferMatcher::maskMatching || type == ChamferMatcher::forwardBackwardMaskMatching;
+    //Orientation of the template along the lines
+    useEdgeOrientationImg = useDistImg || type == ChamferMatcher::lineMatching ||
+        type == ChamferMatcher::lineForwardBackwardMatching;
+    useMask = type == ChamferMatcher::maskMatching || type == ChamferMatcher::forwardBackwardMaskMatching;
+  }
+
+  /*
+   * Add the time elapsed (and the hardware counters) until stop() or the destruction to a stage,
+   * and record the span of the stage. Nothing if timings and recorder are NULL.
+   */
+  class StageTimer {
+  public:
+    StageTimer(StageTimings_t *timings, TraceRecorder *recorder, const StageTimings_t::Stage stage)
+      : m_timings(timings), m_stage(stage), m_start(0), m_startCounters(),
+        m_span(recorder, StageTimings_t::getStageName(stage), "stage") {
+      if(m_timings != NULL) {
+        if(m_timings->m_perfCounters != NULL) {
+          m_timings->m_perfCounters->read(m_startCounters);
+        }
+        m_start = cv::getTickCount();
+      }
+    }
+
+    ~StageTimer() {
+      stop();
+    }
+
+    void stop() {
+      m_span.stop();
+      if(m_timings != NULL) {
+        m_timings->add(m_stage, elapsedMs(m_start));
+        if(m_timings->m_perfCounters != NULL) {
+          PerfCounterValues_t endCounters;
+          m_timings->m_perfCounters->read(endCounters);
+          m_timings->m_counters[m_stage].addDelta(m_startCounters, endCounters);
+        }
+        m_timings = NULL;
+      }
+    }
+
+  private:
+    StageTimings_t *m_timings;
+    StageTimings_t::Stage m_stage;
+    int64 m_start;
+    PerfCounterValues_t m_startCounters;
+    TraceSpan m_span;
+  };
+
+  /*
+   * Locations of a Chamfer map whose cost was computed, the others are at the maximal cost.
+   */
+  double countScoredWindows(const cv::Mat &chamferMap) {
+    double nbScored = 0.0;
+    for(int i = 0; i < chamferMap.rows; i++) {
+      const float *ptr_row = chamferMap.ptr<float>(i);
+      for(int j = 0; j < chamferMap.cols; j++) {
+        if(ptr_row[j] < std::numeric_limits<float>::max()) {
+          nbScored++;
+        }
+      }
+    }
+
+    return nbScored;
+  }
+
+  /*
+   * Mean, over the contour points, of the chamfer distance between a point of the scaled point set and the same
+   * point of the anchor point set, for the same window center. The distance transform (cv::DIST_MASK_5) changes
+   * by at most the chamfer distance between two locations, so the mean distance transform of the anchor points
+   * minus this slack bounds from below the one of the scaled points.
+   */
+  double getScalePruningSlack(const ScaledPointSet_t &pointSet, const ScaledPointSet_t &anchorPointSet) {
+    //Axial and diagonal weights of the 5x5 chamfer mask: a path made of these moves bounds the chamfer distance
+    const double axialWeight = 1.0, diagonalWeight = 1.4;
+    //Window top left corner relative to the window center, as in computeScaledMatchingMaps()
+    const cv::Point half(pointSet.m_size.width / 2, pointSet.m_size.height / 2);
+    const cv::Point anchorHalf(anchorPointSet.m_size.width / 2, anchorPointSet.m_size.height / 2);
+
+    double slack = 0.0;
+    for(size_t cpt = 0; cpt < pointSet.m_points.size(); cpt++) {
+      cv::Point displacement = (pointSet.m_points[cpt] - half) - (anchorPointSet.m_points[cpt] - anchorHalf);
+      int dx = std::abs(displacement.x), dy = std::abs(displacement.y);
+      slack += diagonalWeight * std::min(dx, dy) + axialWeight * (std::max(dx, dy) - std::min(dx, dy));
+    }
+
+    return pointSet.m_points.empty() ? 0.0 : slack / pointSet.m_points.size();
+  }
+}
+
+const char* StageTimings_t::getStageName(const Stage stage) {
+  switch(stage) {
+  case decodeStage:
+    return "decode";
+  case cannyStage:
+    return "canny";
+  case distanceTransformStage:
+    return "distanceTransform";
+  case edgeOrientationStage:
+    return "edgeOrientation";
+  case queryMaskStage:
+    return "queryMask";
+  case contourLinesStage:
+    return "contourLines";
+  case integralDistanceTransformStage:
+    return "integralDistanceTransform";
+  case rejectionStage:
+    return "rejection";
+  case scoringStage:
+    return "scoring";
+  case extractionStage:
+    return "extraction";
+  case groupingStage:
+    return "grouping";
+  default:
+    return "?";
+  }
+}
 
 
 ChamferMatcher::ChamferMatcher() :
@@ -31,21 +218,16 @@ ChamferMatcher::ChamferMatcher() :
 #endif
       m_cannyThreshold(50.0), m_maxDescriptorDistanceError(10.0f), m_maxDescriptorOrientationError(0.35f),
       m_minNbDescriptorMatches(5), m_gridDescriptorSize(4,4), m_matchingStrategyType(templateMatching),
-      m_matchingType(edgeMatching), /*m_query_info(), */m_mapOfTemplate_info(), m_mapOfTemplateImages(),
-      m_orientationLUT(), m_pyramidType(noPyramid), m_rejectionType(gridDescriptorRejection), m_scaleMax(200),
-      m_scaleMin(50), m_scaleStep(10), m_scaleVector() {
-
-  int regular_scale = 100;
-  m_scaleVector.push_back(regular_scale);
-
-  for(int scale = m_scaleMin; scale <= m_scaleMax; scale += m_scaleStep) {
-    if(scale != regular_scale) {
-      m_scaleVector.push_back(scale);
-    }
-  }
-
-  //Sort scales
-  std::sort(m_scaleVector.begin(), m_scaleVector.end());
+      m_matchingType(edgeMatching), /*m_query_info(), */m_library(new TemplateLibrary_t),
+      m_orientationLUT(createOrientationLUT(nbOrientationClusters)), m_pyramidType(noPyramid), m_rejectionType(gridDescriptorRejection), m_scaleMax(200),
+      m_scaleMin(50), m_scaleStep(10), m_scalePruningStride(2),
+      m_useScalePruning(false), m_useTemplateGroups(false), m_usePointSetScaling(false), m_retainCostMaps(false),
+      m_useStageTimings(false), m_traceRecorder(NULL), m_costReport(NULL), m_topK(0),
+      m_matAllocator(NULL), m_executor(NULL), m_maxParallelism(0), m_useCompactTemplates(false) {
+  //Scale vector of the empty library
+  std::shared_ptr<TemplateLibrary_t> library(new TemplateLibrary_t);
+  computeScales(*library);
+  setTemplateLibrary(library);
 }
 
 ChamferMatcher::ChamferMatcher(const std::map<int, cv::Mat> &mapOfTemplateImages,
@@ -55,9 +237,16 @@ ChamferMatcher::ChamferMatcher(const std::map<int, cv::Mat> &mapOfTemplateImages
 #endif
       m_cannyThreshold(50.0), m_maxDescriptorDistanceError(10.0f), m_maxDescriptorOrientationError(0.35f),
       m_minNbDescriptorMatches(5), m_gridDescriptorSize(4,4), m_matchingStrategyType(templateMatching),
-      m_matchingType(edgeMatching), /*m_query_info(), */m_mapOfTemplate_info(), m_mapOfTemplateImages(),
-      m_orientationLUT(), m_pyramidType(noPyramid), m_rejectionType(gridDescriptorRejection), m_scaleMax(200),
-      m_scaleMin(50), m_scaleStep(10), m_scaleVector() {
+      m_matchingType(edgeMatching), /*m_query_info(), */m_library(new TemplateLibrary_t),
+      m_orientationLUT(createOrientationLUT(nbOrientationClusters)), m_pyramidType(noPyramid), m_rejectionType(gridDescriptorRejection), m_scaleMax(200),
+      m_scaleMin(50), m_scaleStep(10), m_scalePruningStride(2),
+      m_useScalePruning(false), m_useTemplateGroups(false), m_usePointSetScaling(false), m_retainCostMaps(false),
+      m_useStageTimings(false), m_traceRecorder(NULL), m_costReport(NULL), m_topK(0),
+      m_matAllocator(NULL), m_executor(NULL), m_maxParallelism(0), m_useCompactTemplates(false) {
+  //Scale vector of the empty library
+  std::shared_ptr<TemplateLibrary_t> library(new TemplateLibrary_t);
+  computeScales(*library);
+  setTemplateLibrary(library);
 
   if(mapOfTemplateImages.size() != mapOfTemplateRois.size()) {
     std::cerr << "Different size between templates and rois!" << std::endl;
@@ -67,29 +256,196 @@ ChamferMatcher::ChamferMatcher(const std::map<int, cv::Mat> &mapOfTemplateImages
   setTemplateImages(mapOfTemplateImages, mapOfTemplateRois);
 }
 
-void ChamferMatcher::approximateContours(const std::vector<std::vector<cv::Point> > &contours,
-    std::vector<std::vector<Line_info_t> > &contour_lines, const double epsilon) {
+void ChamferMatcher::approximateContours(const CSRArray_t<cv::Point> &contours, CSRArray_t<Line_info_t> &contour_lines,
+    const double epsilon) const {
+  std::vector<cv::Point> approx_contour;
 
   for(size_t i = 0; i < contours.size(); i++) {
-    //Approximate the current contour
-    std::vector<cv::Point> approx_contour;
-    cv::approxPolyDP(contours[i], approx_contour, epsilon, true);
+    if(contours.rowSize(i) == 0) {
+      continue;
+    }
+
+    //Approximate the current contour (header on the contiguous storage, no copy)
+    const cv::Mat contour((int) contours.rowSize(i), 1, CV_32SC2, const_cast<cv::Point*>(contours.row(i)));
+    approx_contour.clear();
+    cv::approxPolyDP(contour, approx_contour, epsilon, true);
 
-    std::vector<Line_info_t> lines;
     //Compute polar line equation for the approximated contour
-    for(size_t j = 0; j < approx_contour.size()-1; j++) {
+    for(size_t j = 0; j+1 < approx_contour.size(); j++) {
       double length, rho, theta;
       getPolarLineEquation(approx_contour[j], approx_contour[j+1], theta, rho, length);
 
       //Add the line
-      lines.push_back(Line_info_t(length, rho, theta, approx_contour[j], approx_contour[j+1]));
+      contour_lines.push_back(Line_info_t(length, rho, theta, approx_contour[j], approx_contour[j+1]));
     }
 
-    if(!lines.empty()) {
+    if(approx_contour.size() > 1) {
       //Add the lines
-      contour_lines.push_back(lines);
+      contour_lines.endRow();
+    }
+  }
+}
+
+void ChamferMatcher::calibrateRejection(const std::vector<cv::Mat> &positiveImages,
+    const std::vector<cv::Mat> &negativeImages, const float targetRejectionRate, const float targetRecall,
+    const bool useOrientation, const float distanceThresh, const float lambda, const float weight_forward,
+    const float weight_backward) {
+  const size_t nbDistanceErrors = sizeof(calibrationDistanceErrors) / sizeof(calibrationDistanceErrors[0]);
+  const size_t nbOrientationErrors = sizeof(calibrationOrientationErrors) / sizeof(calibrationOrientationErrors[0]);
+  //Same grid as the detection
+  const int xStep = 5, yStep = 5;
+
+  //Calibrate a copy of the library, published at the end
+  std::shared_ptr<TemplateLibrary_t> library(new TemplateLibrary_t(*getTemplateLibrary()));
+
+  const std::vector<int> &scaleVector = library->m_scaleVector;
+  std::vector<Template_info_t*> templates;
+  std::vector<RejectionHistogram_t> histograms;
+  //The pyramid half scales (not in the scale vector) are only matched on the half resolution query
+  std::vector<bool> isHalfScale;
+  bool hasHalfScales = false;
+  for(std::map<int, std::shared_ptr<const TemplateScales_t> >::iterator it1 = library->m_mapOfTemplate_info.begin();
+      it1 != library->m_mapOfTemplate_info.end(); ++it1) {
+    //Calibrate a copy of the templates, the current library shares them
+    std::shared_ptr<TemplateScales_t> calibrated(new TemplateScales_t(*it1->second));
+    it1->second = calibrated;
+    for(std::map<int, Template_info_t>::iterator it2 = calibrated->begin(); it2 != calibrated->end(); ++it2) {
+      templates.push_back(&it2->second);
+      histograms.push_back(RejectionHistogram_t(nbDistanceErrors * nbOrientationErrors *
+          (it2->second.m_gridDescriptors.size()+1)));
+      isHalfScale.push_back(std::find(scaleVector.begin(), scaleVector.end(), it2->first) == scaleVector.end());
+      hasHalfScales = hasHalfScales || isHalfScale.back();
+    }
+  }
+
+  Query_info_t query_info, half_query_info;
+  cv::Mat edge_query;
+  for(size_t cpt_img = 0; cpt_img < positiveImages.size() + negativeImages.size(); cpt_img++) {
+    bool isPositiveImage = cpt_img < positiveImages.size();
+    const cv::Mat &img = isPositiveImage ? positiveImages[cpt_img] : negativeImages[cpt_img - positiveImages.size()];
+    if(img.empty()) {
+      std::cerr << "Empty calibration image!" << std::endl;
+      continue;
+    }
+
+    prepareQuery(img, query_info, edge_query);
+    if(hasHalfScales) {
+      QueryImageLoader query_loader(img);
+      prepareQuery(query_loader.getImage(2), half_query_info, edge_query);
+    }
+
+    getExecutor().parallelFor(0, (int) templates.size(), [&](const int first, const int last) {
+      for(int cpt_tpl = first; cpt_tpl < last; cpt_tpl++) {
+        const Template_info_t &template_info = *templates[cpt_tpl];
+        const Query_info_t &current_query_info = isHalfScale[cpt_tpl] ? half_query_info : query_info;
+        RejectionHistogram_t &histogram = histograms[cpt_tpl];
+        const size_t nbDescriptors = template_info.m_gridDescriptors.size();
+        int chamferMapWidth = current_query_info.m_distImg.cols - template_info.m_size.width + 1;
+        int chamferMapHeight = current_query_info.m_distImg.rows - template_info.m_size.height + 1;
+
+        if(nbDescriptors == 0 || chamferMapWidth <= 0 || chamferMapHeight <= 0) {
+          continue;
+        }
+
+        std::vector<float> distanceErrors(nbDescriptors), orientationErrors(nbDescriptors);
+        for(int i = 0; i < chamferMapHeight; i += yStep) {
+          for(int j = 0; j < chamferMapWidth; j += xStep) {
+            bool isPositive = false;
+            if(isPositiveImage) {
+              isPositive = computeLocationCost(template_info, current_query_info, j, i, useOrientation, lambda,
+                  weight_forward, weight_backward) < distanceThresh;
+
+              if(!isPositive && !negativeImages.empty()) {
+                //The negatives come from the negative images
+                continue;
+              }
+            }
+
+            for(size_t cpt = 0; cpt < nbDescriptors; cpt++) {
+              cv::Point location = template_info.m_gridDescriptorsLocations[cpt] + cv::Point(j, i);
+              distanceErrors[cpt] = std::fabs(current_query_info.m_distImg.ptr<float>(location.y)[location.x] -
+                  template_info.m_gridDescriptors[cpt].first);
+              orientationErrors[cpt] = std::fabs(
+                  current_query_info.m_mapOfEdgeOrientation.ptr<float>(location.y)[location.x] -
+                  template_info.m_gridDescriptors[cpt].second);
+            }
+
+            std::vector<int> &bins = isPositive ? histogram.m_positives : histogram.m_negatives;
+            (isPositive ? histogram.m_nbPositives : histogram.m_nbNegatives)++;
+
+            for(size_t d = 0; d < nbDistanceErrors; d++) {
+              for(size_t o = 0; o < nbOrientationErrors; o++) {
+                int nbMatches = 0;
+                for(size_t cpt = 0; cpt < nbDescriptors; cpt++) {
+                  if(distanceErrors[cpt] < calibrationDistanceErrors[d] &&
+                      orientationErrors[cpt] < calibrationOrientationErrors[o]) {
+                    nbMatches++;
+                  }
+                }
+
+                bins[(d*nbOrientationErrors + o) * (nbDescriptors+1) + nbMatches]++;
+              }
+            }
+          }
+        }
+      }
+    }, m_maxParallelism);
+  }
+
+  int nbNotCalibrated = 0;
+  for(size_t cpt_tpl = 0; cpt_tpl < templates.size(); cpt_tpl++) {
+    const RejectionHistogram_t &histogram = histograms[cpt_tpl];
+    const size_t nbDescriptors = templates[cpt_tpl]->m_gridDescriptors.size();
+
+    if(histogram.m_nbPositives == 0 || histogram.m_nbNegatives == 0) {
+      //Keep the global parameters
+      templates[cpt_tpl]->m_rejectionParams = RejectionParams_t();
+      nbNotCalibrated++;
+      continue;
+    }
+
+    //Without rejection: all the positives are kept, no negative is rejected
+    RejectionParams_t best;
+    best.m_maxDescriptorDistanceError = m_maxDescriptorDistanceError;
+    best.m_maxDescriptorOrientationError = m_maxDescriptorOrientationError;
+    best.m_minNbDescriptorMatches = 0;
+    best.m_recall = 1.0f;
+    best.m_rejectionRate = 0.0f;
+
+    for(size_t d = 0; d < nbDistanceErrors; d++) {
+      for(size_t o = 0; o < nbOrientationErrors; o++) {
+        const int *ptr_positives = &histogram.m_positives[(d*nbOrientationErrors + o) * (nbDescriptors+1)];
+        const int *ptr_negatives = &histogram.m_negatives[(d*nbOrientationErrors + o) * (nbDescriptors+1)];
+
+        //Locations with nbMatches >= n are kept
+        int nbRejectedPositives = 0, nbRejectedNegatives = 0;
+        for(size_t n = 1; n <= nbDescriptors; n++) {
+          nbRejectedPositives += ptr_positives[n-1];
+          nbRejectedNegatives += ptr_negatives[n-1];
+
+          float recall = 1.0f - nbRejectedPositives / (float) histogram.m_nbPositives;
+          float rejectionRate = nbRejectedNegatives / (float) histogram.m_nbNegatives;
+          if(isBetterRejection(recall, rejectionRate, best.m_recall, best.m_rejectionRate, targetRecall,
+              targetRejectionRate)) {
+            best.m_maxDescriptorDistanceError = calibrationDistanceErrors[d];
+            best.m_maxDescriptorOrientationError = calibrationOrientationErrors[o];
+            best.m_minNbDescriptorMatches = (int) n;
+            best.m_recall = recall;
+            best.m_rejectionRate = rejectionRate;
+          }
+        }
+      }
     }
+
+    templates[cpt_tpl]->m_rejectionParams = best;
+  }
+
+  if(nbNotCalibrated > 0) {
+    std::cerr << nbNotCalibrated << " template(s) without positive or negative locations keep the global"
+        " rejection parameters!" << std::endl;
   }
+
+  setTemplateLibrary(library);
 }
 
 /*
@@ -113,12 +469,13 @@ double ChamferMatcher::computeChamferDistance(const Template_info_t &template_in
 #if DEBUG
     cv::Mat &img_res,
 #endif
-    const bool useOrientation, const float lambda, const float weight_forward, const float weight_backward) {
+    const bool useOrientation, const float lambda, const float weight_forward, const float weight_backward,
+    const float maxCost) {
   double chamfer_dist = 0.0;
   int nbElements = 0;
 
 #if DEBUG
-  img_res = cv::Mat::zeros(template_info.m_distImg.size(), CV_32F);
+  img_res = cv::Mat::zeros(template_info.m_size, CV_32F);
 #endif
 
   //TODO: add a normalization step?
@@ -130,92 +487,91 @@ double ChamferMatcher::computeChamferDistance(const Template_info_t &template_in
     if(m_matchingType == lineIntegralMatching) {
 
       //Use integral image
-      for(size_t i = 0; i < template_info.m_vectorOfContourLines.size(); i++) {
-        for(size_t j = 0; j < template_info.m_vectorOfContourLines[i].size(); j++) {
-          cv::Point pt1 = template_info.m_vectorOfContourLines[i][j].m_pointStart;
-          cv::Point pt2 = template_info.m_vectorOfContourLines[i][j].m_pointEnd;
-          cv::Point offset_pt(offsetX, offsetY);
-
-          //Add current window offset
-          pt1 += offset_pt;
-          pt2 += offset_pt;
-
-          double theta = template_info.m_vectorOfContourLines[i][j].m_theta;
-          int use_angle = (int) round((theta-M_PI)*180.0/M_PI) - 90;
-          use_angle = use_angle < 0 ? use_angle + 180 : use_angle;
-
-          int h = m_orientationLUT[use_angle];
-          const float *ptr_idt_start = query_info.m_integralDistImg.ptr<float>(h) + pt1.y*query_info.m_integralDistImg.size[2];
-          const float *ptr_idt_end = query_info.m_integralDistImg.ptr<float>(h) + pt2.y*query_info.m_integralDistImg.size[2];
-          float diff_dt = fabs( ptr_idt_start[pt1.x] - ptr_idt_end[pt2.x] );
-
-          if(useOrientation && false) {
+      //The lines of all the contours are stored contiguously
+      for(size_t i = 0; i < template_info.m_vectorOfContourLines.nbElements(); i++) {
+        const Line_info_t &line = template_info.m_vectorOfContourLines.m_data[i];
+        cv::Point pt1 = line.m_pointStart;
+        cv::Point pt2 = line.m_pointEnd;
+        cv::Point offset_pt(offsetX, offsetY);
+
+        //Add current window offset
+        pt1 += offset_pt;
+        pt2 += offset_pt;
+
+        double theta = line.m_theta;
+        int use_angle = (int) round((theta-M_PI)*180.0/M_PI) - 90;
+        use_angle = use_angle < 0 ? use_angle + 180 : use_angle;
+
+        int h = m_orientationLUT[use_angle];
+        const float *ptr_idt_start = query_info.m_integralDistImg.ptr<float>(h) + pt1.y*query_info.m_integralDistImg.size[2];
+        const float *ptr_idt_end = query_info.m_integralDistImg.ptr<float>(h) + pt2.y*query_info.m_integralDistImg.size[2];
+        float diff_dt = fabs( ptr_idt_start[pt1.x] - ptr_idt_end[pt2.x] );
+
+        if(useOrientation && false) {
 //            chamfer_dist += weight_forward * ( query_info.m_distImg.at<float>(it_line.pos()) + lambda *
 //                getMinAngleError(template_info.m_mapOfEdgeOrientation.at<float>(it_line.pos()),
 //                    query_info.m_mapOfEdgeOrientation.at<float>(it_line.pos()), false, true) );
 
-            const float *ptr_idt_edge_ori_start = query_info.m_integralEdgeOrientation.ptr<float>(h) +
-                pt1.y*query_info.m_integralEdgeOrientation.size[2];
-            const float *ptr_idt_edge_ori_end = query_info.m_integralEdgeOrientation.ptr<float>(h) +
-                pt2.y*query_info.m_integralEdgeOrientation.size[2];
-            float diff_edge_ori = fabs( ptr_idt_edge_ori_start[pt1.x] - ptr_idt_edge_ori_end[pt2.x] );
+          const float *ptr_idt_edge_ori_start = query_info.m_integralEdgeOrientation.ptr<float>(h) +
+              pt1.y*query_info.m_integralEdgeOrientation.size[2];
+          const float *ptr_idt_edge_ori_end = query_info.m_integralEdgeOrientation.ptr<float>(h) +
+              pt2.y*query_info.m_integralEdgeOrientation.size[2];
+          float diff_edge_ori = fabs( ptr_idt_edge_ori_start[pt1.x] - ptr_idt_edge_ori_end[pt2.x] );
 
-            chamfer_dist += weight_forward * ( diff_dt + lambda *
-                            getMinAngleError(theta,
-                                diff_edge_ori, false, true) );
-          } else {
+          chamfer_dist += weight_forward * ( diff_dt + lambda *
+                          getMinAngleError(theta,
+                              diff_edge_ori, false, true) );
+        } else {
 //            chamfer_dist += weight_forward * ( query_info.m_distImg.at<float>(it_line.pos()) );
-            chamfer_dist += weight_forward * ( diff_dt );
-          }
+          chamfer_dist += weight_forward * ( diff_dt );
         }
       }
     } else {
 
       //"Forward matching" <==> matches lines from template to the nearest lines in the query
-      for(size_t i = 0; i < template_info.m_vectorOfContourLines.size(); i++) {
-        for(size_t j = 0; j < template_info.m_vectorOfContourLines[i].size(); j++) {
-          cv::Point pt1 = template_info.m_vectorOfContourLines[i][j].m_pointStart;
-          cv::Point pt2 = template_info.m_vectorOfContourLines[i][j].m_pointEnd;
-          cv::Point offset_pt(offsetX, offsetY);
-
-          //Add current window offset
-          pt1 += offset_pt;
-          pt2 += offset_pt;
-
-          //Iterate through pixels on line
-          cv::LineIterator it_line(query_info.m_distImg, pt1, pt2, 8);
-          cv::LineIterator it_line_edge_ori_query(query_info.m_mapOfEdgeOrientation, pt1, pt2, 8);
-          cv::LineIterator it_line_edge_ori_template(template_info.m_mapOfEdgeOrientation, pt1-offset_pt, pt2-offset_pt, 8);
-
-          for(int cpt = 0; cpt < it_line.count; cpt++, ++it_line, nbElements++,
-              ++it_line_edge_ori_query, ++it_line_edge_ori_template) {
-            cv::Point current_pos = it_line.pos();
-
-            if(useOrientation) {
-              float value_dist, value_edge_ori_query, value_edge_ori_template;
-              memcpy(&value_dist, it_line.ptr, sizeof(float));
-              memcpy(&value_edge_ori_query, it_line_edge_ori_query.ptr, sizeof(float));
-              memcpy(&value_edge_ori_template, it_line_edge_ori_template.ptr, sizeof(float));
-
-              chamfer_dist += weight_forward * ( value_dist + lambda *
-                  getMinAngleError(value_edge_ori_template,
-                      value_edge_ori_query, false, true) );
-            } else {
-              float value;
-              memcpy(&value, it_line.ptr, sizeof(float));
-              chamfer_dist += weight_forward * ( value );
-            }
+      //The lines of all the contours are stored contiguously
+      for(size_t i = 0; i < template_info.m_vectorOfContourLines.nbElements(); i++) {
+        const Line_info_t &line = template_info.m_vectorOfContourLines.m_data[i];
+        cv::Point pt1 = line.m_pointStart;
+        cv::Point pt2 = line.m_pointEnd;
+        cv::Point offset_pt(offsetX, offsetY);
+
+        //Add current window offset
+        pt1 += offset_pt;
+        pt2 += offset_pt;
+
+        //Iterate through pixels on line
+        cv::LineIterator it_line(query_info.m_distImg, pt1, pt2, 8);
+        cv::LineIterator it_line_edge_ori_query(query_info.m_mapOfEdgeOrientation, pt1, pt2, 8);
+        cv::LineIterator it_line_edge_ori_template(template_info.m_mapOfEdgeOrientation, pt1-offset_pt, pt2-offset_pt, 8);
+
+        for(int cpt = 0; cpt < it_line.count; cpt++, ++it_line, nbElements++,
+            ++it_line_edge_ori_query, ++it_line_edge_ori_template) {
+          cv::Point current_pos = it_line.pos();
+
+          if(useOrientation) {
+            float value_dist, value_edge_ori_query, value_edge_ori_template;
+            memcpy(&value_dist, it_line.ptr, sizeof(float));
+            memcpy(&value_edge_ori_query, it_line_edge_ori_query.ptr, sizeof(float));
+            memcpy(&value_edge_ori_template, it_line_edge_ori_template.ptr, sizeof(float));
+
+            chamfer_dist += weight_forward * ( value_dist + lambda *
+                getMinAngleError(value_edge_ori_template,
+                    value_edge_ori_query, false, true) );
+          } else {
+            float value;
+            memcpy(&value, it_line.ptr, sizeof(float));
+            chamfer_dist += weight_forward * ( value );
           }
         }
       }
 
       if(m_matchingType == lineForwardBackwardMatching) {
         //"Backward matching" <==> matches edges from query to the nearest edges in the template
-        for(size_t i = 0; i < query_info.m_vectorOfContourLines.size(); i++) {
-          for(size_t j = 0; j < query_info.m_vectorOfContourLines[i].size(); j++) {
-            cv::Point pt1 = query_info.m_vectorOfContourLines[i][j].m_pointStart;
-            cv::Point pt2 = query_info.m_vectorOfContourLines[i][j].m_pointEnd;
-            //TODO:
+        for(size_t i = 0; i < query_info.m_vectorOfContourLines.nbElements(); i++) {
+          cv::Point pt1 = query_info.m_vectorOfContourLines.m_data[i].m_pointStart;
+          cv::Point pt2 = query_info.m_vectorOfContourLines.m_data[i].m_pointEnd;
+          //TODO:
 //            cv::Point offset_pt(offsetX, offsetY);
 //
 //            //Add current window offset
@@ -236,24 +592,39 @@ double ChamferMatcher::computeChamferDistance(const Template_info_t &template_in
 //                chamfer_dist += weight_backward * ( template_info.m_distImg.at<float>(it_line.pos()) );
 //              }
 //            }
-          }
         }
       }
     }
   } else {
     //Classical edge matching
 
+    //All the terms are positive and the cost is normalized by the number of template points:
+    //stop as soon as the cost cannot be lower than maxCost
+    double maxSum = std::numeric_limits<double>::max();
+    if(maxCost < std::numeric_limits<float>::max()) {
+      size_t nbTemplatePoints = template_info.m_contours.nbElements();
+      maxSum = maxCost * (double) nbTemplatePoints;
+    }
+
     //"Forward matching" <==> matches edges from template to the nearest edges in the query
     for(size_t i = 0; i < template_info.m_contours.size(); i++) {
-      for(size_t j = 0; j < template_info.m_contours[i].size(); j++, nbElements++) {
-        int x = template_info.m_contours[i][j].x;
-        int y = template_info.m_contours[i][j].y;
+      if(chamfer_dist >= maxSum) {
+        //Same value as a rejected location
+        return std::numeric_limits<float>::max();
+      }
+
+      const cv::Point *ptr_contour = template_info.m_contours.row(i);
+      const float *ptr_edges_ori = template_info.m_edgesOrientation.row(i);
+      const size_t contourSize = template_info.m_contours.rowSize(i);
+      for(size_t j = 0; j < contourSize; j++, nbElements++) {
+        int x = ptr_contour[j].x;
+        int y = ptr_contour[j].y;
 
         const float *ptr_row_edge_ori = query_info.m_mapOfEdgeOrientation.ptr<float>(y + offsetY);
 
         if(useOrientation) {
           chamfer_dist += weight_forward *( query_info.m_distImg.ptr<float>(y + offsetY)[x + offsetX]
-             + lambda*(getMinAngleError(template_info.m_edgesOrientation[i][j], ptr_row_edge_ori[x + offsetX], false, true)) );
+             + lambda*(getMinAngleError(ptr_edges_ori[j], ptr_row_edge_ori[x + offsetX], false, true)) );
 
 #if DEBUG
           //DEBUG:
@@ -275,19 +646,22 @@ double ChamferMatcher::computeChamferDistance(const Template_info_t &template_in
     if(m_matchingType == edgeForwardBackwardMatching) {
       //"Backward matching" <==> matches edges from query to the nearest edges in the template
       for(size_t i = 0; i < query_info.m_contours.size(); i++) {
+        const cv::Point *ptr_contour = query_info.m_contours.row(i);
+        const float *ptr_edges_ori = query_info.m_edgesOrientation.row(i);
+        const size_t contourSize = query_info.m_contours.rowSize(i);
 
-        for(size_t j = 0; j < query_info.m_contours[i].size(); j++, nbElements) {
-          int x = query_info.m_contours[i][j].x;
-          int y = query_info.m_contours[i][j].y;
+        for(size_t j = 0; j < contourSize; j++, nbElements) {
+          int x = ptr_contour[j].x;
+          int y = ptr_contour[j].y;
           const float *ptr_row_edge_ori = template_info.m_mapOfEdgeOrientation.ptr<float>(y-offsetY);
 
           //Get only contours located in the current region
-          if(offsetX <= x && x < offsetX+template_info.m_distImg.cols &&
-              offsetY <= y && y < offsetY+template_info.m_distImg.rows) {
+          if(offsetX <= x && x < offsetX+template_info.m_size.width &&
+              offsetY <= y && y < offsetY+template_info.m_size.height) {
 
             if(useOrientation) {
               chamfer_dist += weight_backward * ( template_info.m_distImg.ptr<float>(y-offsetY)[x-offsetX] +
-                  lambda*(getMinAngleError(query_info.m_edgesOrientation[i][j], ptr_row_edge_ori[x-offsetX], false, true)) );
+                  lambda*(getMinAngleError(ptr_edges_ori[j], ptr_row_edge_ori[x-offsetX], false, true)) );
 
 #if DEBUG
               //DEBUG:
@@ -318,7 +692,7 @@ double ChamferMatcher::computeChamferDistance(const Template_info_t &template_in
  * id and with a distance transform of 0.
  */
 void ChamferMatcher::computeDistanceTransform(const cv::Mat &img, cv::Mat &dist_img, cv::Mat &labels) {
-  dist_img = cv::Mat(img.size(), CV_32F);
+  dist_img.create(img.size(), CV_32F);
 
   cv::distanceTransform(img, dist_img, labels, cv::DIST_L2, cv::DIST_MASK_5, cv::DIST_LABEL_PIXEL);
 }
@@ -350,14 +724,14 @@ double ChamferMatcher::computeFullChamferDistance(const Template_info_t &templat
   int nbElements = 0;
 
 #if DEBUG
-  img_res = cv::Mat::zeros(template_info.m_distImg.size(), CV_32F);
+  img_res = cv::Mat::zeros(template_info.m_size, CV_32F);
 #endif
 
   cv::Mat subDistImg = query_info.m_distImg(
-      cv::Rect(offsetX, offsetY, template_info.m_distImg.cols, template_info.m_distImg.rows));
+      cv::Rect(offsetX, offsetY, template_info.m_size.width, template_info.m_size.height));
 
   cv::Mat subEdgeOriImg = query_info.m_mapOfEdgeOrientation(
-      cv::Rect(offsetX, offsetY, template_info.m_distImg.cols, template_info.m_distImg.rows));
+      cv::Rect(offsetX, offsetY, template_info.m_size.width, template_info.m_size.height));
 
   if(m_matchingType == fullMatching) {
     //Distance transform
@@ -394,7 +768,7 @@ double ChamferMatcher::computeFullChamferDistance(const Template_info_t &templat
 
     if(m_matchingType == forwardBackwardMaskMatching) {
       cv::Mat query_mask = query_info.m_mask(
-          cv::Rect(offsetX, offsetY, template_info.m_distImg.cols, template_info.m_distImg.rows));
+          cv::Rect(offsetX, offsetY, template_info.m_size.width, template_info.m_size.height));
       cv::bitwise_or(template_info.m_mask, query_mask, common_mask);
     }
 
@@ -457,7 +831,7 @@ void ChamferMatcher::computeIntegralDistanceTransform(const cv::Mat &dt, cv::Mat
       const bool useLineIterator) {
   int size[3] = {nbClusters, dt.rows, dt.cols};
 
-  idt = cv::Mat(3, size, CV_32F);
+  idt.create(3, size, CV_32F);
 
   int angle_step = 180 / nbClusters;
   float *ptr_row_idt;
@@ -661,22 +1035,366 @@ void ChamferMatcher::computeIntegralDistanceTransform(const cv::Mat &dt, cv::Mat
   }
 }
 
+double ChamferMatcher::computeLocationCost(const Template_info_t &template_info, const Query_info_t &query_info,
+    const int offsetX, const int offsetY, const bool useOrientation, const float lambda,
+    const float weight_forward, const float weight_backward, const float maxCost) {
+#if DEBUG
+  cv::Mat res;
+#endif
+
+  switch(m_matchingType) {
+  case fullMatching:
+  case maskMatching:
+  case forwardBackwardMaskMatching:
+    return computeFullChamferDistance(template_info, query_info, offsetX, offsetY,
+#if DEBUG
+        res,
+#endif
+        useOrientation, lambda);
+
+  default:
+    return computeChamferDistance(template_info, query_info, offsetX, offsetY,
+#if DEBUG
+        res,
+#endif
+        useOrientation, lambda, weight_forward, weight_backward, maxCost);
+  }
+}
+
+/*
+ * Compute the Chamfer maps of a group of templates of the same size, grid descriptor size and query ROI
+ * by scanning the locations in the outer loop: at each location, the grid descriptors of the query are read
+ * once for all the templates and the distance transform neighbourhood stays in the cache while the templates
+ * are scored. The rejection masks are updated as in computeRejectionMask().
+ */
+bool ChamferMatcher::computeGroupMatchingMaps(const std::vector<const Template_info_t*> &templates,
+    const std::vector<int> &templateIds, const Query_info_t &query_info, std::vector<cv::Mat> &chamferMaps,
+    std::vector<cv::Mat> &rejection_masks, const bool useOrientation, const int xStep, const int yStep,
+    const float lambda, const float weight_forward, const float weight_backward, TopKBound *topKBound,
+    const DetectionDeadline *deadline) {
+  if(templates.empty()) {
+    return true;
+  }
+
+  const Template_info_t &first_template = *templates.front();
+  int chamferMapWidth = query_info.m_distImg.cols - first_template.m_size.width + 1;
+  int chamferMapHeight = query_info.m_distImg.rows - first_template.m_size.height + 1;
+
+  if(chamferMapWidth <= 0 || chamferMapHeight <= 0) {
+    return true;
+  }
+
+  for(size_t cpt_tpl = 0; cpt_tpl < templates.size(); cpt_tpl++) {
+    chamferMaps[cpt_tpl].create(chamferMapHeight, chamferMapWidth, CV_32F);
+    chamferMaps[cpt_tpl].setTo(std::numeric_limits<float>::max());
+  }
+
+  //Same query ROI for all the templates of the group
+  int startI = first_template.m_queryROI.y;
+  int endI = first_template.m_queryROI.height > 0 ? startI+first_template.m_queryROI.height : chamferMapHeight;
+  int startJ = first_template.m_queryROI.x;
+  int endJ = first_template.m_queryROI.width > 0 ? startJ+first_template.m_queryROI.width : chamferMapWidth;
+
+  //Rejection parameters of each template (calibrated or global)
+  const bool useRejection = m_rejectionType == gridDescriptorRejection;
+  std::vector<float> maxDistanceErrors(templates.size()), maxOrientationErrors(templates.size());
+  std::vector<int> minNbMatches(templates.size());
+  for(size_t cpt_tpl = 0; cpt_tpl < templates.size(); cpt_tpl++) {
+    const RejectionParams_t &params = templates[cpt_tpl]->m_rejectionParams;
+    maxDistanceErrors[cpt_tpl] = params.isCalibrated() ? params.m_maxDescriptorDistanceError :
+        m_maxDescriptorDistanceError;
+    maxOrientationErrors[cpt_tpl] = params.isCalibrated() ? params.m_maxDescriptorOrientationError :
+        m_maxDescriptorOrientationError;
+    minNbMatches[cpt_tpl] = params.isCalibrated() ? params.m_minNbDescriptorMatches : m_minNbDescriptorMatches;
+  }
+
+  //Same grid locations for all the templates of the group
+  const std::vector<cv::Point> &gridLocations = first_template.m_gridDescriptorsLocations;
+
+  std::atomic<bool> interrupted(false);
+
+  const int nbRows = (endI - startI + yStep - 1) / yStep;
+  getExecutor().parallelFor(0, nbRows, [&](const int firstRow, const int lastRow) {
+    TraceSpan span(m_traceRecorder, "groupScoringRows", "chunk");
+    span.addArg("firstRow", firstRow);
+    span.addArg("lastRow", lastRow);
+    //Per chunk descriptors of the current location
+    std::vector<float> query_dists(gridLocations.size()), query_orientations(gridLocations.size());
+
+    for(int row = firstRow; row < lastRow; row++) {
+      const int i = startI + row*yStep;
+      if(deadline != NULL && (interrupted.load(std::memory_order_relaxed) || deadline->isExpired())) {
+        interrupted.store(true, std::memory_order_relaxed);
+        continue;
+      }
+
+      for(int j = startJ; j < endJ; j += xStep) {
+        bool descriptorsLoaded = false;
+
+        for(size_t cpt_tpl = 0; cpt_tpl < templates.size(); cpt_tpl++) {
+          const Template_info_t &template_info = *templates[cpt_tpl];
+          uchar &mask = rejection_masks[cpt_tpl].ptr<uchar>(i)[j];
+          if(mask == 0) {
+            continue;
+          }
+
+          if(useRejection) {
+            if(!descriptorsLoaded) {
+              for(size_t cpt = 0; cpt < gridLocations.size(); cpt++) {
+                cv::Point location = gridLocations[cpt] + cv::Point(j, i);
+                query_dists[cpt] = query_info.m_distImg.ptr<float>(location.y)[location.x];
+                query_orientations[cpt] = query_info.m_mapOfEdgeOrientation.ptr<float>(location.y)[location.x];
+              }
+              descriptorsLoaded = true;
+            }
+
+            int nbMatches = 0;
+            for(size_t cpt = 0; cpt < gridLocations.size(); cpt++) {
+              if( std::fabs(query_dists[cpt]-template_info.m_gridDescriptors[cpt].first) < maxDistanceErrors[cpt_tpl]
+                  && std::fabs(query_orientations[cpt]-template_info.m_gridDescriptors[cpt].second) <
+                  maxOrientationErrors[cpt_tpl] ) {
+                nbMatches++;
+              }
+            }
+
+            if(nbMatches < minNbMatches[cpt_tpl]) {
+              mask = 0;
+              continue;
+            }
+          }
+
+          //Top-K mode: current k-th best cost, shared by all the threads
+          float maxCost = topKBound != NULL ? topKBound->get() : std::numeric_limits<float>::max();
+          float cost = (float) computeLocationCost(template_info, query_info, j, i, useOrientation, lambda,
+              weight_forward, weight_backward, maxCost);
+          chamferMaps[cpt_tpl].ptr<float>(i)[j] = cost;
+
+          if(topKBound != NULL && cost < maxCost) {
+            topKBound->update(templateIds[cpt_tpl], cost);
+          }
+        }
+      }
+    }
+  }, m_maxParallelism);
+
+  return !interrupted;
+}
+
+/*
+ * Compute the Chamfer maps (edgeMatching) of all the scales of a template from the point sets scaled around
+ * the template center: the window centers are swept once and, at each center, every scale is scored while
+ * the distance transform neighbourhood is in the cache. The grid descriptors are scaled in the same way,
+ * their distance transform value being proportional to the scale.
+ * With useScalePruning, the anchor scales (one every m_scalePruningStride and the last one) are scored first
+ * at each center. The points of an intermediate scale are the points of its neighbouring anchors moved by a
+ * known displacement, so the mean distance transform at the anchor minus the mean chamfer length of the
+ * displacements (getScalePruningSlack) bounds its cost from below, the orientation term being positive.
+ * The intermediate scales whose bound is not below distanceThresh (or the top-K bound) are skipped at this
+ * center: they cannot give a detection, the detections are unchanged.
+ */
+bool ChamferMatcher::computeScaledMatchingMaps(const Template_info_t &template_info, const int templateId,
+    const std::vector<ScaledPointSet_t> &pointSets, const Query_info_t &query_info,
+    std::vector<cv::Mat> &chamferMaps, const bool useOrientation, const int xStep, const int yStep,
+    const float lambda, const float weight_forward, const bool useScalePruning, const float distanceThresh,
+    TopKBound *topKBound, const DetectionDeadline *deadline) {
+  //Same orientations at all the scales
+  const std::vector<float> &orientations = template_info.m_edgesOrientation.m_data;
+
+  //Bounding indexes of the window centers (the query ROI applies to the top left corner)
+  int minCenterX = std::numeric_limits<int>::max(), maxCenterX = 0;
+  int minCenterY = std::numeric_limits<int>::max(), maxCenterY = 0;
+  std::vector<cv::Rect> validCorners(pointSets.size());
+  for(size_t cpt_scale = 0; cpt_scale < pointSets.size(); cpt_scale++) {
+    const ScaledPointSet_t &pointSet = pointSets[cpt_scale];
+    int chamferMapWidth = query_info.m_distImg.cols - pointSet.m_size.width + 1;
+    int chamferMapHeight = query_info.m_distImg.rows - pointSet.m_size.height + 1;
+    if(chamferMapWidth <= 0 || chamferMapHeight <= 0) {
+      chamferMaps[cpt_scale].release();
+      continue;
+    }
+
+    chamferMaps[cpt_scale].create(chamferMapHeight, chamferMapWidth, CV_32F);
+    chamferMaps[cpt_scale].setTo(std::numeric_limits<float>::max());
+
+    cv::Rect corners(0, 0, chamferMapWidth, chamferMapHeight);
+    if(template_info.m_queryROI.width > 0 && template_info.m_queryROI.height > 0) {
+      corners &= template_info.m_queryROI;
+    }
+    validCorners[cpt_scale] = corners;
+
+    if(corners.area() > 0) {
+      cv::Point center(pointSet.m_size.width / 2, pointSet.m_size.height / 2);
+      minCenterX = std::min(minCenterX, corners.x + center.x);
+      maxCenterX = std::max(maxCenterX, corners.x + corners.width + center.x);
+      minCenterY = std::min(minCenterY, corners.y + center.y);
+      maxCenterY = std::max(maxCenterY, corners.y + corners.height + center.y);
+    }
+  }
+
+  if(minCenterX >= maxCenterX || minCenterY >= maxCenterY) {
+    return true;
+  }
+
+  //Anchor scales first; key: 2 * scale index (+1) - value: previous (next) anchor and its slack
+  const size_t nbScales = pointSets.size();
+  std::vector<bool> isAnchorScale(nbScales, true);
+  std::vector<size_t> scaleOrder, anchorIndexes(2*nbScales);
+  std::vector<double> anchorSlacks(2*nbScales);
+  for(size_t cpt_scale = 0; cpt_scale < nbScales; cpt_scale++) {
+    isAnchorScale[cpt_scale] = !useScalePruning || cpt_scale % m_scalePruningStride == 0 ||
+        cpt_scale == nbScales-1;
+    if(isAnchorScale[cpt_scale]) {
+      scaleOrder.push_back(cpt_scale);
+    }
+  }
+
+  for(size_t cpt_scale = 0; cpt_scale < nbScales; cpt_scale++) {
+    if(!isAnchorScale[cpt_scale]) {
+      scaleOrder.push_back(cpt_scale);
+
+      anchorIndexes[2*cpt_scale] = (cpt_scale / m_scalePruningStride) * m_scalePruningStride;
+      anchorIndexes[2*cpt_scale+1] = std::min(anchorIndexes[2*cpt_scale] + m_scalePruningStride, nbScales-1);
+      for(int cpt = 0; cpt < 2; cpt++) {
+        anchorSlacks[2*cpt_scale+cpt] = getScalePruningSlack(pointSets[cpt_scale],
+            pointSets[anchorIndexes[2*cpt_scale+cpt]]);
+      }
+    }
+  }
+
+  //Rejection parameters (calibrated at 100% or global)
+  const bool useRejection = m_rejectionType == gridDescriptorRejection;
+  const RejectionParams_t &params = template_info.m_rejectionParams;
+  const float maxDescriptorDistanceError = params.isCalibrated() ? params.m_maxDescriptorDistanceError :
+      m_maxDescriptorDistanceError;
+  const float maxDescriptorOrientationError = params.isCalibrated() ? params.m_maxDescriptorOrientationError :
+      m_maxDescriptorOrientationError;
+  const int minNbDescriptorMatches = params.isCalibrated() ? params.m_minNbDescriptorMatches :
+      m_minNbDescriptorMatches;
+
+  std::atomic<bool> interrupted(false);
+
+  const int nbRows = (maxCenterY - minCenterY + yStep - 1) / yStep;
+  getExecutor().parallelFor(0, nbRows, [&](const int firstRow, const int lastRow) {
+    TraceSpan span(m_traceRecorder, "scaledScoringRows", "chunk");
+    span.addArg("firstRow", firstRow);
+    span.addArg("lastRow", lastRow);
+    //Mean distance transform of the anchor scales at the current center, negative if not computed
+    std::vector<double> anchorDistances(nbScales, -1.0);
+    for(int row = firstRow; row < lastRow; row++) {
+      const int cy = minCenterY + row*yStep;
+      if(deadline != NULL && (interrupted.load(std::memory_order_relaxed) || deadline->isExpired())) {
+        interrupted.store(true, std::memory_order_relaxed);
+        continue;
+      }
+
+      for(int cx = minCenterX; cx < maxCenterX; cx += xStep) {
+        if(useScalePruning) {
+          std::fill(anchorDistances.begin(), anchorDistances.end(), -1.0);
+        }
+
+        for(size_t cpt_order = 0; cpt_order < nbScales; cpt_order++) {
+          const size_t cpt_scale = scaleOrder[cpt_order];
+          const ScaledPointSet_t &pointSet = pointSets[cpt_scale];
+          const cv::Rect &corners = validCorners[cpt_scale];
+          int offsetX = cx - pointSet.m_size.width / 2;
+          int offsetY = cy - pointSet.m_size.height / 2;
+          if(!corners.contains(cv::Point(offsetX, offsetY))) {
+            continue;
+          }
+
+          if(!isAnchorScale[cpt_scale]) {
+            float threshold = topKBound != NULL ? topKBound->get() : distanceThresh;
+            double lowerBound = 0.0;
+            for(int cpt = 0; cpt < 2; cpt++) {
+              double anchorDistance = anchorDistances[anchorIndexes[2*cpt_scale+cpt]];
+              if(anchorDistance >= 0.0) {
+                lowerBound = std::max(lowerBound, weight_forward * (anchorDistance - anchorSlacks[2*cpt_scale+cpt]));
+              }
+            }
+
+            if(lowerBound >= threshold) {
+              continue;
+            }
+          }
+
+          if(useRejection && !pointSet.m_gridLocations.empty()) {
+            int nbMatches = 0;
+            for(size_t cpt = 0; cpt < pointSet.m_gridLocations.size(); cpt++) {
+              cv::Point location = pointSet.m_gridLocations[cpt] + cv::Point(offsetX, offsetY);
+
+              float query_dist = query_info.m_distImg.ptr<float>(location.y)[location.x];
+              float query_orientation = query_info.m_mapOfEdgeOrientation.ptr<float>(location.y)[location.x];
+
+              if( std::fabs(query_dist-pointSet.m_gridDistances[cpt]) < maxDescriptorDistanceError
+                  && std::fabs(query_orientation-template_info.m_gridDescriptors[cpt].second) <
+                  maxDescriptorOrientationError ) {
+                nbMatches++;
+              }
+            }
+
+            if(nbMatches < minNbDescriptorMatches) {
+              continue;
+            }
+          }
+
+          //Top-K mode: current k-th best cost, shared by all the threads
+          float maxCost = topKBound != NULL ? topKBound->get() : std::numeric_limits<float>::max();
+          double maxSum = maxCost < std::numeric_limits<float>::max() ?
+              maxCost * (double) pointSet.m_points.size() : std::numeric_limits<double>::max();
+
+          double chamfer_dist = 0.0, distance_sum = 0.0;
+          for(size_t cpt = 0; cpt < pointSet.m_points.size() && chamfer_dist < maxSum; cpt++) {
+            int x = pointSet.m_points[cpt].x + offsetX;
+            int y = pointSet.m_points[cpt].y + offsetY;
+            float dist = query_info.m_distImg.ptr<float>(y)[x];
+            distance_sum += dist;
+
+            if(useOrientation) {
+              chamfer_dist += weight_forward * ( dist
+                  + lambda*(getMinAngleError(orientations[cpt], query_info.m_mapOfEdgeOrientation.ptr<float>(y)[x],
+                      false, true)) );
+            } else {
+              chamfer_dist += weight_forward * dist;
+            }
+          }
+
+          if(useScalePruning && isAnchorScale[cpt_scale] && !pointSet.m_points.empty()) {
+            //Stopped early in the top-K mode: the partial sum still bounds the mean from below
+            anchorDistances[cpt_scale] = distance_sum / pointSet.m_points.size();
+          }
+
+          float cost = chamfer_dist >= maxSum || pointSet.m_points.empty() ? std::numeric_limits<float>::max() :
+              (float) (chamfer_dist / pointSet.m_points.size());
+          chamferMaps[cpt_scale].ptr<float>(offsetY)[offsetX] = cost;
+
+          if(topKBound != NULL && cost < maxCost) {
+            topKBound->update(templateId, cost);
+          }
+        }
+      }
+    }
+  }, m_maxParallelism);
+
+  return !interrupted;
+}
+
 /*
  * Compute the image that contains at each pixel location the Chamfer distance.
  */
-void ChamferMatcher::computeMatchingMap(const Template_info_t &template_info, const Query_info_t &query_info,
+bool ChamferMatcher::computeMatchingMap(const Template_info_t &template_info, const Query_info_t &query_info,
     cv::Mat &chamferMap, cv::Mat &rejection_mask, const bool useOrientation, const int xStep, const int yStep,
-    const float lambda, const float weight_forward, const float weight_backward) {
-  int chamferMapWidth = query_info.m_distImg.cols - template_info.m_distImg.cols + 1;
-  int chamferMapHeight = query_info.m_distImg.rows - template_info.m_distImg.rows + 1;
+    const float lambda, const float weight_forward, const float weight_backward, TopKBound *topKBound,
+    const int templateId, const DetectionDeadline *deadline, StageTimings_t *timings) {
+  int chamferMapWidth = query_info.m_distImg.cols - template_info.m_size.width + 1;
+  int chamferMapHeight = query_info.m_distImg.rows - template_info.m_size.height + 1;
 
   if(chamferMapWidth <= 0 || chamferMapHeight <= 0) {
-    return;
+    return true;
   }
 
-  //Set the map at the maximum float value
-  chamferMap = std::numeric_limits<float>::max()*
-      cv::Mat::ones(chamferMapHeight, chamferMapWidth, CV_32F);
+  //Set the map at the maximum float value (no reallocation if chamferMap already has the right size)
+  chamferMap.create(chamferMapHeight, chamferMapWidth, CV_32F);
+  chamferMap.setTo(std::numeric_limits<float>::max());
 
 #if DEBUG
   //DEBUG:
@@ -697,78 +1415,107 @@ void ChamferMatcher::computeMatchingMap(const Template_info_t &template_info, co
     endJ = startJ + 1;
   }
 
+  StageTimer rejectionTimer(timings, m_traceRecorder, StageTimings_t::rejectionStage);
   computeRejectionMask(template_info, query_info, rejection_mask, startI, endI, yStep, startJ, endJ, xStep);
+  rejectionTimer.stop();
 
+  StageTimer scoringTimer(timings, m_traceRecorder, StageTimings_t::scoringStage);
 
-#pragma omp parallel for
-  for(int i = startI; i < endI; i += yStep) {
-    float *ptr_row = chamferMap.ptr<float>(i);
-    uchar *ptr_row_rejection_mask = rejection_mask.ptr<uchar>(i);
+  //Set by the first thread that sees the deadline expired, the remaining rows are skipped
+  std::atomic<bool> interrupted(false);
 
-    for(int j = startJ; j < endJ; j += xStep) {
-      if(ptr_row_rejection_mask[j] == 0) {
+  const int nbRows = (endI - startI + yStep - 1) / yStep;
+  if(timings != NULL) {
+    timings->m_nbWindows += countQueryWindows(template_info, chamferMap.size(), xStep, yStep);
+  }
+  getExecutor().parallelFor(0, nbRows, [&](const int firstRow, const int lastRow) {
+    TraceSpan span(m_traceRecorder, "scoringRows", "chunk");
+    span.addArg("firstRow", firstRow);
+    span.addArg("lastRow", lastRow);
+    for(int row = firstRow; row < lastRow; row++) {
+      const int i = startI + row*yStep;
+      if(deadline != NULL && (interrupted.load(std::memory_order_relaxed) || deadline->isExpired())) {
+        interrupted.store(true, std::memory_order_relaxed);
         continue;
       }
 
-#if DEBUG
-      //DEBUG:
-      cv::Mat res;
-#endif
+      float *ptr_row = chamferMap.ptr<float>(i);
+      uchar *ptr_row_rejection_mask = rejection_mask.ptr<uchar>(i);
 
-      switch(m_matchingType) {
-      case fullMatching:
-      case maskMatching:
-      case forwardBackwardMaskMatching:
-        ptr_row[j] = computeFullChamferDistance(template_info, query_info, j, i,
-#if DEBUG
-            res,
-#endif
-            useOrientation, lambda);
-        break;
+      for(int j = startJ; j < endJ; j += xStep) {
+        if(ptr_row_rejection_mask[j] == 0) {
+          continue;
+        }
 
-      case edgeMatching:
-      case edgeForwardBackwardMatching:
-      case lineMatching:
-      case lineForwardBackwardMatching:
-      case lineIntegralMatching:
-      default:
-        ptr_row[j] = computeChamferDistance(template_info, query_info, j, i,
-#if DEBUG
-            res,
-#endif
-            useOrientation, lambda, weight_forward, weight_backward);
-        break;
-      }
+        //Top-K mode: current k-th best cost, shared by all the threads
+        float maxCost = topKBound != NULL ? topKBound->get() : std::numeric_limits<float>::max();
+
+  #if DEBUG
+        //DEBUG:
+        cv::Mat res;
+  #endif
+
+        switch(m_matchingType) {
+        case fullMatching:
+        case maskMatching:
+        case forwardBackwardMaskMatching:
+          ptr_row[j] = computeFullChamferDistance(template_info, query_info, j, i,
+  #if DEBUG
+              res,
+  #endif
+              useOrientation, lambda);
+          break;
+
+        case edgeMatching:
+        case edgeForwardBackwardMatching:
+        case lineMatching:
+        case lineForwardBackwardMatching:
+        case lineIntegralMatching:
+        default:
+          ptr_row[j] = computeChamferDistance(template_info, query_info, j, i,
+  #if DEBUG
+              res,
+  #endif
+              useOrientation, lambda, weight_forward, weight_backward, maxCost);
+          break;
+        }
 
-#if DEBUG
-      //DEBUG:
-      if(m_debug && display) {
-        //        std::cout << "ptr_row[" << j << "]=" << ptr_row[j] << std::endl;
+        if(topKBound != NULL && ptr_row[j] < maxCost) {
+          topKBound->update(templateId, ptr_row[j]);
+        }
+
+  #if DEBUG
+        //DEBUG:
+        if(m_debug && display) {
+          //        std::cout << "ptr_row[" << j << "]=" << ptr_row[j] << std::endl;
 
-        cv::Mat query_img_roi = m_query_info.m_img(cv::Rect(j, i, template_info.m_distImg.cols,
-            template_info.m_distImg.rows));
-        cv::Mat displayEdgeAndChamferDist;
-        double threshold = 50;
-        cv::Canny(query_img_roi, displayEdgeAndChamferDist, threshold, 3.0*threshold);
+          cv::Mat query_img_roi = m_query_info.m_img(cv::Rect(j, i, template_info.m_size.width,
+              template_info.m_size.height));
+          cv::Mat displayEdgeAndChamferDist;
+          double threshold = 50;
+          cv::Canny(query_img_roi, displayEdgeAndChamferDist, threshold, 3.0*threshold);
 
-        cv::Mat res_8u;
-        double min, max;
-        cv::minMaxLoc(res, &min, &max);
-        res.convertTo(res_8u, CV_8U, 255.0/(max-min), -255.0*min/(max-min));
+          cv::Mat res_8u;
+          double min, max;
+          cv::minMaxLoc(res, &min, &max);
+          res.convertTo(res_8u, CV_8U, 255.0/(max-min), -255.0*min/(max-min));
 
-        displayEdgeAndChamferDist = displayEdgeAndChamferDist + res_8u;
+          displayEdgeAndChamferDist = displayEdgeAndChamferDist + res_8u;
 
-        cv::imshow("displayEdgeAndChamferDist", displayEdgeAndChamferDist);
-        cv::imshow("res_8u", res_8u);
+          cv::imshow("displayEdgeAndChamferDist", displayEdgeAndChamferDist);
+          cv::imshow("res_8u", res_8u);
 
-        char c = cv::waitKey(0);
-        if(c == 27) {
-          display = false;
+          char c = cv::waitKey(0);
+          if(c == 27) {
+            display = false;
+          }
         }
+  #endif
       }
-#endif
     }
-  }
+  }, m_maxParallelism);
+
+  return !interrupted;
 }
 
 void ChamferMatcher::computeRejectionMask(const Template_info_t &template_info, const Query_info_t &query_info,
@@ -776,35 +1523,50 @@ void ChamferMatcher::computeRejectionMask(const Template_info_t &template_info,
     const int endJ, const int xStep) {
 
   if(m_rejectionType == gridDescriptorRejection) {
-#pragma omp parallel for
-    for(int i = startI; i < endI; i += yStep) {
-      uchar *ptr_row_rejection_mask = rejection_mask.ptr<uchar>(i);
-
-      for(int j = startJ; j < endJ; j += xStep) {
-
-        if(ptr_row_rejection_mask[j]) {
-          int nbMatches = 0;
-          for(size_t cpt = 0; cpt < template_info.m_gridDescriptorsLocations.size(); cpt++) {
-            cv::Point location = template_info.m_gridDescriptorsLocations[cpt] + cv::Point(j, i);
-
-            float query_dist = query_info.m_distImg.ptr<float>(location.y)[location.x];
-            float query_orientation = query_info.m_mapOfEdgeOrientation.ptr<float>(location.y)[location.x];
-
-            float template_dist = template_info.m_gridDescriptors[cpt].first;
-            float template_orientation = template_info.m_gridDescriptors[cpt].second;
-
-            if( std::fabs(query_dist-template_dist) < m_maxDescriptorDistanceError
-                && std::fabs(query_orientation-template_orientation) < m_maxDescriptorOrientationError ) {
-              nbMatches++;
+    //Parameters calibrated for this template and scale, or the global ones
+    const RejectionParams_t &params = template_info.m_rejectionParams;
+    const float maxDescriptorDistanceError = params.isCalibrated() ? params.m_maxDescriptorDistanceError :
+        m_maxDescriptorDistanceError;
+    const float maxDescriptorOrientationError = params.isCalibrated() ? params.m_maxDescriptorOrientationError :
+        m_maxDescriptorOrientationError;
+    const int minNbDescriptorMatches = params.isCalibrated() ? params.m_minNbDescriptorMatches :
+        m_minNbDescriptorMatches;
+
+    const int nbRows = (endI - startI + yStep - 1) / yStep;
+    getExecutor().parallelFor(0, nbRows, [&](const int firstRow, const int lastRow) {
+      TraceSpan span(m_traceRecorder, "rejectionRows", "chunk");
+      span.addArg("firstRow", firstRow);
+      span.addArg("lastRow", lastRow);
+      for(int row = firstRow; row < lastRow; row++) {
+        const int i = startI + row*yStep;
+        uchar *ptr_row_rejection_mask = rejection_mask.ptr<uchar>(i);
+
+        for(int j = startJ; j < endJ; j += xStep) {
+
+          if(ptr_row_rejection_mask[j]) {
+            int nbMatches = 0;
+            for(size_t cpt = 0; cpt < template_info.m_gridDescriptorsLocations.size(); cpt++) {
+              cv::Point location = template_info.m_gridDescriptorsLocations[cpt] + cv::Point(j, i);
+
+              float query_dist = query_info.m_distImg.ptr<float>(location.y)[location.x];
+              float query_orientation = query_info.m_mapOfEdgeOrientation.ptr<float>(location.y)[location.x];
+
+              float template_dist = template_info.m_gridDescriptors[cpt].first;
+              float template_orientation = template_info.m_gridDescriptors[cpt].second;
+
+              if( std::fabs(query_dist-template_dist) < maxDescriptorDistanceError
+                  && std::fabs(query_orientation-template_orientation) < maxDescriptorOrientationError ) {
+                nbMatches++;
+              }
             }
-          }
 
-          if(nbMatches < m_minNbDescriptorMatches) {
-            ptr_row_rejection_mask[j] = 0;
+            if(nbMatches < minNbDescriptorMatches) {
+              ptr_row_rejection_mask[j] = 0;
+            }
           }
         }
       }
-    }
+    }, m_maxParallelism);
   }
 }
 
@@ -822,7 +1584,8 @@ void ChamferMatcher::createMapOfEdgeOrientations(const cv::Mat &img, const cv::M
   std::map<int, std::pair<int, int> > mapOfIndex;
   computeEdgeMapIndex(contours, labels, mapOfIndex);
 
-  mapOfEdgeOrientations = cv::Mat::zeros(img.size(), CV_32F);
+  //Every pixel is set below
+  mapOfEdgeOrientations.create(img.size(), CV_32F);
   for(int i = 0; i < img.rows; i++) {
     const int *ptr_row_label = labels.ptr<int>(i);
     float *ptr_row_edgeOri = mapOfEdgeOrientations.ptr<float>(i);
@@ -837,6 +1600,49 @@ void ChamferMatcher::createMapOfEdgeOrientations(const cv::Mat &img, const cv::M
   }
 }
 
+/*
+ * Same as above with a contiguous storage of the contours and the orientations.
+ */
+void ChamferMatcher::createMapOfEdgeOrientations(const cv::Mat &img, const cv::Mat &labels, cv::Mat &mapOfEdgeOrientations,
+    CSRArray_t<cv::Point> &contours, CSRArray_t<float> &edges_orientation) {
+  //Find contours
+  std::vector<std::vector<cv::Point> > vectorOfContours;
+  getContours(img, vectorOfContours);
+  contours.assign(vectorOfContours);
+
+  //Compute orientation for each contour point
+  getContoursOrientation(contours, edges_orientation);
+
+  //Label -> index in the contiguous storage
+  std::vector<size_t> mapOfIndex;
+  for(size_t i = 0; i < contours.nbElements(); i++) {
+    const cv::Point &pt = contours.m_data[i];
+    int label = labels.ptr<int>(pt.y)[pt.x];
+    if(label >= (int) mapOfIndex.size()) {
+      mapOfIndex.resize(label+1, 0);
+    }
+    mapOfIndex[label] = i;
+  }
+
+  //Every pixel is set below
+  mapOfEdgeOrientations.create(img.size(), CV_32F);
+  if(edges_orientation.nbElements() == 0) {
+    mapOfEdgeOrientations = 0.0f;
+    return;
+  }
+
+  const float *ptr_edges_ori = &edges_orientation.m_data[0];
+  for(int i = 0; i < img.rows; i++) {
+    const int *ptr_row_label = labels.ptr<int>(i);
+    float *ptr_row_edgeOri = mapOfEdgeOrientations.ptr<float>(i);
+
+    for(int j = 0; j < img.cols; j++) {
+      size_t idx = ptr_row_label[j] >= 0 && ptr_row_label[j] < (int) mapOfIndex.size() ? mapOfIndex[ptr_row_label[j]] : 0;
+      ptr_row_edgeOri[j] = ptr_edges_ori[idx];
+    }
+  }
+}
+
 /*
  * Create a LUT that maps an angle in degree to the corresponding index.
  */
@@ -866,7 +1672,8 @@ void ChamferMatcher::createTemplateMask(const cv::Mat &img, cv::Mat &mask, const
   std::vector<std::vector<cv::Point> > contours;
   getContours(img, contours, threshold);
 
-  mask = cv::Mat::zeros(img.size(), CV_8U);
+  mask.create(img.size(), CV_8U);
+  mask.setTo(0);
   for(int i = 0; i < contours.size(); i++) {
     cv::drawContours(mask, contours, i, cv::Scalar(255), -1);
   }
@@ -875,56 +1682,147 @@ void ChamferMatcher::createTemplateMask(const cv::Mat &img, cv::Mat &mask, const
 /*
  * Detect an image template in a query image.
  */
-void ChamferMatcher::detect_impl(const Template_info_t &template_info, const Query_info_t &query_info, const int scale,
-    std::vector<Detection_t> &currentDetections, cv::Mat &rejection_mask, const bool useOrientation,
-    const float distanceThresh, const float lambda, const float weight_forward,
-    const float weight_backward, const bool useGroupDetections) {
+bool ChamferMatcher::detect_impl(const Template_info_t &template_info, const Query_info_t &query_info, const int scale,
+    DetectionWorkspace &workspace, std::vector<Detection_t> &currentDetections, cv::Mat &rejection_mask,
+    const bool useOrientation, const float distanceThresh, const float lambda, const float weight_forward,
+    const float weight_backward, const bool useGroupDetections, TopKBound *topKBound,
+    const int templateId, const DetectionDeadline *deadline) {
+  TraceSpan span(m_traceRecorder, "detect_impl", "job");
+  span.addArg("templateId", templateId);
+  span.addArg("scale", scale);
+  currentDetections.clear();
+
+  int chamferMapWidth = query_info.m_distImg.cols - template_info.m_size.width + 1;
+  int chamferMapHeight = query_info.m_distImg.rows - template_info.m_size.height + 1;
+  if(chamferMapWidth <= 0 || chamferMapHeight <= 0) {
+    return true;
+  }
 
-  cv::Mat chamferMap;
-  computeMatchingMap(template_info, query_info, chamferMap, rejection_mask, useOrientation, 5, 5, lambda,
-      weight_forward, weight_backward);
+  int64 t_start = m_costReport != NULL ? cv::getTickCount() : 0;
+  cv::Mat chamferMap = workspace.getChamferMap(chamferMapHeight, chamferMapWidth);
+  //If interrupted, the detections are extracted from the part of the map computed
+  bool complete = computeMatchingMap(template_info, query_info, chamferMap, rejection_mask, useOrientation, 5, 5,
+      lambda, weight_forward, weight_backward, topKBound, templateId, deadline, getStageTimings(workspace));
+  //Counted before the extraction overwrites the minima
+  double nbScoredWindows = m_costReport != NULL && templateId >= 0 ? countScoredWindows(chamferMap) : 0.0;
 
-  if(!chamferMap.empty()) {
-    double minVal, maxVal;
-    //Avoid possibility of infinite loop and / or keep a maximum of 100 detections
-    int maxLoopIterations = 100, iteration = 0;
+  extractDetections(template_info.m_size, chamferMap, scale, workspace, currentDetections, rejection_mask, distanceThresh,
+      useGroupDetections, templateId);
 
-    std::vector<Detection_t> all_detections;
-    do {
-      iteration++;
+  if(m_costReport != NULL && templateId >= 0) {
+    addTemplateCost(template_info, templateId, scale, chamferMap.size(), nbScoredWindows, getNbPoints(template_info),
+        elapsedMs(t_start), currentDetections.size());
+  }
 
-      //Find the pixel location of the minimal Chamfer distance.
-      cv::Point minLoc, maxLoc;
-      cv::minMaxLoc(chamferMap, &minVal, &maxVal, &minLoc, &maxLoc);
+  return complete;
+}
 
-      //"Reset the location" to find other detections
-      chamferMap.at<float>(minLoc.y, minLoc.x) = std::numeric_limits<float>::max();
+void ChamferMatcher::extractDetections(const cv::Size &templateSize, cv::Mat &chamferMap, const int scale,
+    DetectionWorkspace &workspace, std::vector<Detection_t> &currentDetections, cv::Mat &rejection_mask,
+    const float distanceThresh, const bool useGroupDetections, const int templateId) {
+  currentDetections.clear();
 
-      cv::Point pt1(minLoc.x, minLoc.y);
-      cv::Point pt2 = pt1 + cv::Point(template_info.m_distImg.cols, template_info.m_distImg.rows);
+  if(templateId >= 0 && workspace.m_retainedCostMaps) {
+    workspace.m_retainedCostMaps->add(templateId, scale, templateSize, chamferMap);
+  }
 
-      if(minVal < distanceThresh) {
-        //Add the detection
-        cv::Rect detection(pt1, pt2);
-        Detection_t detect_t(detection, minVal, scale);
-        all_detections.push_back(detect_t);
-      }
-    } while( minVal < distanceThresh && iteration <= maxLoopIterations );
+  double minVal, maxVal;
+  //Avoid possibility of infinite loop and / or keep a maximum of 100 detections
+  int maxLoopIterations = 100, iteration = 0;
 
-    //Group similar detections
-    if(useGroupDetections) {
-      groupDetections(all_detections, currentDetections);
-    } else {
-      currentDetections = all_detections;
+  StageTimer extractionTimer(getStageTimings(workspace), m_traceRecorder, StageTimings_t::extractionStage);
+  std::vector<Detection_t> &all_detections = workspace.m_rawDetections;
+  all_detections.clear();
+  do {
+    iteration++;
+
+    //Find the pixel location of the minimal Chamfer distance.
+    cv::Point minLoc, maxLoc;
+    cv::minMaxLoc(chamferMap, &minVal, &maxVal, &minLoc, &maxLoc);
+
+    //"Reset the location" to find other detections
+    chamferMap.at<float>(minLoc.y, minLoc.x) = std::numeric_limits<float>::max();
+
+    cv::Point pt1(minLoc.x, minLoc.y);
+    cv::Point pt2 = pt1 + cv::Point(templateSize.width, templateSize.height);
+
+    if(minVal < distanceThresh) {
+      //Add the detection
+      cv::Rect detection(pt1, pt2);
+      Detection_t detect_t(detection, minVal, scale);
+      all_detections.push_back(detect_t);
     }
+  } while( minVal < distanceThresh && iteration <= maxLoopIterations );
+  extractionTimer.stop();
+
+  //Group similar detections
+  StageTimer groupingTimer(getStageTimings(workspace), m_traceRecorder, StageTimings_t::groupingStage);
+  if(useGroupDetections) {
+    groupDetections(all_detections, currentDetections);
+  } else {
+    currentDetections = all_detections;
+  }
+
+  //Sort detections by increasing cost
+  std::sort(currentDetections.begin(), currentDetections.end());
+  groupingTimer.stop();
+
+  if(m_pyramidType == pyramid2) {
+    cv::compare(chamferMap, distanceThresh, rejection_mask, cv::CMP_LT);
+  }
+}
+
+/*
+ * Compute on the half resolution query the mask of the locations to process at the regular resolution.
+ * Return false if the mask cannot be computed (query smaller than the template).
+ */
+bool ChamferMatcher::computeHalfRejectionMask(const Template_info_t &half_template_info,
+    const Query_info_t &half_query_info, const int half_scale, DetectionWorkspace &workspace,
+    cv::Mat &half_rejection_mask, const bool useOrientation, const float distanceThresh, const float lambda,
+    const float weight_forward, const float weight_backward, const bool useGroupDetections, float *bestCost) {
+  int half_chamferMapWidth = half_query_info.m_distImg.cols - half_template_info.m_size.width + 1;
+  int half_chamferMapHeight = half_query_info.m_distImg.rows - half_template_info.m_size.height + 1;
+
+  if(half_chamferMapWidth <= 0 || half_chamferMapHeight <= 0) {
+    return false;
+  }
 
-    //Sort detections by increasing cost
-    std::sort(currentDetections.begin(), currentDetections.end());
+  half_rejection_mask.create(half_chamferMapHeight, half_chamferMapWidth, CV_8U);
+  half_rejection_mask.setTo(1);
 
-    if(m_pyramidType == pyramid2) {
-      rejection_mask = (chamferMap < distanceThresh);
+  //Compute the bounding indexes where we want to perform the matching
+  int startI = half_template_info.m_queryROI.y;
+  int endI = half_template_info.m_queryROI.height > 0 ?
+      startI + half_template_info.m_queryROI.height/2 : half_chamferMapHeight;
+  int startJ = half_template_info.m_queryROI.x;
+  int endJ = half_template_info.m_queryROI.width > 0 ?
+      startJ + half_template_info.m_queryROI.width/2 : half_chamferMapWidth;
+
+  if(m_pyramidType == pyramid1) {
+    StageTimer rejectionTimer(getStageTimings(workspace), m_traceRecorder, StageTimings_t::rejectionStage);
+    computeRejectionMask(half_template_info, half_query_info, half_rejection_mask, startI, endI, 5, startJ, endJ, 5);
+  } else {
+    //Timed as the regular detections
+    detect_impl(half_template_info, half_query_info, half_scale, workspace, workspace.m_currentDetections,
+        half_rejection_mask, useOrientation, distanceThresh, lambda, weight_forward, weight_backward,
+        useGroupDetections);
+
+    if(bestCost != NULL && !workspace.m_currentDetections.empty()) {
+      //Sorted by increasing cost
+      *bestCost = workspace.m_currentDetections.front().m_chamferDist;
     }
   }
+
+  //Use dilate to increase regions of interest
+  int dilation_size = 5;
+  static const cv::Mat element = cv::getStructuringElement( cv::MORPH_RECT,
+      cv::Size( 2*dilation_size + 1, 2*dilation_size+1 ),
+      cv::Point( dilation_size, dilation_size ) );
+
+  StageTimer dilationTimer(getStageTimings(workspace), m_traceRecorder, StageTimings_t::rejectionStage);
+  cv::dilate(half_rejection_mask, half_rejection_mask, element);
+
+  return true;
 }
 
 /*
@@ -933,194 +1831,523 @@ void ChamferMatcher::detect_impl(const Template_info_t &template_info, const Que
 void ChamferMatcher::detect(const cv::Mat &img_query, std::vector<Detection_t> &detections, const bool useOrientation,
     const float distanceThresh, const float lambda, const float weight_forward, const float weight_backward,
     const bool useGroupDetections) {
+  detect(DetectionQuery_t(img_query), detections, useOrientation, distanceThresh, lambda, weight_forward,
+      weight_backward, useGroupDetections);
+}
+
+bool ChamferMatcher::detect(const DetectionQuery_t &query, std::vector<Detection_t> &detections,
+    const bool useOrientation, const float distanceThresh, const float lambda, const float weight_forward,
+    const float weight_backward, const bool useGroupDetections) {
+  DetectionWorkspace call_workspace;
+  DetectionWorkspace &workspace = query.m_workspace != NULL ? *query.m_workspace : call_workspace;
+  DetectionDeadline noDeadline;
+  const DetectionDeadline &deadline = query.m_deadline != NULL ? *query.m_deadline : noDeadline;
+
+  if(query.m_image != NULL) {
+    QueryImageLoader query_loader(*query.m_image);
+    return detectQuery(&query_loader, NULL, workspace, deadline, detections, useOrientation, distanceThresh, lambda,
+        weight_forward, weight_backward, useGroupDetections);
+  }
+
+  return detectQuery(query.m_loader, query.m_preparedQuery, workspace, deadline, detections, useOrientation,
+      distanceThresh, lambda, weight_forward, weight_backward, useGroupDetections);
+}
+
+/*
+ * Detect on a single scale, the query image is decoded at the resolutions needed (or taken already prepared).
+ * With a pyramid, the half resolution is decoded directly and the regular resolution
+ * is decoded only if at least one location is not rejected.
+ * The detection stops when the deadline expires, return false in this case.
+ */
+bool ChamferMatcher::detectQuery(QueryImageLoader *query_loader, const PreparedQuery_t *prepared_query,
+    DetectionWorkspace &workspace, const DetectionDeadline &deadline, std::vector<Detection_t> &detections,
+    const bool useOrientation, const float distanceThresh, const float lambda, const float weight_forward,
+    const float weight_backward, const bool useGroupDetections) {
+  TraceSpan span(m_traceRecorder, "detect", "detection");
   detections.clear();
+  workspace.m_mapOfCoarseCosts.clear();
+  if(m_matAllocator != NULL) {
+    workspace.setAllocator(m_matAllocator);
+  }
+
+  workspace.m_stageTimings.clear();
+  //New object, the caller may still hold the cost maps of the previous detection
+  workspace.m_retainedCostMaps.reset();
+  if(m_retainCostMaps) {
+    workspace.m_retainedCostMaps = std::make_shared<RetainedCostMaps>(distanceThresh);
+  }
 
 
   int half_scale = 50, regular_scale = 100;
 
-  cv::Mat half_query;
-  Query_info_t half_query_info;
-  if(m_pyramidType != noPyramid) {
-    //PyrDown
-    cv::pyrDown(img_query, half_query);
-    half_query_info = prepareQuery(half_query);
+  //Pin the current template library for the whole detection
+  const std::shared_ptr<const TemplateLibrary_t> library = getTemplateLibrary();
+  const std::map<int, std::shared_ptr<const TemplateScales_t> > &mapOfTemplate_info = library->m_mapOfTemplate_info;
+  if(!hasTemplateMaps(*library)) {
+    std::cerr << "The templates were prepared compact for another matching type!" << std::endl;
+    return true;
+  }
+  if(workspace.m_library != library) {
+    //The masks are keyed by the templates of the previous library
+    workspace.m_mapOfHalfRejectionMasks.clear();
+    workspace.m_library = library;
+  }
+
+  //Invalidate the masks of the previous query
+  for(std::map<const Template_info_t*, std::pair<bool, cv::Mat> >::iterator it_mask =
+      workspace.m_mapOfHalfRejectionMasks.begin(); it_mask != workspace.m_mapOfHalfRejectionMasks.end(); ++it_mask) {
+    it_mask->second.first = false;
+  }
+
+  if(m_pyramidType != noPyramid && m_matchingStrategyType != templatePoseMatching) {
+    const Query_info_t *ptr_half_query_info = getQueryInfo(query_loader, prepared_query, workspace, 2);
+    if(ptr_half_query_info == NULL) {
+      return true;
+    }
+
+    const Query_info_t &half_query_info = *ptr_half_query_info;
+    bool needRegularScale = false;
+
+    for(std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it = mapOfTemplate_info.begin();
+        it != mapOfTemplate_info.end(); ++it) {
+      if(deadline.isExpired()) {
+        //Nothing matched at the regular resolution yet
+        return false;
+      }
+
+      std::map<int, Template_info_t>::const_iterator it_template = it->second->find(regular_scale);
+      std::map<int, Template_info_t>::const_iterator it_template_half = it->second->find(half_scale);
+
+      if(it_template != it->second->end() && it_template_half != it->second->end()) {
+        std::pair<bool, cv::Mat> &half_mask = workspace.m_mapOfHalfRejectionMasks[&it_template->second];
+        float bestCost = std::numeric_limits<float>::max();
+        half_mask.first = computeHalfRejectionMask(it_template_half->second, half_query_info, half_scale, workspace,
+            half_mask.second, useOrientation, distanceThresh, lambda, weight_forward, weight_backward,
+            useGroupDetections, &bestCost);
+        workspace.m_mapOfCoarseCosts[it->first] = bestCost;
+        needRegularScale = needRegularScale || !half_mask.first || cv::countNonZero(half_mask.second) > 0;
+      } else {
+        //No coarse information, the template has to be matched on the whole regular resolution
+        needRegularScale = true;
+      }
+    }
+
+    if(!needRegularScale) {
+      //Every location is rejected, no need to decode the regular resolution
+      return true;
+    }
+  }
+
+  const Query_info_t *ptr_query_info = getQueryInfo(query_loader, prepared_query, workspace, 1);
+  if(ptr_query_info == NULL) {
+    return true;
+  }
+
+  const Query_info_t &query_info = *ptr_query_info;
+
+  TopKBound topKBound(m_topK, distanceThresh);
+  TopKBound *ptr_topKBound = m_topK > 0 ? &topKBound : NULL;
+
+  std::vector<Detection_t> &all_detections = workspace.m_templateDetections;
+  getTemplateOrder(*library, workspace.m_mapOfCoarseCosts, workspace.m_mapOfTemplateHits, workspace.m_templateOrder);
+  getTemplateGroups(*library, workspace.m_templateOrder, regular_scale, workspace.m_templateGroups);
+  bool complete = true;
+  std::vector<const Template_info_t*> group_templates;
+  for(std::vector<std::vector<int> >::const_iterator it_group = workspace.m_templateGroups.begin();
+      it_group != workspace.m_templateGroups.end() && complete; ++it_group) {
+    if(deadline.isExpired()) {
+      complete = false;
+      break;
+    }
+
+    group_templates.clear();
+    for(std::vector<int>::const_iterator it_id = it_group->begin(); it_id != it_group->end(); ++it_id) {
+      std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it = mapOfTemplate_info.find(*it_id);
+      std::map<int, Template_info_t>::const_iterator it_template = it->second->find(regular_scale);
+      if(it_template == it->second->end()) {
+        std::cerr << "Cannot find template at regular scale!" << std::endl;
+        return true;
+      }
+
+      group_templates.push_back(&it_template->second);
+    }
+
+    //Same size for all the templates of the group
+    int chamferMapWidth = query_info.m_distImg.cols - group_templates.front()->m_size.width + 1;
+    int chamferMapHeight = query_info.m_distImg.rows - group_templates.front()->m_size.height + 1;
+    if(chamferMapWidth <= 0 || chamferMapHeight <= 0) {
+      continue;
+    }
+
+    if(group_templates.size() == 1) {
+      const Template_info_t &template_info = *group_templates.front();
+      int templateId = it_group->front();
+      cv::Mat rejection_mask = workspace.getRejectionMask(chamferMapHeight, chamferMapWidth);
+      initRejectionMask(workspace, template_info, rejection_mask);
+
+#if DEBUG
+      rejection_mask *= 255;
+      std::stringstream ss;
+      ss << "rejection_mask_" << templateId;
+      cv::imshow(ss.str(), rejection_mask);
+      cv::waitKey(30);
+#endif
+
+      //Regular scale
+      complete = detect_impl(template_info, query_info, regular_scale, workspace, all_detections, rejection_mask,
+          useOrientation, distanceThresh, lambda, weight_forward, weight_backward, useGroupDetections,
+          ptr_topKBound, templateId, &deadline);
+
+      //Set Template index
+      for(std::vector<Detection_t>::iterator it_detection = all_detections.begin();
+          it_detection != all_detections.end(); ++it_detection) {
+        it_detection->m_templateIndex = templateId;
+      }
+
+      detections.insert(detections.end(), all_detections.begin(), all_detections.end());
+    } else {
+      //Location-major scan of the group
+      TraceSpan span(m_traceRecorder, "templateGroup", "job");
+      span.addArg("templateId", it_group->front());
+      span.addArg("nbTemplates", (int) group_templates.size());
+      std::vector<cv::Mat> &chamferMaps = workspace.m_groupChamferMaps;
+      std::vector<cv::Mat> &rejection_masks = workspace.m_groupRejectionMasks;
+      if(chamferMaps.size() < group_templates.size()) {
+        chamferMaps.resize(group_templates.size());
+        rejection_masks.resize(group_templates.size());
+      }
+
+      for(size_t cpt_tpl = 0; cpt_tpl < group_templates.size(); cpt_tpl++) {
+        chamferMaps[cpt_tpl].allocator = workspace.getAllocator();
+        rejection_masks[cpt_tpl].allocator = workspace.getAllocator();
+        rejection_masks[cpt_tpl].create(chamferMapHeight, chamferMapWidth, CV_8U);
+        initRejectionMask(workspace, *group_templates[cpt_tpl], rejection_masks[cpt_tpl]);
+      }
+
+      //The rejection is fused with the scoring
+      int64 t_group = m_costReport != NULL ? cv::getTickCount() : 0;
+      StageTimer scoringTimer(getStageTimings(workspace), m_traceRecorder, StageTimings_t::scoringStage);
+      complete = computeGroupMatchingMaps(group_templates, *it_group, query_info, chamferMaps, rejection_masks,
+          useOrientation, 5, 5, lambda, weight_forward, weight_backward, ptr_topKBound, &deadline);
+      scoringTimer.stop();
+      //Shared equally by the templates of the group
+      double groupTime = m_costReport != NULL ? elapsedMs(t_group) / group_templates.size() : 0.0;
+      if(m_useStageTimings) {
+        //Same query ROI for the templates of the group
+        workspace.m_stageTimings.m_nbWindows +=
+            countQueryWindows(*group_templates.front(), cv::Size(chamferMapWidth, chamferMapHeight)) *
+            group_templates.size();
+      }
+
+      for(size_t cpt_tpl = 0; cpt_tpl < group_templates.size(); cpt_tpl++) {
+        int64 t_extraction = m_costReport != NULL ? cv::getTickCount() : 0;
+        double nbScoredWindows = m_costReport != NULL ? countScoredWindows(chamferMaps[cpt_tpl]) : 0.0;
+        extractDetections(group_templates[cpt_tpl]->m_size, chamferMaps[cpt_tpl], regular_scale, workspace,
+            all_detections, rejection_masks[cpt_tpl], distanceThresh, useGroupDetections, (*it_group)[cpt_tpl]);
+        if(m_costReport != NULL) {
+          addTemplateCost(*group_templates[cpt_tpl], (*it_group)[cpt_tpl], regular_scale, chamferMaps[cpt_tpl].size(),
+              nbScoredWindows, getNbPoints(*group_templates[cpt_tpl]), groupTime + elapsedMs(t_extraction),
+              all_detections.size());
+        }
+
+        //Set Template index
+        for(std::vector<Detection_t>::iterator it_detection = all_detections.begin();
+            it_detection != all_detections.end(); ++it_detection) {
+          it_detection->m_templateIndex = (*it_group)[cpt_tpl];
+        }
+
+        detections.insert(detections.end(), all_detections.begin(), all_detections.end());
+      }
+    }
+  }
+
+  //Sort detections by increasing cost
+  std::sort(detections.begin(), detections.end());
+
+  if(m_topK > 0) {
+    retainTopK(workspace, detections);
+  }
+
+  return complete;
+}
+
+/*
+ * Detect on multiple scales.
+ */
+void ChamferMatcher::detectMultiScale(const cv::Mat &img_query, std::vector<Detection_t> &detections,
+    const bool useOrientation, const float distanceThresh, const float lambda, const float weight_forward,
+    const float weight_backward, const bool useNonMaximaSuppression, const bool useGroupDetections) {
+  detectMultiScale(DetectionQuery_t(img_query), detections, useOrientation, distanceThresh, lambda, weight_forward,
+      weight_backward, useNonMaximaSuppression, useGroupDetections);
+}
+
+bool ChamferMatcher::detectMultiScale(const DetectionQuery_t &query, std::vector<Detection_t> &detections,
+    const bool useOrientation, const float distanceThresh, const float lambda, const float weight_forward,
+    const float weight_backward, const bool useNonMaximaSuppression, const bool useGroupDetections) {
+  DetectionWorkspace call_workspace;
+  DetectionWorkspace &workspace = query.m_workspace != NULL ? *query.m_workspace : call_workspace;
+  DetectionDeadline noDeadline;
+  const DetectionDeadline &deadline = query.m_deadline != NULL ? *query.m_deadline : noDeadline;
+
+  if(query.m_image != NULL) {
+    QueryImageLoader query_loader(*query.m_image);
+    return detectMultiScaleQuery(&query_loader, NULL, workspace, deadline, detections, useOrientation,
+        distanceThresh, lambda, weight_forward, weight_backward, useNonMaximaSuppression, useGroupDetections);
+  }
+
+  return detectMultiScaleQuery(query.m_loader, query.m_preparedQuery, workspace, deadline, detections,
+      useOrientation, distanceThresh, lambda, weight_forward, weight_backward, useNonMaximaSuppression,
+      useGroupDetections);
+}
+
+/*
+ * Detect on multiple scales, the query image is decoded at the resolutions needed (or taken already prepared).
+ * The detection stops when the deadline expires, return false in this case.
+ */
+bool ChamferMatcher::detectMultiScaleQuery(QueryImageLoader *query_loader, const PreparedQuery_t *prepared_query,
+    DetectionWorkspace &workspace, const DetectionDeadline &deadline, std::vector<Detection_t> &detections,
+    const bool useOrientation, const float distanceThresh, const float lambda, const float weight_forward,
+    const float weight_backward, const bool useNonMaximaSuppression, const bool useGroupDetections) {
+  TraceSpan span(m_traceRecorder, "detectMultiScale", "detection");
+  detections.clear();
+  workspace.m_mapOfCoarseCosts.clear();
+  if(m_matAllocator != NULL) {
+    workspace.setAllocator(m_matAllocator);
+  }
+
+  workspace.m_stageTimings.clear();
+  //New object, the caller may still hold the cost maps of the previous detection
+  workspace.m_retainedCostMaps.reset();
+  if(m_retainCostMaps) {
+    workspace.m_retainedCostMaps = std::make_shared<RetainedCostMaps>(distanceThresh);
+  }
+
+  if(m_matchingStrategyType == templatePoseMatching) {
+    std::cerr << "Cannot detect on multiple scales with the matching strategy=templatePoseMatching!" << std::endl;
+    return true;
+  }
+
+  if(m_usePointSetScaling && m_matchingType != edgeMatching) {
+    std::cerr << "The point set scaling requires the matching type=edgeMatching!" << std::endl;
+    return true;
+  }
+
+  //Pin the current template library for the whole detection
+  const std::shared_ptr<const TemplateLibrary_t> library = getTemplateLibrary();
+  const std::map<int, std::shared_ptr<const TemplateScales_t> > &mapOfTemplate_info = library->m_mapOfTemplate_info;
+  if(!hasTemplateMaps(*library)) {
+    std::cerr << "The templates were prepared compact for another matching type!" << std::endl;
+    return true;
+  }
+  const std::vector<int> &scaleVector = library->m_scaleVector;
+  if(workspace.m_library != library) {
+    //The masks are keyed by the templates of the previous library
+    workspace.m_mapOfHalfRejectionMasks.clear();
+    workspace.m_library = library;
+  }
+
+  //Invalidate the masks of the previous query
+  for(std::map<const Template_info_t*, std::pair<bool, cv::Mat> >::iterator it_mask =
+      workspace.m_mapOfHalfRejectionMasks.begin(); it_mask != workspace.m_mapOfHalfRejectionMasks.end(); ++it_mask) {
+    it_mask->second.first = false;
+  }
+
+  //No template prepared at the other scales with the point set scaling
+  if(m_pyramidType != noPyramid && !m_usePointSetScaling) {
+    const Query_info_t *ptr_half_query_info = getQueryInfo(query_loader, prepared_query, workspace, 2);
+    if(ptr_half_query_info == NULL) {
+      return true;
+    }
+
+    const Query_info_t &half_query_info = *ptr_half_query_info;
+    bool needRegularScale = false;
+
+    for(std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it1 = mapOfTemplate_info.begin();
+        it1 != mapOfTemplate_info.end(); ++it1) {
+      if(deadline.isExpired()) {
+        //Nothing matched at the regular resolution yet
+        return false;
+      }
+
+      for(std::vector<int>::const_iterator it2 = scaleVector.begin(); it2 != scaleVector.end(); ++it2) {
+        std::map<int, Template_info_t>::const_iterator it_tpl_scale = it1->second->find(*it2);
+        if(it_tpl_scale == it1->second->end()) {
+          continue;
+        }
+
+        int half_scale = (*it2) / 2;
+        std::map<int, Template_info_t>::const_iterator it_template_half = it1->second->find(half_scale);
+
+        if(half_scale > 0 && it_template_half != it1->second->end()) {
+          std::pair<bool, cv::Mat> &half_mask = workspace.m_mapOfHalfRejectionMasks[&it_tpl_scale->second];
+          float bestCost = std::numeric_limits<float>::max();
+          half_mask.first = computeHalfRejectionMask(it_template_half->second, half_query_info, half_scale,
+              workspace, half_mask.second, useOrientation, distanceThresh, lambda, weight_forward, weight_backward,
+              useGroupDetections, &bestCost);
+
+          //Best cost of the template over the scales
+          std::map<int, float>::iterator it_coarse = workspace.m_mapOfCoarseCosts.find(it1->first);
+          if(it_coarse == workspace.m_mapOfCoarseCosts.end()) {
+            workspace.m_mapOfCoarseCosts[it1->first] = bestCost;
+          } else {
+            it_coarse->second = std::min(it_coarse->second, bestCost);
+          }
+          needRegularScale = needRegularScale || !half_mask.first || cv::countNonZero(half_mask.second) > 0;
+        } else {
+          needRegularScale = true;
+        }
+      }
+    }
+
+    if(!needRegularScale) {
+      //Every location is rejected, no need to decode the regular resolution
+      return true;
+    }
   }
 
-  Query_info_t query_info = prepareQuery(img_query);
+  const Query_info_t *ptr_query_info = getQueryInfo(query_loader, prepared_query, workspace, 1);
+  if(ptr_query_info == NULL) {
+    return true;
+  }
 
-  for(std::map<int, std::map<int, Template_info_t> >::const_iterator it = m_mapOfTemplate_info.begin();
-      it != m_mapOfTemplate_info.end(); ++it) {
-    std::vector<Detection_t> all_detections;
+  const Query_info_t &query_info = *ptr_query_info;
+
+  //The bound needs the points of each scale to be the scaled points of the template at 100%
+  bool useScalePruning = m_useScalePruning && m_usePointSetScaling && scaleVector.size() > 2;
+
+  //Scale order, coarse to fine: the anchor scales (one every m_scalePruningStride) are processed first so that
+  //an interrupted detection has covered the whole scale range
+  std::vector<size_t> &scaleOrder = workspace.m_scaleOrder;
+  std::vector<bool> &isAnchorScale = workspace.m_isAnchorScale;
+  scaleOrder.clear();
+  isAnchorScale.assign(scaleVector.size(), true);
+  for(size_t i = 0; i < scaleVector.size(); i++) {
+    isAnchorScale[i] = (i % m_scalePruningStride == 0) || (i == scaleVector.size()-1);
+    if(isAnchorScale[i]) {
+      scaleOrder.push_back(i);
+    }
+  }
 
-    std::map<int, Template_info_t>::const_iterator it_template = it->second.find(regular_scale);
-    if(it_template != it->second.end()) {
-      int chamferMapWidth = query_info.m_distImg.cols - it_template->second.m_distImg.cols + 1;
-      int chamferMapHeight = query_info.m_distImg.rows - it_template->second.m_distImg.rows + 1;
+  for(size_t i = 0; i < scaleVector.size(); i++) {
+    if(!isAnchorScale[i]) {
+      scaleOrder.push_back(i);
+    }
+  }
 
-      if(chamferMapWidth > 0 && chamferMapHeight > 0) {
-        cv::Mat rejection_mask = cv::Mat::ones(chamferMapHeight, chamferMapWidth, CV_8U);
+  if(m_usePointSetScaling) {
+    //All the scales are scored in a single sweep per template
+    scaleOrder.clear();
+  }
 
+  TopKBound topKBound(m_topK, distanceThresh);
+  TopKBound *ptr_topKBound = m_topK > 0 ? &topKBound : NULL;
 
-        if(m_pyramidType != noPyramid && m_matchingStrategyType != templatePoseMatching) {
-          //Half size
-          std::map<int, Template_info_t>::const_iterator it_template_half = it->second.find(half_scale);
+  std::vector<Detection_t> &all_detections = workspace.m_templateDetections;
+  std::vector<Detection_t> &current_detections = workspace.m_currentDetections;
 
-          if(it_template_half != it->second.end()) {
-            int half_chamferMapWidth = half_query_info.m_distImg.cols - it_template_half->second.m_distImg.cols + 1;
-            int half_chamferMapHeight = half_query_info.m_distImg.rows - it_template_half->second.m_distImg.rows + 1;
+  getTemplateOrder(*library, workspace.m_mapOfCoarseCosts, workspace.m_mapOfTemplateHits, workspace.m_templateOrder);
+  bool complete = true;
+  for(std::vector<int>::const_iterator it_id = workspace.m_templateOrder.begin();
+      it_id != workspace.m_templateOrder.end() && complete; ++it_id) {
+    std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it1 = mapOfTemplate_info.find(*it_id);
+    all_detections.clear();
 
-            if(half_chamferMapWidth > 0 && half_chamferMapHeight > 0) {
-              cv::Mat half_rejection_mask = cv::Mat::ones(half_chamferMapHeight, half_chamferMapWidth, CV_8U);
+    if(m_usePointSetScaling) {
+      if(deadline.isExpired()) {
+        complete = false;
+        break;
+      }
 
-              //Compute the bounding indexes where we want to perform the matching
-              int startI = it_template_half->second.m_queryROI.y;
-              int endI = it_template_half->second.m_queryROI.height > 0 ?
-                  startI + it_template_half->second.m_queryROI.height/2 : half_chamferMapHeight;
-              int startJ = it_template_half->second.m_queryROI.x;
-              int endJ = it_template_half->second.m_queryROI.width > 0 ?
-                  startJ + it_template_half->second.m_queryROI.width/2 : half_chamferMapWidth;
+      std::map<int, Template_info_t>::const_iterator it_tpl_regular = it1->second->find(100);
+      if(it_tpl_regular == it1->second->end()) {
+        std::cerr << "Cannot find template at regular scale!" << std::endl;
+        continue;
+      }
 
-              if(m_pyramidType == pyramid1) {
-                computeRejectionMask(it_template_half->second, half_query_info, half_rejection_mask,
-                    startI, endI, 5, startJ, endJ, 5);
-              } else {
-                std::vector<Detection_t> half_detections;
-                detect_impl(it_template_half->second, half_query_info, half_scale, half_detections, half_rejection_mask,
-                    useOrientation, distanceThresh, lambda, weight_forward, weight_backward, useGroupDetections);
-              }
+      TraceSpan span(m_traceRecorder, "pointSetScales", "job");
+      span.addArg("templateId", it1->first);
+      std::vector<ScaledPointSet_t> &pointSets = workspace.m_scaledPointSets;
+      getScaledPointSets(it_tpl_regular->second, scaleVector, pointSets);
+      span.addArg("nbScales", (int) pointSets.size());
 
-              //Use dilate to increase regions of interest
-              int dilation_size = 5;
-              cv::Mat element = cv::getStructuringElement( cv::MORPH_RECT,
-                  cv::Size( 2*dilation_size + 1, 2*dilation_size+1 ),
-                  cv::Point( dilation_size, dilation_size ) );
+      std::vector<cv::Mat> &chamferMaps = workspace.m_groupChamferMaps;
+      if(chamferMaps.size() < pointSets.size()) {
+        chamferMaps.resize(pointSets.size());
+      }
+      for(size_t cpt_scale = 0; cpt_scale < pointSets.size(); cpt_scale++) {
+        chamferMaps[cpt_scale].allocator = workspace.getAllocator();
+      }
 
-              cv::dilate(half_rejection_mask, half_rejection_mask, element);
+      int64 t_scales = m_costReport != NULL ? cv::getTickCount() : 0;
+      StageTimer scoringTimer(getStageTimings(workspace), m_traceRecorder, StageTimings_t::scoringStage);
+      complete = computeScaledMatchingMaps(it_tpl_regular->second, it1->first, pointSets, query_info, chamferMaps,
+          useOrientation, 5, 5, lambda, weight_forward, useScalePruning, distanceThresh, ptr_topKBound, &deadline);
+      scoringTimer.stop();
+      for(size_t cpt_scale = 0; m_useStageTimings && cpt_scale < pointSets.size(); cpt_scale++) {
+        workspace.m_stageTimings.m_nbWindows +=
+            countQueryWindows(it_tpl_regular->second, chamferMaps[cpt_scale].size());
+      }
 
-              //Resize the mask to the current size
-              cv::resize(half_rejection_mask, rejection_mask, cv::Size(chamferMapWidth, chamferMapHeight),
-                  0.0, 0.0, cv::INTER_NEAREST);
-            }
-          }
+      //Shared equally by the scales
+      double scaleTime = 0.0;
+      if(m_costReport != NULL) {
+        size_t nbMaps = 0;
+        for(size_t cpt_scale = 0; cpt_scale < pointSets.size(); cpt_scale++) {
+          nbMaps += chamferMaps[cpt_scale].empty() ? 0 : 1;
         }
+        scaleTime = elapsedMs(t_scales) / std::max((size_t) 1, nbMaps);
+      }
 
-#if DEBUG
-        rejection_mask *= 255;
-        std::stringstream ss;
-        ss << "rejection_mask_" << it->first;
-        cv::imshow(ss.str(), rejection_mask);
-        cv::waitKey(30);
-#endif
+      for(size_t cpt_scale = 0; cpt_scale < pointSets.size(); cpt_scale++) {
+        if(chamferMaps[cpt_scale].empty()) {
+          continue;
+        }
 
-        //Regular scale
-        detect_impl(it_template->second, query_info, regular_scale, all_detections, rejection_mask, useOrientation,
-            distanceThresh, lambda, weight_forward, weight_backward, useGroupDetections);
+        //Only written with pyramid2
+        int64 t_extraction = m_costReport != NULL ? cv::getTickCount() : 0;
+        double nbScoredWindows = m_costReport != NULL ? countScoredWindows(chamferMaps[cpt_scale]) : 0.0;
+        cv::Mat rejection_mask = workspace.getRejectionMask(chamferMaps[cpt_scale].rows, chamferMaps[cpt_scale].cols);
+        extractDetections(pointSets[cpt_scale].m_size, chamferMaps[cpt_scale], pointSets[cpt_scale].m_scale,
+            workspace, current_detections, rejection_mask, distanceThresh, useGroupDetections, it1->first);
+        if(m_costReport != NULL) {
+          addTemplateCost(it_tpl_regular->second, it1->first, pointSets[cpt_scale].m_scale,
+              chamferMaps[cpt_scale].size(), nbScoredWindows, pointSets[cpt_scale].m_points.size(),
+              scaleTime + elapsedMs(t_extraction), current_detections.size());
+        }
 
         //Set Template index
-        for(std::vector<Detection_t>::iterator it_detection = all_detections.begin();
-            it_detection != all_detections.end(); ++it_detection) {
-          it_detection->m_templateIndex = it->first;
+        for(std::vector<Detection_t>::iterator it_detection = current_detections.begin();
+            it_detection != current_detections.end(); ++it_detection) {
+          it_detection->m_templateIndex = it1->first;
         }
 
-        detections.insert(detections.end(), all_detections.begin(), all_detections.end());
+        all_detections.insert(all_detections.end(), current_detections.begin(), current_detections.end());
       }
-    } else {
-      std::cerr << "Cannot find template at regular scale!" << std::endl;
-      return;
     }
-  }
-
-  //Sort detections by increasing cost
-  std::sort(detections.begin(), detections.end());
-}
 
-/*
- * Detect on multiple scales.
- */
-void ChamferMatcher::detectMultiScale(const cv::Mat &img_query, std::vector<Detection_t> &detections,
-    const bool useOrientation, const float distanceThresh, const float lambda, const float weight_forward,
-    const float weight_backward, const bool useNonMaximaSuppression, const bool useGroupDetections) {
-  detections.clear();
-
-  if(m_matchingStrategyType == templatePoseMatching) {
-    std::cerr << "Cannot detect on multiple scales with the matching strategy=templatePoseMatching!" << std::endl;
-    return;
-  }
-
-  cv::Mat half_query;
-  Query_info_t half_query_info;
-  if(m_pyramidType != noPyramid) {
-    //PyrDown
-    cv::pyrDown(img_query, half_query);
-    half_query_info = prepareQuery(half_query);
-  }
-
-  Query_info_t query_info = prepareQuery(img_query);
-
-  for(std::map<int, std::map<int, Template_info_t> >::iterator it1 = m_mapOfTemplate_info.begin();
-      it1 != m_mapOfTemplate_info.end(); ++it1) {
-    std::vector<Detection_t> all_detections;
-
-    for(std::vector<int>::const_iterator it2 = m_scaleVector.begin(); it2 != m_scaleVector.end(); ++it2) {
-      std::map<int, Template_info_t>::const_iterator it_tpl_scale = it1->second.find(*it2);
+    for(std::vector<size_t>::const_iterator it_order = scaleOrder.begin(); it_order != scaleOrder.end(); ++it_order) {
+      if(deadline.isExpired()) {
+        complete = false;
+        break;
+      }
 
-      if(it_tpl_scale != it1->second.end()) {
-        std::vector<Detection_t> current_detections;
+      std::vector<int>::const_iterator it2 = scaleVector.begin() + *it_order;
+      std::map<int, Template_info_t>::const_iterator it_tpl_scale = it1->second->find(*it2);
 
-        int chamferMapWidth = query_info.m_distImg.cols - it_tpl_scale->second.m_distImg.cols + 1;
-        int chamferMapHeight = query_info.m_distImg.rows - it_tpl_scale->second.m_distImg.rows + 1;
+      if(it_tpl_scale != it1->second->end()) {
+        int chamferMapWidth = query_info.m_distImg.cols - it_tpl_scale->second.m_size.width + 1;
+        int chamferMapHeight = query_info.m_distImg.rows - it_tpl_scale->second.m_size.height + 1;
 
         if(chamferMapWidth > 0 && chamferMapHeight > 0) {
-          cv::Mat rejection_mask = cv::Mat::ones(chamferMapHeight, chamferMapWidth, CV_8U);
-
-
-          int half_scale = (*it2) / 2;
-          if(m_pyramidType != noPyramid && half_scale > 0 && m_matchingStrategyType != templatePoseMatching) {
-            //Half size
-            std::map<int, Template_info_t>::const_iterator it_template_half = it1->second.find(half_scale);
-
-            if(it_template_half != it1->second.end()) {
-              int half_chamferMapWidth = half_query_info.m_distImg.cols - it_template_half->second.m_distImg.cols + 1;
-              int half_chamferMapHeight = half_query_info.m_distImg.rows - it_template_half->second.m_distImg.rows + 1;
-
-              if(half_chamferMapWidth > 0 && half_chamferMapHeight > 0) {
-                cv::Mat half_rejection_mask = cv::Mat::ones(half_chamferMapHeight, half_chamferMapWidth, CV_8U);
-
-                //Compute the bounding indexes where we want to perform the matching
-                int startI = it_template_half->second.m_queryROI.y;
-                int endI = it_template_half->second.m_queryROI.height > 0 ?
-                    startI + it_template_half->second.m_queryROI.height/2 : half_chamferMapHeight;
-                int startJ = it_template_half->second.m_queryROI.x;
-                int endJ = it_template_half->second.m_queryROI.width > 0 ?
-                    startJ + it_template_half->second.m_queryROI.width/2 : half_chamferMapWidth;
-
-                if(m_pyramidType == pyramid1) {
-                  computeRejectionMask(it_template_half->second, half_query_info, rejection_mask, startI, endI, 5, startJ, endJ, 5);
-                } else {
-                  std::vector<Detection_t> half_detections;
-                  detect_impl(it_template_half->second, half_query_info, half_scale, half_detections, half_rejection_mask,
-                      useOrientation, distanceThresh, lambda, weight_forward, weight_backward, useGroupDetections);
-                }
+          cv::Mat rejection_mask = workspace.getRejectionMask(chamferMapHeight, chamferMapWidth);
+          initRejectionMask(workspace, it_tpl_scale->second, rejection_mask);
 
-                //Use dilate to increase regions of interest
-                int dilation_size = 5;
-                cv::Mat element = cv::getStructuringElement( cv::MORPH_RECT,
-                    cv::Size( 2*dilation_size + 1, 2*dilation_size+1 ),
-                    cv::Point( dilation_size, dilation_size ) );
-
-                cv::dilate(half_rejection_mask, half_rejection_mask, element);
-
-                //Resize the mask to the current size
-                cv::resize(half_rejection_mask, rejection_mask, cv::Size(chamferMapWidth, chamferMapHeight),
-                    0.0, 0.0, cv::INTER_NEAREST);
-              }
-            }
+          if(!detect_impl(it_tpl_scale->second, query_info, it_tpl_scale->first, workspace, current_detections,
+              rejection_mask, useOrientation, distanceThresh, lambda, weight_forward, weight_backward,
+              useGroupDetections, ptr_topKBound, it1->first, &deadline)) {
+            complete = false;
           }
 
-
-          detect_impl(it_tpl_scale->second, query_info, it_tpl_scale->first, current_detections, rejection_mask, useOrientation,
-              distanceThresh, lambda, weight_forward, weight_backward, useGroupDetections);
-
           //Set Template index
           for(std::vector<Detection_t>::iterator it_detection = current_detections.begin();
               it_detection != current_detections.end(); ++it_detection) {
@@ -1151,23 +2378,30 @@ void ChamferMatcher::detectMultiScale(const cv::Mat &img_query, std::vector<Dete
 
   //Sort detections by increasing cost
   std::sort(detections.begin(), detections.end());
+
+  if(m_topK > 0) {
+    retainTopK(workspace, detections);
+  }
+
+  return complete;
 }
 
 /*
  * Display template data to check if the template data are correctly loaded / computed.
  */
 void ChamferMatcher::displayTemplateData(const int tempo) {
-  if(m_mapOfTemplate_info.size() != m_mapOfTemplateImages.size()) {
+  const std::shared_ptr<const TemplateLibrary_t> library = getTemplateLibrary();
+  if(library->m_mapOfTemplate_info.size() != library->m_mapOfTemplateImages.size()) {
     std::cerr << "Size of template info vector is different of size of template image vector!" << std::endl;
     return;
   }
 
-  for(std::map<int, std::map<int, Template_info_t> >::const_iterator it_tpl = m_mapOfTemplate_info.begin();
-      it_tpl != m_mapOfTemplate_info.end(); ++it_tpl) {
+  for(std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it_tpl = library->m_mapOfTemplate_info.begin();
+      it_tpl != library->m_mapOfTemplate_info.end(); ++it_tpl) {
 
     //Display image
-    std::map<int, cv::Mat>::const_iterator it_img = m_mapOfTemplateImages.find(it_tpl->first);
-    if(it_img == m_mapOfTemplateImages.end()) {
+    std::map<int, cv::Mat>::const_iterator it_img = library->m_mapOfTemplateImages.find(it_tpl->first);
+    if(it_img == library->m_mapOfTemplateImages.end()) {
       std::cerr << "Missing template image for id=" << it_tpl->first << std::endl;
       return;
     }
@@ -1175,23 +2409,25 @@ void ChamferMatcher::displayTemplateData(const int tempo) {
     cv::imshow("Template image", it_img->second);
 
 
-    for(std::map<int, Template_info_t>::const_iterator it_tpl_scale = it_tpl->second.begin();
-        it_tpl_scale != it_tpl->second.end(); ++it_tpl_scale) {
+    for(std::map<int, Template_info_t>::const_iterator it_tpl_scale = it_tpl->second->begin();
+        it_tpl_scale != it_tpl->second->end(); ++it_tpl_scale) {
       //Display contour points
-      cv::Mat contour_img = cv::Mat::zeros(it_tpl_scale->second.m_distImg.size(), CV_8UC3);
+      cv::Mat contour_img = cv::Mat::zeros(it_tpl_scale->second.m_size, CV_8UC3);
 
-      for(size_t i = 0; i < it_tpl_scale->second.m_contours.size(); i++) {
-        cv::drawContours(contour_img, it_tpl_scale->second.m_contours, i, cv::Scalar(0,0,255), 1);
+      std::vector<std::vector<cv::Point> > contours;
+      it_tpl_scale->second.m_contours.toVectors(contours);
+      for(size_t i = 0; i < contours.size(); i++) {
+        cv::drawContours(contour_img, contours, i, cv::Scalar(0,0,255), 1);
       }
 
 
       //Display contour orientation
       int length = 20;
       for(size_t i = 0; i < it_tpl_scale->second.m_edgesOrientation.size(); i++) {
-        for(size_t j = 0; j < it_tpl_scale->second.m_edgesOrientation[i].size(); j += 10) {
-          cv::Point start_point = it_tpl_scale->second.m_contours[i][j];
+        for(size_t j = 0; j < it_tpl_scale->second.m_edgesOrientation.rowSize(i); j += 10) {
+          cv::Point start_point = it_tpl_scale->second.m_contours.row(i)[j];
 
-          float angle1 = it_tpl_scale->second.m_edgesOrientation[i][j];
+          float angle1 = it_tpl_scale->second.m_edgesOrientation.row(i)[j];
           int x1 = cos(angle1)*length;
           int y1 = sin(angle1)*length;
           cv::Point end_point1 = start_point + cv::Point(x1, y1);
@@ -1210,27 +2446,29 @@ void ChamferMatcher::displayTemplateData(const int tempo) {
 
 
       //Display distance transform image
-      cv::Mat template_dt;
-      double minVal, maxVal;
-      cv::minMaxLoc(it_tpl_scale->second.m_distImg, &minVal, &maxVal);
-      it_tpl_scale->second.m_distImg.convertTo(template_dt, CV_8U, 255.0/(maxVal-minVal), -255.0*minVal/(maxVal-minVal));
-      cv::imshow("Template distance transform", template_dt);
+      //Released with the compact templates
+      if(!it_tpl_scale->second.m_distImg.empty()) {
+        cv::Mat template_dt;
+        double minVal, maxVal;
+        cv::minMaxLoc(it_tpl_scale->second.m_distImg, &minVal, &maxVal);
+        it_tpl_scale->second.m_distImg.convertTo(template_dt, CV_8U, 255.0/(maxVal-minVal),
+            -255.0*minVal/(maxVal-minVal));
+        cv::imshow("Template distance transform", template_dt);
+      }
 
 
       //Display lines that approximated the contours
-      cv::Mat template_lines = cv::Mat::zeros(it_tpl_scale->second.m_distImg.size(), CV_8UC3);
+      cv::Mat template_lines = cv::Mat::zeros(it_tpl_scale->second.m_size, CV_8UC3);
       for(size_t i = 0; i < it_tpl_scale->second.m_vectorOfContourLines.size(); i++) {
-        for(size_t j = 0; j < it_tpl_scale->second.m_vectorOfContourLines[i].size(); j++) {
+        for(size_t j = 0; j < it_tpl_scale->second.m_vectorOfContourLines.rowSize(i); j++) {
+          const Line_info_t &line = it_tpl_scale->second.m_vectorOfContourLines.row(i)[j];
           //Display line
-          cv::line(template_lines, it_tpl_scale->second.m_vectorOfContourLines[i][j].m_pointStart,
-              it_tpl_scale->second.m_vectorOfContourLines[i][j].m_pointEnd, cv::Scalar(0,0,255), 1);
+          cv::line(template_lines, line.m_pointStart, line.m_pointEnd, cv::Scalar(0,0,255), 1);
 
           //Display line orientation
-          cv::Point start_point = it_tpl_scale->second.m_vectorOfContourLines[i][j].m_pointStart +
-              (it_tpl_scale->second.m_vectorOfContourLines[i][j].m_pointEnd -
-              it_tpl_scale->second.m_vectorOfContourLines[i][j].m_pointStart) / 2.0;
+          cv::Point start_point = line.m_pointStart + (line.m_pointEnd - line.m_pointStart) / 2.0;
 
-          float angle1 = it_tpl_scale->second.m_vectorOfContourLines[i][j].m_theta;
+          float angle1 = line.m_theta;
           int x1 = cos(angle1)*length;
           int y1 = sin(angle1)*length;
           cv::Point end_point1 = start_point + cv::Point(x1, y1);
@@ -1378,6 +2616,247 @@ void ChamferMatcher::getContoursOrientation(const std::vector<std::vector<cv::Po
   }
 }
 
+/*
+ * Same as above with a contiguous storage of the contours and the orientations.
+ */
+void ChamferMatcher::getContoursOrientation(const CSRArray_t<cv::Point> &contours,
+    CSRArray_t<float> &contoursOrientation) {
+  contoursOrientation.clear();
+  contoursOrientation.m_data.reserve(contours.nbElements());
+  contoursOrientation.m_offsets.reserve(contours.size()+1);
+
+  for(size_t i = 0; i < contours.size(); i++) {
+    const cv::Point *ptr_contour = contours.row(i);
+    const size_t contourSize = contours.rowSize(i);
+
+    if(contourSize > 2) {
+      double rho = 0.0 , angle = 0.0;
+
+      //First point orientation == second point orientation
+      getPolarLineEquation(ptr_contour[0], ptr_contour[2], angle, rho);
+      contoursOrientation.push_back(angle);
+      contoursOrientation.push_back(angle);
+
+      for(size_t j = 2; j < contourSize-1; j++) {
+        getPolarLineEquation(ptr_contour[j-1], ptr_contour[j+1], angle, rho);
+        contoursOrientation.push_back((float) angle);
+      }
+
+      //Last point
+      contoursOrientation.push_back(contoursOrientation.m_data.back());
+    } else {
+      for(size_t j = 0; j < contourSize; j++) {
+        std::cerr << "Not enough contour points !" << std::endl;
+        contoursOrientation.push_back(0);
+      }
+    }
+
+    contoursOrientation.endRow();
+  }
+}
+
+//Template ids by decreasing number of top-K hits
+struct more_hits {
+  const std::map<int, int> &m_mapOfHits;
+
+  explicit more_hits(const std::map<int, int> &mapOfHits) : m_mapOfHits(mapOfHits) {
+  }
+
+  int getHits(const int id) const {
+    std::map<int, int>::const_iterator it = m_mapOfHits.find(id);
+    return it != m_mapOfHits.end() ? it->second : 0;
+  }
+
+  bool operator()(const int id1, const int id2) const {
+    return getHits(id1) > getHits(id2);
+  }
+};
+
+//Template ids by increasing best cost at the half resolution
+struct lower_coarse_cost {
+  const std::map<int, float> &m_mapOfCosts;
+
+  explicit lower_coarse_cost(const std::map<int, float> &mapOfCosts) : m_mapOfCosts(mapOfCosts) {
+  }
+
+  float getCost(const int id) const {
+    std::map<int, float>::const_iterator it = m_mapOfCosts.find(id);
+    return it != m_mapOfCosts.end() ? it->second : std::numeric_limits<float>::max();
+  }
+
+  bool operator()(const int id1, const int id2) const {
+    return getCost(id1) < getCost(id2);
+  }
+};
+
+/*
+ * Scale the contour points and the grid descriptors of the template at 100% around its center,
+ * as cv::resize would scale the template image.
+ */
+void ChamferMatcher::getScaledPointSets(const Template_info_t &template_info, const std::vector<int> &scaleVector,
+    std::vector<ScaledPointSet_t> &pointSets) {
+  pointSets.resize(scaleVector.size());
+
+  const cv::Size size = template_info.m_size;
+  const cv::Point2f center(size.width / 2.0f, size.height / 2.0f);
+  const std::vector<cv::Point> &points = template_info.m_contours.m_data;
+
+  for(size_t cpt_scale = 0; cpt_scale < scaleVector.size(); cpt_scale++) {
+    ScaledPointSet_t &pointSet = pointSets[cpt_scale];
+    const float factor = scaleVector[cpt_scale] / 100.0f;
+
+    pointSet.m_scale = scaleVector[cpt_scale];
+    pointSet.m_size = cv::Size(std::max(1, (int) round(size.width*factor)), std::max(1, (int) round(size.height*factor)));
+    const cv::Point2f scaled_center(pointSet.m_size.width / 2.0f, pointSet.m_size.height / 2.0f);
+
+    pointSet.m_points.resize(points.size());
+    for(size_t cpt = 0; cpt < points.size(); cpt++) {
+      int x = (int) round((points[cpt].x - center.x)*factor + scaled_center.x);
+      int y = (int) round((points[cpt].y - center.y)*factor + scaled_center.y);
+      pointSet.m_points[cpt] = cv::Point(std::min(std::max(x, 0), pointSet.m_size.width-1),
+          std::min(std::max(y, 0), pointSet.m_size.height-1));
+    }
+
+    pointSet.m_gridLocations.resize(template_info.m_gridDescriptorsLocations.size());
+    pointSet.m_gridDistances.resize(template_info.m_gridDescriptors.size());
+    for(size_t cpt = 0; cpt < template_info.m_gridDescriptorsLocations.size(); cpt++) {
+      const cv::Point &location = template_info.m_gridDescriptorsLocations[cpt];
+      int x = (int) round((location.x - center.x)*factor + scaled_center.x);
+      int y = (int) round((location.y - center.y)*factor + scaled_center.y);
+      pointSet.m_gridLocations[cpt] = cv::Point(std::min(std::max(x, 0), pointSet.m_size.width-1),
+          std::min(std::max(y, 0), pointSet.m_size.height-1));
+      //The distance transform scales with the template
+      pointSet.m_gridDistances[cpt] = template_info.m_gridDescriptors[cpt].first * factor;
+    }
+  }
+}
+
+/*
+ * Template ids in the processing order. In the top-K mode, the templates often in the top-K are
+ * processed first so that a tight bound is available early. The best costs at the half resolution,
+ * when computed, take precedence so that an interrupted detection has processed the most promising templates.
+ */
+void ChamferMatcher::getTemplateOrder(const TemplateLibrary_t &library, const std::map<int, float> &mapOfCoarseCosts,
+    const std::map<int, int> &mapOfTemplateHits, std::vector<int> &templateOrder) const {
+  templateOrder.clear();
+  for(std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it = library.m_mapOfTemplate_info.begin();
+      it != library.m_mapOfTemplate_info.end(); ++it) {
+    templateOrder.push_back(it->first);
+  }
+
+  if(m_topK > 0 && !mapOfTemplateHits.empty()) {
+    //Decreasing number of hits, increasing id
+    std::stable_sort(templateOrder.begin(), templateOrder.end(), more_hits(mapOfTemplateHits));
+  }
+
+  if(!mapOfCoarseCosts.empty()) {
+    std::stable_sort(templateOrder.begin(), templateOrder.end(), lower_coarse_cost(mapOfCoarseCosts));
+  }
+}
+
+/*
+ * Group the templates of the same size, grid descriptor size and query ROI at the given scale.
+ * The groups keep the processing order of their first template.
+ */
+void ChamferMatcher::getTemplateGroups(const TemplateLibrary_t &library, const std::vector<int> &templateOrder,
+    const int scale, std::vector<std::vector<int> > &templateGroups) const {
+  templateGroups.clear();
+
+  //Key: (width, height, grid width, grid height, ROI) - Value: group index
+  std::map<std::vector<int>, size_t> mapOfGroups;
+  for(std::vector<int>::const_iterator it_id = templateOrder.begin(); it_id != templateOrder.end(); ++it_id) {
+    std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it = library.m_mapOfTemplate_info.find(*it_id);
+    std::map<int, Template_info_t>::const_iterator it_template = it->second->find(scale);
+
+    if(!m_useTemplateGroups || m_matchingStrategyType != templateMatching || it_template == it->second->end()) {
+      templateGroups.push_back(std::vector<int>(1, *it_id));
+      continue;
+    }
+
+    const Template_info_t &template_info = it_template->second;
+    int key_values[] = {template_info.m_size.width, template_info.m_size.height,
+        template_info.m_gridDescriptorsSize.width, template_info.m_gridDescriptorsSize.height,
+        template_info.m_queryROI.x, template_info.m_queryROI.y, template_info.m_queryROI.width,
+        template_info.m_queryROI.height};
+    std::vector<int> key(key_values, key_values + sizeof(key_values) / sizeof(key_values[0]));
+
+    std::map<std::vector<int>, size_t>::const_iterator it_group = mapOfGroups.find(key);
+    if(it_group == mapOfGroups.end()) {
+      mapOfGroups[key] = templateGroups.size();
+      templateGroups.push_back(std::vector<int>(1, *it_id));
+    } else {
+      templateGroups[it_group->second].push_back(*it_id);
+    }
+  }
+}
+
+/*
+ * The windows are the locations of the grid in the query ROI clamped to the Chamfer map, as in computeMatchingMap().
+ */
+double ChamferMatcher::countQueryWindows(const Template_info_t &template_info, const cv::Size &mapSize,
+    const int xStep, const int yStep) const {
+  if(m_matchingStrategyType == templatePoseMatching) {
+    return 1.0;
+  }
+
+  int startI = std::min(template_info.m_queryROI.y, mapSize.height);
+  int endI = template_info.m_queryROI.height > 0 ?
+      std::min(startI + template_info.m_queryROI.height, mapSize.height) : mapSize.height;
+  int startJ = std::min(template_info.m_queryROI.x, mapSize.width);
+  int endJ = template_info.m_queryROI.width > 0 ?
+      std::min(startJ + template_info.m_queryROI.width, mapSize.width) : mapSize.width;
+
+  return (double) ((endI - startI + yStep - 1) / yStep) * ((endJ - startJ + xStep - 1) / xStep);
+}
+
+void ChamferMatcher::addTemplateCost(const Template_info_t &template_info, const int templateId, const int scale,
+    const cv::Size &mapSize, const double nbScoredWindows, const size_t nbPoints, const double time,
+    const size_t nbDetections) const {
+  double nbWindows = countQueryWindows(template_info, mapSize);
+  m_costReport->add(templateId, scale, nbWindows, nbScoredWindows, nbScoredWindows * nbPoints, time, nbDetections);
+}
+
+size_t ChamferMatcher::getNbPoints(const Template_info_t &template_info) const {
+  if(m_matchingType == lineMatching || m_matchingType == lineForwardBackwardMatching ||
+      m_matchingType == lineIntegralMatching) {
+    return template_info.m_vectorOfContourLines.m_data.size();
+  }
+
+  return template_info.m_contours.m_data.size();
+}
+
+void ChamferMatcher::initRejectionMask(const DetectionWorkspace &workspace, const Template_info_t &template_info,
+    cv::Mat &rejection_mask) const {
+  std::map<const Template_info_t*, std::pair<bool, cv::Mat> >::const_iterator it_half_mask =
+      workspace.m_mapOfHalfRejectionMasks.find(&template_info);
+  if(it_half_mask != workspace.m_mapOfHalfRejectionMasks.end() && it_half_mask->second.first) {
+    //Resize the mask to the current size
+    cv::resize(it_half_mask->second.second, rejection_mask, rejection_mask.size(), 0.0, 0.0, cv::INTER_NEAREST);
+  } else {
+    rejection_mask.setTo(1);
+  }
+}
+
+/*
+ * Keep the best detection of each template and the K best overall. The detections must be sorted.
+ * The hit history is kept by the workspace: concurrent detections with their own workspace do not share it.
+ */
+void ChamferMatcher::retainTopK(DetectionWorkspace &workspace, std::vector<Detection_t> &detections) const {
+  std::vector<Detection_t> bestDetections;
+  std::map<int, bool> mapOfRetainedTemplates;
+
+  for(std::vector<Detection_t>::const_iterator it = detections.begin();
+      it != detections.end() && bestDetections.size() < m_topK; ++it) {
+    if(mapOfRetainedTemplates.find(it->m_templateIndex) == mapOfRetainedTemplates.end()) {
+      mapOfRetainedTemplates[it->m_templateIndex] = true;
+      bestDetections.push_back(*it);
+      workspace.m_mapOfTemplateHits[it->m_templateIndex]++;
+    }
+  }
+
+  detections = bestDetections;
+}
+
 /*
  * Group similar detections (detections whose the overlapping percentage is above a specific threshold).
  */
@@ -1450,19 +2929,21 @@ void ChamferMatcher::groupDetections(const std::vector<Detection_t> &detections,
  * Call prepareTemplate for each read template.
  */
 void ChamferMatcher::loadTemplateData(const std::string &filename) {
+  std::map<int, cv::Mat> mapOfTemplateImages;
+  std::map<int, std::pair<cv::Rect, cv::Rect> > mapOfTemplateRois;
+  if(readTemplateData(filename, mapOfTemplateImages, mapOfTemplateRois)) {
+    bool deepCopy = false;
+    setTemplateImages(mapOfTemplateImages, mapOfTemplateRois, deepCopy);
+  }
+}
+
+bool ChamferMatcher::readTemplateData(const std::string &filename, std::map<int, cv::Mat> &mapOfTemplateImages,
+    std::map<int, std::pair<cv::Rect, cv::Rect> > &mapOfTemplateRois) {
+  mapOfTemplateImages.clear();
+  mapOfTemplateRois.clear();
   std::ifstream file(filename.c_str(), std::ifstream::binary);
 
   if(file.is_open()) {
-    //Clean the maps
-    m_mapOfTemplate_info.clear();
-    m_mapOfTemplateImages.clear();
-
-#define COMPUTE_AFTER_READ 1
-
-#if COMPUTE_AFTER_READ
-    std::map<int, cv::Mat> mapOfTemplateImages;
-    std::map<int, std::pair<cv::Rect, cv::Rect> > mapOfTemplateRois;
-#endif
 
     //Read the type of the save
     int saveType = 0;
@@ -1532,11 +3013,7 @@ void ChamferMatcher::loadTemplateData(const std::string &filename) {
       }
 
       //Add image
-#if COMPUTE_AFTER_READ
       mapOfTemplateImages[id] = img;
-#else
-      m_mapOfTemplateImages[id] = img;
-#endif
 
 
       //Read the template location and size
@@ -1572,31 +3049,14 @@ void ChamferMatcher::loadTemplateData(const std::string &filename) {
       //Create query ROI
       cv::Rect queryROI(x_roi, y_roi, width_roi, height_roi);
 
-#if COMPUTE_AFTER_READ
       mapOfTemplateRois[id] = std::pair<cv::Rect, cv::Rect>(templateLocation, queryROI);
-#else
-      //Create Template
-      Template_info_t template_info = prepareTemplate(img);
-      template_info.m_queryROI = queryROI;
-      template_info.m_templateLocation = templateLocation;
-
-      int regular_scale = 100;
-      m_mapOfTemplate_info[id][regular_scale] = template_info;
-#endif
     }
 
     file.close();
-
-#if COMPUTE_AFTER_READ
-    bool deepCopy = false;
-    setTemplateImages(mapOfTemplateImages, mapOfTemplateRois, deepCopy);
-#else
-    //Compute template information for all the scales between [m_scaleMin ; m_scaleMax]
-    setScale(m_scaleMin, m_scaleMax, m_scaleStep);
-#endif
+    return true;
   } else {
     std::cerr << "File: " << filename << " cannot be opened !" << std::endl;
-    return;
+    return false;
   }
 }
 
@@ -1632,9 +3092,23 @@ void ChamferMatcher::nonMaximaSuppression(const std::vector<Detection_t> &detect
 /*
  * Compute all the necessary information for the query part.
  */
-Query_info_t ChamferMatcher::prepareQuery(const cv::Mat &img_query) {
+Query_info_t ChamferMatcher::prepareQuery(const cv::Mat &img_query) const {
+  Query_info_t query_info;
   cv::Mat edge_query;
+  prepareQuery(img_query, query_info, edge_query);
+
+  return query_info;
+}
+
+/*
+ * Compute all the necessary information for the query part, the buffers of query_info
+ * are reused when the query size does not change.
+ */
+void ChamferMatcher::prepareQuery(const cv::Mat &img_query, Query_info_t &query_info, cv::Mat &edge_query,
+    StageTimings_t *timings) const {
+  StageTimer cannyTimer(timings, m_traceRecorder, StageTimings_t::cannyStage);
   computeCanny(img_query, edge_query, m_cannyThreshold);
+  cannyTimer.stop();
 
 #if DEBUG_LIGHT
   cv::imshow("edge_query", edge_query);
@@ -1642,38 +3116,108 @@ Query_info_t ChamferMatcher::prepareQuery(const cv::Mat &img_query) {
   //XXX:
   //  cv::imwrite("Edge_query.png", edge_query);
 
-  cv::Mat dist_query, img_dist_query, labels_query;
-  computeDistanceTransform(edge_query, dist_query, labels_query);
+  StageTimer distanceTransformTimer(timings, m_traceRecorder, StageTimings_t::distanceTransformStage);
+  computeDistanceTransform(edge_query, query_info.m_distImg, query_info.m_mapOfLabels);
+  distanceTransformTimer.stop();
 
 #if DEBUG_LIGHT
-  dist_query.convertTo(img_dist_query, CV_8U);
+  cv::Mat img_dist_query;
+  query_info.m_distImg.convertTo(img_dist_query, CV_8U);
   cv::imshow("img_dist_query", img_dist_query);
 #endif
 
-  cv::Mat edge_orientations_query;
-  std::vector<std::vector<cv::Point> > contours;
-  std::vector<std::vector<float> > edges_orientation;
-  createMapOfEdgeOrientations(img_query, labels_query, edge_orientations_query, contours, edges_orientation);
+  StageTimer edgeOrientationTimer(timings, m_traceRecorder, StageTimings_t::edgeOrientationStage);
+  query_info.m_contours.clear();
+  query_info.m_edgesOrientation.clear();
+  createMapOfEdgeOrientations(img_query, query_info.m_mapOfLabels, query_info.m_mapOfEdgeOrientation,
+      query_info.m_contours, query_info.m_edgesOrientation);
+  edgeOrientationTimer.stop();
 
   //Query mask
-  cv::Mat mask;
-  createTemplateMask(img_query, mask);
+  StageTimer queryMaskTimer(timings, m_traceRecorder, StageTimings_t::queryMaskStage);
+  createTemplateMask(img_query, query_info.m_mask);
+  queryMaskTimer.stop();
 
   //Contours Lines
-  std::vector<std::vector<Line_info_t> > contours_lines;
-  approximateContours(contours, contours_lines);
+  StageTimer contourLinesTimer(timings, m_traceRecorder, StageTimings_t::contourLinesStage);
+  query_info.m_vectorOfContourLines.clear();
+  approximateContours(query_info.m_contours, query_info.m_vectorOfContourLines);
+  contourLinesTimer.stop();
+
+  //Compute IDT, one plane per cluster of m_orientationLUT
+  StageTimer integralDistanceTransformTimer(timings, m_traceRecorder, StageTimings_t::integralDistanceTransformStage);
+  ChamferMatcher::computeIntegralDistanceTransform(query_info.m_distImg, query_info.m_integralDistImg,
+      nbOrientationClusters, true);
+  ChamferMatcher::computeIntegralDistanceTransform(query_info.m_mapOfEdgeOrientation,
+      query_info.m_integralEdgeOrientation, nbOrientationClusters, true);
+  integralDistanceTransformTimer.stop();
+
+  query_info.m_img = img_query;
+}
+
+std::shared_ptr<const PreparedQuery_t> ChamferMatcher::createPreparedQuery(const cv::Mat &img_query,
+    const bool halfResolution) const {
+  std::shared_ptr<PreparedQuery_t> prepared_query(new PreparedQuery_t);
+  prepared_query->m_cannyThreshold = m_cannyThreshold;
+
+  if(img_query.empty()) {
+    std::cerr << "Empty query image!" << std::endl;
+    return prepared_query;
+  }
+
+  cv::Mat edge_query;
+  prepareQuery(img_query, prepared_query->m_queryInfo, edge_query);
+
+  if(halfResolution) {
+    QueryImageLoader query_loader(img_query);
+    prepareQuery(query_loader.getImage(2), prepared_query->m_halfQueryInfo, edge_query);
+    prepared_query->m_hasHalfResolution = true;
+  }
+
+  return prepared_query;
+}
+
+/*
+ * Query information at the given reduction (1 or 2): taken from the prepared query if given, otherwise
+ * decoded with the loader and prepared in the workspace. Return NULL (and print the reason) if not available.
+ */
+const Query_info_t* ChamferMatcher::getQueryInfo(QueryImageLoader *query_loader, const PreparedQuery_t *prepared_query,
+    DetectionWorkspace &workspace, const int reduction) const {
+  if(prepared_query != NULL) {
+    if(prepared_query->m_cannyThreshold != m_cannyThreshold) {
+      std::cerr << "The query was prepared with another Canny threshold!" << std::endl;
+      return NULL;
+    }
+
+    if(reduction == 2 && !prepared_query->m_hasHalfResolution) {
+      std::cerr << "The query was prepared without the half resolution!" << std::endl;
+      return NULL;
+    }
+
+    const Query_info_t &query_info = reduction == 2 ? prepared_query->m_halfQueryInfo : prepared_query->m_queryInfo;
+    if(query_info.m_distImg.empty()) {
+      std::cerr << "Empty prepared query!" << std::endl;
+      return NULL;
+    }
 
-  int nbClusters = 12;
-  //Compute IDT
-  cv::Mat query_idt, query_idt_edge_ori;
-  ChamferMatcher::computeIntegralDistanceTransform(dist_query, query_idt, nbClusters, true);
-  ChamferMatcher::computeIntegralDistanceTransform(edge_orientations_query, query_idt_edge_ori, nbClusters, true);
+    return &query_info;
+  }
+
+  StageTimer decodeTimer(getStageTimings(workspace), m_traceRecorder, StageTimings_t::decodeStage);
+  const cv::Mat &img_query = query_loader->getImage(reduction);
+  decodeTimer.stop();
+  if(img_query.empty()) {
+    std::cerr << "Cannot decode the query image!" << std::endl;
+    return NULL;
+  }
 
-  //Create orientation LUT
-  m_orientationLUT = ChamferMatcher::createOrientationLUT(nbClusters);
+  Query_info_t &query_info = reduction == 2 ? workspace.m_halfQueryInfo : workspace.m_queryInfo;
+  prepareQuery(img_query, query_info, workspace.m_edges, getStageTimings(workspace));
+  if(m_useStageTimings) {
+    workspace.m_stageTimings.m_nbPixels += (double) img_query.total();
+  }
 
-  return Query_info_t(contours, dist_query, img_query, query_idt, query_idt_edge_ori, edge_orientations_query,
-      edges_orientation, labels_query, mask, contours_lines);
+  return &query_info;
 }
 
 /*
@@ -1698,14 +3242,20 @@ Template_info_t ChamferMatcher::prepareTemplate(const cv::Mat &img_template) {
 #endif
 
   cv::Mat edge_orientations_template;
-  std::vector<std::vector<cv::Point> > contours_template;
-  std::vector<std::vector<float> > edges_orientation;
-  createMapOfEdgeOrientations(img_template, labels_template, edge_orientations_template, contours_template, edges_orientation);
+  CSRArray_t<cv::Point> csr_contours_template;
+  CSRArray_t<float> csr_edges_orientation;
+  createMapOfEdgeOrientations(img_template, labels_template, edge_orientations_template, csr_contours_template,
+      csr_edges_orientation);
 
 
 #if DEBUG
   //DEBUG:
   if(m_debug) {
+    std::vector<std::vector<cv::Point> > contours_template;
+    std::vector<std::vector<float> > edges_orientation;
+    csr_contours_template.toVectors(contours_template);
+    csr_edges_orientation.toVectors(edges_orientation);
+
     cv::Mat displayFindContours = cv::Mat::zeros(img_template.size(), CV_32F);
     for(int i = 0; i < contours_template.size(); i++) {
       for(int j = 0; j < contours_template[i].size(); j++) {
@@ -1753,15 +3303,54 @@ Template_info_t ChamferMatcher::prepareTemplate(const cv::Mat &img_template) {
   createTemplateMask(img_template, mask);
 
   //Contours Lines
-  std::vector<std::vector<Line_info_t> > contours_lines;
-  approximateContours(contours_template, contours_lines);
+  CSRArray_t<Line_info_t> contours_lines;
+  approximateContours(csr_contours_template, contours_lines);
+
+  Template_info_t template_info(std::move(csr_contours_template), dist_template, std::move(csr_edges_orientation),
+      m_gridDescriptorSize, edge_orientations_template, mask, std::move(contours_lines));
 
-  Template_info_t template_info(contours_template, dist_template, edges_orientation, m_gridDescriptorSize,
-      edge_orientations_template, mask, contours_lines);
+  if(m_useCompactTemplates) {
+    //The grid descriptors are already sampled from the images
+    compactTemplate(template_info);
+  }
 
   return template_info;
 }
 
+void ChamferMatcher::compactTemplate(Template_info_t &template_info) const {
+  bool useDistImg = false, useEdgeOrientationImg = false, useMask = false;
+  getTemplateImagesUsed(m_matchingType, useDistImg, useEdgeOrientationImg, useMask);
+
+  //The contours, orientations and lines are kept: they are small and read by all the matching types
+  if(!useDistImg) {
+    template_info.m_distImg.release();
+  }
+  if(!useEdgeOrientationImg) {
+    template_info.m_mapOfEdgeOrientation.release();
+  }
+  if(!useMask) {
+    template_info.m_mask.release();
+  }
+}
+
+bool ChamferMatcher::hasTemplateMaps(const TemplateLibrary_t &library) const {
+  bool useDistImg = false, useEdgeOrientationImg = false, useMask = false;
+  getTemplateImagesUsed(m_matchingType, useDistImg, useEdgeOrientationImg, useMask);
+
+  //All the templates are prepared with the same profile, check the first one
+  for(std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it_tpl = library.m_mapOfTemplate_info.begin();
+      it_tpl != library.m_mapOfTemplate_info.end(); ++it_tpl) {
+    if(!it_tpl->second->empty()) {
+      const Template_info_t &template_info = it_tpl->second->begin()->second;
+      return (!useDistImg || !template_info.m_distImg.empty()) &&
+          (!useEdgeOrientationImg || !template_info.m_mapOfEdgeOrientation.empty()) &&
+          (!useMask || !template_info.m_mask.empty());
+    }
+  }
+
+  return true;
+}
+
 /*
  * Keep detections whose the Chamfer distance is below a threshold.
  */
@@ -1788,6 +3377,7 @@ void ChamferMatcher::retainDetections(std::vector<Detection_t> &bbDetections, co
  * can be computed from this two data.
  */
 void ChamferMatcher::saveTemplateData(const std::string &filename, const bool saveSingleFile) {
+  const std::shared_ptr<const TemplateLibrary_t> library = getTemplateLibrary();
   std::ofstream file(filename.c_str(), std::ofstream::binary);
 
   if(file.is_open()) {
@@ -1796,12 +3386,12 @@ void ChamferMatcher::saveTemplateData(const std::string &filename, const bool sa
     file.write((char *)(&saveType), sizeof(saveType));
 
     //Write the number of templates
-    int nbTemplates = (int) m_mapOfTemplate_info.size();
+    int nbTemplates = (int) library->m_mapOfTemplate_info.size();
     file.write((char *)(&nbTemplates), sizeof(nbTemplates));
 
     int cpt_img = 0;
-    for(std::map<int, std::map<int, Template_info_t> >::const_iterator it = m_mapOfTemplate_info.begin();
-        it != m_mapOfTemplate_info.end(); ++it, cpt_img++) {
+    for(std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it = library->m_mapOfTemplate_info.begin();
+        it != library->m_mapOfTemplate_info.end(); ++it, cpt_img++) {
       //Write the id of the template
       int id = it->first;
       file.write((char *)(&id), sizeof(id));
@@ -1809,12 +3399,12 @@ void ChamferMatcher::saveTemplateData(const std::string &filename, const bool sa
 
       //Get template object at scale==100
       int regular_scale = 100;
-      std::map<int, Template_info_t>::const_iterator it_template = it->second.find(regular_scale);
+      std::map<int, Template_info_t>::const_iterator it_template = it->second->find(regular_scale);
 
       //Get template image
-      std::map<int, cv::Mat>::const_iterator it_image = m_mapOfTemplateImages.find(it->first);
+      std::map<int, cv::Mat>::const_iterator it_image = library->m_mapOfTemplateImages.find(it->first);
 
-      if(it_template != it->second.end() && it_image != m_mapOfTemplateImages.end()) {
+      if(it_template != it->second->end() && it_image != library->m_mapOfTemplateImages.end()) {
 
         if(saveSingleFile) {
           //Save template image
@@ -1901,107 +3491,164 @@ void ChamferMatcher::setScale(const int min, const int max, const int step) {
     m_scaleMax = max;
     m_scaleStep = step;
 
-    m_scaleVector.clear();
-    int regular_scale = 100;
-    m_scaleVector.push_back(regular_scale);
+    //Build the new library aside, the detections in progress keep the current one
+    std::shared_ptr<TemplateLibrary_t> library(new TemplateLibrary_t(*getTemplateLibrary()));
+    computeScales(*library);
+    setTemplateLibrary(library);
+  } else {
+    std::cerr << "Invalid scale parameter !" << std::endl;
+  }
+}
+
+std::shared_ptr<const TemplateLibrary_t> ChamferMatcher::createTemplateLibraryReplica(const int node) const {
+  std::shared_ptr<const TemplateLibrary_t> library = getTemplateLibrary();
+  const NumaTopology &topology = NumaTopology::getInstance();
+  if(!topology.isNuma()) {
+    return library;
+  }
 
-    for(int scale = m_scaleMin; scale <= m_scaleMax; scale += m_scaleStep) {
-      if(scale != regular_scale) {
-        m_scaleVector.push_back(scale);
+  std::shared_ptr<TemplateLibrary_t> replica;
+  topology.runOnNode(node, [&]() {
+    //The vectors are copied by this thread, the cv::Mat are cloned (only the header is copied otherwise)
+    replica = std::make_shared<TemplateLibrary_t>(*library);
+    for(std::map<int, std::shared_ptr<const TemplateScales_t> >::iterator it1 = replica->m_mapOfTemplate_info.begin();
+        it1 != replica->m_mapOfTemplate_info.end(); ++it1) {
+      std::shared_ptr<TemplateScales_t> templates(new TemplateScales_t(*it1->second));
+      it1->second = templates;
+      for(std::map<int, Template_info_t>::iterator it2 = templates->begin(); it2 != templates->end(); ++it2) {
+        it2->second.m_distImg = it2->second.m_distImg.clone();
+        it2->second.m_mapOfEdgeOrientation = it2->second.m_mapOfEdgeOrientation.clone();
+        it2->second.m_mask = it2->second.m_mask.clone();
       }
     }
+    //The template images are not read by the detections, they stay shared
+  });
 
-    //Sort scales
-    std::sort(m_scaleVector.begin(), m_scaleVector.end());
+  return replica;
+}
+
+/*
+ * Compute the scale vector and the template information for all the scales between [m_scaleMin ; m_scaleMax],
+ * the templates at scale=100 must already be prepared.
+ */
+void ChamferMatcher::computeScales(TemplateLibrary_t &library) {
+  std::map<int, std::shared_ptr<const TemplateScales_t> > &mapOfTemplate_info = library.m_mapOfTemplate_info;
+  const std::map<int, cv::Mat> &mapOfTemplateImages = library.m_mapOfTemplateImages;
+  std::vector<int> &scaleVector = library.m_scaleVector;
+
+  scaleVector.clear();
+  int regular_scale = 100;
+  scaleVector.push_back(regular_scale);
+
+  for(int scale = m_scaleMin; scale <= m_scaleMax; scale += m_scaleStep) {
+    if(scale != regular_scale) {
+      scaleVector.push_back(scale);
+    }
+  }
 
+  //Sort scales
+  std::sort(scaleVector.begin(), scaleVector.end());
 
-    for(std::map<int, std::map<int, Template_info_t> >::iterator it_tpl = m_mapOfTemplate_info.begin();
-        it_tpl != m_mapOfTemplate_info.end(); ++it_tpl) {
+  //Vector of valid scales (multi-scales + pyramid half scale if sets)
+  std::vector<int> vectorOfScales;
+  vectorOfScales.push_back(regular_scale);
+  for(int scale = m_scaleMin; scale <= m_scaleMax; scale += m_scaleStep) {
+    if(m_usePointSetScaling && scale != regular_scale) {
+      continue;
+    }
+    vectorOfScales.push_back(scale);
 
-      //Get the template image
-      std::map<int, cv::Mat>::const_iterator it_image = m_mapOfTemplateImages.find(it_tpl->first);
+    if(m_pyramidType != noPyramid) {
+      if(scale / 2 > 0) {
+        //Add half scale
+        vectorOfScales.push_back(scale / 2);
+      }
+    }
+  }
 
-      //Get the template at regular scale
-      std::map<int, Template_info_t>::const_iterator it_tpl_reg_scale = it_tpl->second.find(regular_scale);
 
-      if(it_image != m_mapOfTemplateImages.end() && it_tpl_reg_scale != it_tpl->second.end()) {
+  for(std::map<int, std::shared_ptr<const TemplateScales_t> >::iterator it_tpl = mapOfTemplate_info.begin();
+      it_tpl != mapOfTemplate_info.end(); ++it_tpl) {
+    //Update a copy, the templates may be shared with other libraries
+    std::shared_ptr<TemplateScales_t> templates(new TemplateScales_t(*it_tpl->second));
+    it_tpl->second = templates;
 
-        //Compute template information for all the scales between [m_scaleMin ; m_scaleMax]
-        for(int scale = m_scaleMin; scale <= m_scaleMax; scale += m_scaleStep) {
+    //Get the template image
+    std::map<int, cv::Mat>::const_iterator it_image = mapOfTemplateImages.find(it_tpl->first);
 
-          std::map<int, Template_info_t>::const_iterator it_scale = m_mapOfTemplate_info[it_tpl->first].find(scale);
-          if(scale != regular_scale && it_scale == m_mapOfTemplate_info[it_tpl->first].end()) {
-            //The scale is not present and is different of 100
-            cv::Mat img_template_scale;
-            cv::resize(it_image->second, img_template_scale, cv::Size(), scale/100.0, scale/100.0);
+    //Get the template at regular scale
+    std::map<int, Template_info_t>::const_iterator it_tpl_reg_scale = templates->find(regular_scale);
 
-            m_mapOfTemplate_info[it_tpl->first][scale] = prepareTemplate(img_template_scale);
+    if(it_image != mapOfTemplateImages.end() && it_tpl_reg_scale != templates->end()) {
 
-            //Set query ROI
-            m_mapOfTemplate_info[it_tpl->first][scale].m_queryROI = it_tpl_reg_scale->second.m_queryROI;
-          }
+      //Compute template information for all the scales between [m_scaleMin ; m_scaleMax]
+      for(int scale = m_scaleMin; scale <= m_scaleMax; scale += m_scaleStep) {
 
-          if(m_pyramidType != noPyramid) {
-            int half_scale = scale / 2;
+        if(m_usePointSetScaling && scale != regular_scale) {
+          //The scales are obtained from the point set at 100% during the detection
+          continue;
+        }
 
-            if(half_scale > 0) {
-              it_scale = m_mapOfTemplate_info[it_tpl->first].find(half_scale);
+        std::map<int, Template_info_t>::const_iterator it_scale = templates->find(scale);
+        if(scale != regular_scale && it_scale == templates->end()) {
+          //The scale is not present and is different of 100
+          cv::Mat img_template_scale;
+          cv::resize(it_image->second, img_template_scale, cv::Size(), scale/100.0, scale/100.0);
 
-              if(it_scale == m_mapOfTemplate_info[it_tpl->first].end()) {
-                cv::Mat img_template_scale;
-                cv::resize(it_image->second, img_template_scale, cv::Size(), half_scale/100.0, half_scale/100.0);
+          (*templates)[scale] = prepareTemplate(img_template_scale);
 
-                m_mapOfTemplate_info[it_tpl->first][half_scale] = prepareTemplate(img_template_scale);
-              }
-            }
-          }
+          //Set query ROI
+          (*templates)[scale].m_queryROI = it_tpl_reg_scale->second.m_queryROI;
         }
-      } else {
-        std::cerr << "Cannot find the template image!" << std::endl;
-      }
-    }
 
-    //Vector of valid scales (multi-scales + pyramid half scale if sets)
-    std::vector<int> vectorOfScales;
-    vectorOfScales.push_back(regular_scale);
-    for(int scale = m_scaleMin; scale <= m_scaleMax; scale += m_scaleStep) {
-      vectorOfScales.push_back(scale);
+        if(m_pyramidType != noPyramid) {
+          int half_scale = scale / 2;
+
+          if(half_scale > 0) {
+            it_scale = templates->find(half_scale);
 
-      if(m_pyramidType != noPyramid) {
-        if(scale / 2 > 0) {
-          //Add half scale
-          vectorOfScales.push_back(scale / 2);
+            if(it_scale == templates->end()) {
+              cv::Mat img_template_scale;
+              cv::resize(it_image->second, img_template_scale, cv::Size(), half_scale/100.0, half_scale/100.0);
+
+              (*templates)[half_scale] = prepareTemplate(img_template_scale);
+            }
+          }
         }
       }
+    } else {
+      std::cerr << "Cannot find the template image!" << std::endl;
     }
 
     //Remove obsolete scales
-    for(std::map<int, std::map<int, Template_info_t> >::iterator it_tpl = m_mapOfTemplate_info.begin();
-        it_tpl != m_mapOfTemplate_info.end(); ++it_tpl) {
-
-      for(std::map<int, Template_info_t>::iterator it_tpl_scale = it_tpl->second.begin();
-          it_tpl_scale != it_tpl->second.end(); ) {
-        if( std::find(vectorOfScales.begin(), vectorOfScales.end(), it_tpl_scale->first) == vectorOfScales.end() ) {
-          //Delete obsolete scale
-          it_tpl->second.erase(it_tpl_scale++);
-        } else {
-          ++it_tpl_scale;
-        }
+    for(std::map<int, Template_info_t>::iterator it_tpl_scale = templates->begin();
+        it_tpl_scale != templates->end(); ) {
+      if( std::find(vectorOfScales.begin(), vectorOfScales.end(), it_tpl_scale->first) == vectorOfScales.end() ) {
+        //Delete obsolete scale
+        templates->erase(it_tpl_scale++);
+      } else {
+        ++it_tpl_scale;
       }
     }
-  } else {
-    std::cerr << "Invalid scale parameter !" << std::endl;
   }
 }
 
 void ChamferMatcher::setTemplateImages(const std::map<int, cv::Mat> &mapOfTemplateImages,
     const std::map<int, std::pair<cv::Rect, cv::Rect> > &mapOfTemplateRois, const bool deepCopy) {
-  m_mapOfTemplate_info.clear();
-  m_mapOfTemplateImages.clear();
+  //Build the new library aside, the detections in progress keep the current one.
+  //The current library is kept if the new one cannot be built.
+  std::shared_ptr<TemplateLibrary_t> library(new TemplateLibrary_t);
+  if(buildTemplateLibrary(mapOfTemplateImages, mapOfTemplateRois, deepCopy, *library)) {
+    setTemplateLibrary(library);
+  }
+}
 
+bool ChamferMatcher::buildTemplateLibrary(const std::map<int, cv::Mat> &mapOfTemplateImages,
+    const std::map<int, std::pair<cv::Rect, cv::Rect> > &mapOfTemplateRois, const bool deepCopy,
+    TemplateLibrary_t &library) {
   if(mapOfTemplateImages.size() != mapOfTemplateRois.size()) {
     std::cerr << "Different size between templates and rois!" << std::endl;
-    return;
+    return false;
   }
 
   int regular_scale = 100;
@@ -2010,26 +3657,30 @@ void ChamferMatcher::setTemplateImages(const std::map<int, cv::Mat> &mapOfTempla
 
     //Set template image
     if(deepCopy) {
-      m_mapOfTemplateImages[it_tpl->first] = it_tpl->second.clone(); //Clone to avoid modification problem
+      library.m_mapOfTemplateImages[it_tpl->first] = it_tpl->second.clone(); //Clone to avoid modification problem
     } else {
-      m_mapOfTemplateImages[it_tpl->first] = it_tpl->second;
+      library.m_mapOfTemplateImages[it_tpl->first] = it_tpl->second;
     }
 
     //Precompute the template information for scale=100
-    m_mapOfTemplate_info[it_tpl->first][regular_scale] = prepareTemplate(it_tpl->second);
+    std::shared_ptr<TemplateScales_t> templates(new TemplateScales_t);
+    (*templates)[regular_scale] = prepareTemplate(it_tpl->second);
 
     std::map<int, std::pair<cv::Rect, cv::Rect> >::const_iterator it_roi = mapOfTemplateRois.find(it_tpl->first);
     if(it_roi == mapOfTemplateRois.end()) {
-      std::cerr << "The id: " << it_roi->first << " does not exist in template rois!" << std::endl;
-      return;
+      std::cerr << "The id: " << it_tpl->first << " does not exist in template rois!" << std::endl;
+      return false;
     }
 
     //Set template location
-    m_mapOfTemplate_info[it_tpl->first][regular_scale].m_templateLocation = it_roi->second.first;
+    (*templates)[regular_scale].m_templateLocation = it_roi->second.first;
 
     //Set query ROI
-    m_mapOfTemplate_info[it_tpl->first][regular_scale].m_queryROI = it_roi->second.second;
+    (*templates)[regular_scale].m_queryROI = it_roi->second.second;
+
+    library.m_mapOfTemplate_info[it_tpl->first] = templates;
   }
 
-  setScale(m_scaleMin, m_scaleMax, m_scaleStep);
+  computeScales(library);
+  return true;
 }
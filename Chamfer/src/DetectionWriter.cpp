@@ -0,0 +1,332 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/DetectionWriter.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace {
+  void appendInt(std::string &buffer, const int value) {
+    buffer.append((const char *) &value, sizeof(value));
+  }
+
+  void appendFloat(std::string &buffer, const float value) {
+    buffer.append((const char *) &value, sizeof(value));
+  }
+
+  void appendDouble(std::string &buffer, const double value) {
+    buffer.append((const char *) &value, sizeof(value));
+  }
+
+  void appendString(std::string &buffer, const std::string &str) {
+    appendInt(buffer, (int) str.length());
+    buffer.append(str);
+  }
+
+  void appendJsonString(std::string &buffer, const std::string &str) {
+    buffer.push_back('"');
+    for(std::string::const_iterator it = str.begin(); it != str.end(); ++it) {
+      switch(*it) {
+      case '"':
+        buffer.append("\\\"");
+        break;
+      case '\\':
+        buffer.append("\\\\");
+        break;
+      case '\n':
+        buffer.append("\\n");
+        break;
+      case '\r':
+        buffer.append("\\r");
+        break;
+      case '\t':
+        buffer.append("\\t");
+        break;
+      default:
+        if((unsigned char) *it < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) *it);
+          buffer.append(escaped);
+        } else {
+          buffer.push_back(*it);
+        }
+        break;
+      }
+    }
+    buffer.push_back('"');
+  }
+
+  template<typename T>
+  bool readValue(std::istream &stream, T &value) {
+    stream.read((char *) &value, sizeof(value));
+    return (bool) stream;
+  }
+
+  bool readString(std::istream &stream, std::string &str) {
+    int length = 0;
+    if(!readValue(stream, length) || length < 0) {
+      return false;
+    }
+
+    str.resize(length);
+    if(length > 0) {
+      stream.read(&str[0], length);
+    }
+    return (bool) stream;
+  }
+}
+
+DetectionWriter::DetectionWriter()
+  : m_format(binaryFormat), m_fd(-1), m_ownFd(false), m_pending(), m_maxPendingBytes(64*1024*1024), m_mutex(),
+    m_condition(), m_stop(false), m_thread() {
+}
+
+DetectionWriter::~DetectionWriter() {
+  close();
+}
+
+void DetectionWriter::close() {
+  if(m_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_condition.notify_all();
+    m_thread.join();
+  }
+
+  if(m_ownFd && m_fd >= 0) {
+    ::close(m_fd);
+  }
+  m_fd = -1;
+  m_ownFd = false;
+}
+
+bool DetectionWriter::open(const std::string &filename, const FormatType &format, const size_t maxPendingBytes) {
+  close();
+
+  if(filename == "-") {
+    m_fd = STDOUT_FILENO;
+    m_ownFd = false;
+  } else {
+    m_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    m_ownFd = true;
+
+    if(m_fd < 0) {
+      std::cerr << "File: " << filename << " cannot be opened ! (" << strerror(errno) << ")" << std::endl;
+      m_ownFd = false;
+      return false;
+    }
+  }
+
+  m_format = format;
+  m_maxPendingBytes = maxPendingBytes;
+  m_stop = false;
+  m_pending.clear();
+
+  if(m_format == binaryFormat) {
+    appendInt(m_pending, binaryMagic);
+    appendInt(m_pending, binaryVersion);
+  }
+
+  m_thread = std::thread(&DetectionWriter::writerLoop, this);
+  return true;
+}
+
+bool DetectionWriter::readBinaryHeader(std::istream &stream) {
+  int magic = 0, version = 0;
+  return readValue(stream, magic) && readValue(stream, version) && magic == binaryMagic && version == binaryVersion;
+}
+
+bool DetectionWriter::readBinaryRecord(std::istream &stream, DetectionRecord_t &record) {
+  int payloadLength = 0;
+  if(!readValue(stream, payloadLength) || payloadLength <= 0) {
+    return false;
+  }
+
+  record.m_detections.clear();
+  record.m_timings.clear();
+
+  int nbDetections = 0;
+  if(!readValue(stream, record.m_frame) || !readString(stream, record.m_source) ||
+      !readValue(stream, nbDetections) || nbDetections < 0) {
+    return false;
+  }
+
+  record.m_detections.reserve(nbDetections);
+  for(int i = 0; i < nbDetections; i++) {
+    int x = 0, y = 0, width = 0, height = 0;
+    Detection_t detection;
+
+    if(!readValue(stream, x) || !readValue(stream, y) || !readValue(stream, width) || !readValue(stream, height) ||
+        !readValue(stream, detection.m_chamferDist) || !readValue(stream, detection.m_scale) ||
+        !readValue(stream, detection.m_templateIndex)) {
+      return false;
+    }
+
+    detection.m_boundingBox = cv::Rect(x, y, width, height);
+    record.m_detections.push_back(detection);
+  }
+
+  int nbTimings = 0;
+  if(!readValue(stream, nbTimings) || nbTimings < 0) {
+    return false;
+  }
+
+  for(int i = 0; i < nbTimings; i++) {
+    std::pair<std::string, double> timing;
+    if(!readString(stream, timing.first) || !readValue(stream, timing.second)) {
+      return false;
+    }
+    record.m_timings.push_back(timing);
+  }
+
+  return true;
+}
+
+void DetectionWriter::serialize(const DetectionRecord_t &record, const FormatType &format, std::string &buffer) {
+  if(format == binaryFormat) {
+    //Reserve the payload length, filled at the end
+    size_t start = buffer.size();
+    appendInt(buffer, 0);
+
+    appendInt(buffer, record.m_frame);
+    appendString(buffer, record.m_source);
+
+    appendInt(buffer, (int) record.m_detections.size());
+    for(std::vector<Detection_t>::const_iterator it = record.m_detections.begin();
+        it != record.m_detections.end(); ++it) {
+      appendInt(buffer, it->m_boundingBox.x);
+      appendInt(buffer, it->m_boundingBox.y);
+      appendInt(buffer, it->m_boundingBox.width);
+      appendInt(buffer, it->m_boundingBox.height);
+      appendFloat(buffer, it->m_chamferDist);
+      appendInt(buffer, it->m_scale);
+      appendInt(buffer, it->m_templateIndex);
+    }
+
+    appendInt(buffer, (int) record.m_timings.size());
+    for(std::vector<std::pair<std::string, double> >::const_iterator it = record.m_timings.begin();
+        it != record.m_timings.end(); ++it) {
+      appendString(buffer, it->first);
+      appendDouble(buffer, it->second);
+    }
+
+    int payloadLength = (int) (buffer.size() - start - sizeof(int));
+    memcpy(&buffer[start], &payloadLength, sizeof(payloadLength));
+  } else {
+    char number[64];
+
+    buffer.append("{\"source\":");
+    appendJsonString(buffer, record.m_source);
+    snprintf(number, sizeof(number), ",\"frame\":%d,\"detections\":[", record.m_frame);
+    buffer.append(number);
+
+    for(std::vector<Detection_t>::const_iterator it = record.m_detections.begin();
+        it != record.m_detections.end(); ++it) {
+      if(it != record.m_detections.begin()) {
+        buffer.push_back(',');
+      }
+
+      char detection[256];
+      snprintf(detection, sizeof(detection),
+          "{\"x\":%d,\"y\":%d,\"width\":%d,\"height\":%d,\"dist\":%.9g,\"scale\":%d,\"template\":%d}",
+          it->m_boundingBox.x, it->m_boundingBox.y, it->m_boundingBox.width, it->m_boundingBox.height,
+          it->m_chamferDist, it->m_scale, it->m_templateIndex);
+      buffer.append(detection);
+    }
+    buffer.push_back(']');
+
+    if(!record.m_timings.empty()) {
+      buffer.append(",\"timings\":{");
+      for(std::vector<std::pair<std::string, double> >::const_iterator it = record.m_timings.begin();
+          it != record.m_timings.end(); ++it) {
+        if(it != record.m_timings.begin()) {
+          buffer.push_back(',');
+        }
+
+        appendJsonString(buffer, it->first);
+        snprintf(number, sizeof(number), ":%.6g", it->second);
+        buffer.append(number);
+      }
+      buffer.push_back('}');
+    }
+
+    buffer.append("}\n");
+  }
+}
+
+void DetectionWriter::write(const DetectionRecord_t &record) {
+  if(!isOpen()) {
+    std::cerr << "The detection writer is not opened!" << std::endl;
+    return;
+  }
+
+  //Serialize outside of the lock
+  std::string buffer;
+  serialize(record, m_format, buffer);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while(!m_stop && !m_pending.empty() && m_pending.size() + buffer.size() > m_maxPendingBytes) {
+    m_condition.wait(lock);
+  }
+
+  m_pending.append(buffer);
+  lock.unlock();
+  m_condition.notify_all();
+}
+
+void DetectionWriter::writerLoop() {
+  std::string buffer;
+  bool stop = false;
+
+  while(!stop) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while(!m_stop && m_pending.empty()) {
+        m_condition.wait(lock);
+      }
+
+      //Take all the pending data at once
+      buffer.swap(m_pending);
+      stop = m_stop;
+    }
+    m_condition.notify_all();
+
+    const char *ptr = buffer.data();
+    size_t remaining = buffer.size();
+    while(remaining > 0) {
+      ssize_t nb = ::write(m_fd, ptr, remaining);
+      if(nb < 0 && errno == EINTR) {
+        continue;
+      }
+      if(nb <= 0) {
+        std::cerr << "Cannot write the detections: " << strerror(errno) << std::endl;
+        break;
+      }
+
+      ptr += nb;
+      remaining -= nb;
+    }
+    buffer.clear();
+  }
+}
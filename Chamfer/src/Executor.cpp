@@ -0,0 +1,234 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/Executor.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+
+namespace {
+  //Number of chunks run by the current thread, > 0 inside a parallelFor
+  thread_local int t_nestingDepth = 0;
+
+  //Chunks per thread, to balance the rows of different costs (rejection)
+  const int CHUNKS_PER_THREAD = 4;
+
+  //Mark the current thread as running chunks for its lifetime, also when a chunk throws
+  struct NestingGuard {
+    NestingGuard() {
+      t_nestingDepth++;
+    }
+
+    ~NestingGuard() {
+      t_nestingDepth--;
+    }
+  };
+
+  struct ParallelJob_t {
+    std::function<void(int, int)> m_func;
+    std::atomic<int> m_next;
+    int m_end;
+    int m_chunkSize;
+    int m_nbChunks;
+    int m_nbDone;
+    //! First exception thrown by a chunk, the remaining chunks are skipped.
+    std::exception_ptr m_exception;
+    std::atomic<bool> m_failed;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+
+    ParallelJob_t(const std::function<void(int, int)> &func, const int begin, const int end, const int chunkSize)
+      : m_func(func), m_next(begin), m_end(end), m_chunkSize(chunkSize),
+        m_nbChunks((end - begin + chunkSize - 1) / chunkSize), m_nbDone(0), m_exception(), m_failed(false),
+        m_mutex(), m_condition() {
+    }
+
+    /*
+     * Run the chunks left, never throws: the exception of a chunk is kept for the thread that waits.
+     */
+    void runChunks() {
+      NestingGuard guard;
+      for(int first = m_next.fetch_add(m_chunkSize); first < m_end; first = m_next.fetch_add(m_chunkSize)) {
+        if(!m_failed.load(std::memory_order_relaxed)) {
+          try {
+            m_func(first, std::min(first + m_chunkSize, m_end));
+          } catch(...) {
+            setException(std::current_exception());
+          }
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(++m_nbDone == m_nbChunks) {
+          m_condition.notify_all();
+        }
+      }
+    }
+
+    void setException(const std::exception_ptr &exception) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(!m_exception) {
+        m_exception = exception;
+      }
+      m_failed = true;
+    }
+
+    /*
+     * Wait for all the chunks, then rethrow the first exception thrown by a chunk.
+     */
+    void wait() {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while(m_nbDone < m_nbChunks) {
+        m_condition.wait(lock);
+      }
+
+      if(m_exception) {
+        std::rethrow_exception(m_exception);
+      }
+    }
+  };
+}
+
+Executor::~Executor() {
+}
+
+Executor* Executor::getDefault() {
+  //Intentionally leaked: detections may run during the static destructors
+  static Executor *instance = new ThreadPoolExecutor;
+  return instance;
+}
+
+void Executor::parallelFor(const int begin, const int end, const std::function<void(int, int)> &func,
+    const int maxParallelism) {
+  if(end <= begin) {
+    return;
+  }
+
+  int parallelism = maxParallelism > 0 ? std::min(maxParallelism, getConcurrency()) : getConcurrency();
+  parallelism = std::min(parallelism, end - begin);
+  if(parallelism <= 1 || t_nestingDepth > 0) {
+    //Serial or nested loop: the threads are already busy with the outer loop
+    NestingGuard guard;
+    func(begin, end);
+    return;
+  }
+
+  int chunkSize = std::max(1, (end - begin) / (CHUNKS_PER_THREAD * parallelism));
+  std::shared_ptr<ParallelJob_t> job = std::make_shared<ParallelJob_t>(func, begin, end, chunkSize);
+
+  //The helpers hold the job: a helper that starts after the end of the loop finds no chunk left
+  std::exception_ptr submitException;
+  try {
+    for(int cpt = 0; cpt < parallelism-1; cpt++) {
+      submit([job]() {
+        job->runChunks();
+      });
+    }
+  } catch(...) {
+    //The calling thread runs the chunks not taken by the submitted helpers
+    submitException = std::current_exception();
+  }
+
+  //Never leave while a helper may still call func
+  job->runChunks();
+  job->wait();
+
+  if(submitException) {
+    std::rethrow_exception(submitException);
+  }
+}
+
+int SerialExecutor::getConcurrency() const {
+  return 1;
+}
+
+SerialExecutor* SerialExecutor::getInstance() {
+  static SerialExecutor *instance = new SerialExecutor;
+  return instance;
+}
+
+void SerialExecutor::submit(const std::function<void()> &task) {
+  task();
+}
+
+ThreadPoolExecutor::ThreadPoolExecutor(const int nbThreads)
+  : m_threads(), m_tasks(), m_mutex(), m_condition(), m_stop(false) {
+  int nb = nbThreads > 0 ? nbThreads : std::max(1, (int) std::thread::hardware_concurrency());
+  for(int cpt = 0; cpt < nb; cpt++) {
+    m_threads.push_back(std::thread(&ThreadPoolExecutor::run, this));
+  }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_condition.notify_all();
+
+  for(std::vector<std::thread>::iterator it = m_threads.begin(); it != m_threads.end(); ++it) {
+    it->join();
+  }
+}
+
+int ThreadPoolExecutor::getConcurrency() const {
+  return (int) m_threads.size();
+}
+
+void ThreadPoolExecutor::run() {
+  for(;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while(!m_stop && m_tasks.empty()) {
+        m_condition.wait(lock);
+      }
+
+      if(m_tasks.empty()) {
+        //Stopped
+        return;
+      }
+
+      task = m_tasks.front();
+      m_tasks.pop_front();
+    }
+
+    task();
+  }
+}
+
+void ThreadPoolExecutor::submit(const std::function<void()> &task) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back(task);
+  }
+  m_condition.notify_one();
+}
+
+CallbackExecutor::CallbackExecutor(const SubmitFunction_t &submit, const int concurrency)
+  : m_submit(submit), m_concurrency(std::max(1, concurrency)) {
+}
+
+int CallbackExecutor::getConcurrency() const {
+  return m_concurrency;
+}
+
+void CallbackExecutor::submit(const std::function<void()> &task) {
+  m_submit(task);
+}
@@ -0,0 +1,136 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/NumaTopology.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace {
+#ifdef __linux__
+  //Maximal number of nodes looked for in sysfs
+  const int MAX_NODES = 64;
+
+  /*
+   * Parse a sysfs CPU list, e.g. "0-7,16-23".
+   */
+  void parseCpuList(const std::string &list, std::vector<int> &cpus) {
+    std::istringstream stream(list);
+    std::string range;
+    while(std::getline(stream, range, ',')) {
+      if(range.empty() || range[0] == '\n') {
+        continue;
+      }
+
+      size_t dash = range.find('-');
+      int first = atoi(range.substr(0, dash).c_str());
+      int last = dash == std::string::npos ? first : atoi(range.substr(dash+1).c_str());
+      for(int cpu = first; cpu <= last; cpu++) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+}
+
+NumaTopology::NumaTopology() : m_nodeCpus() {
+#ifdef __linux__
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  bool hasAffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+  for(int node = 0; node < MAX_NODES; node++) {
+    std::stringstream ss;
+    ss << "/sys/devices/system/node/node" << node << "/cpulist";
+    std::ifstream file(ss.str().c_str());
+    if(!file.is_open()) {
+      continue;
+    }
+
+    std::string list;
+    std::getline(file, list);
+    std::vector<int> cpus, allowedCpus;
+    parseCpuList(list, cpus);
+    for(std::vector<int>::const_iterator it = cpus.begin(); it != cpus.end(); ++it) {
+      if(!hasAffinity || (*it < CPU_SETSIZE && CPU_ISSET(*it, &allowed))) {
+        allowedCpus.push_back(*it);
+      }
+    }
+
+    //Memory only nodes and nodes outside the cpuset are not used
+    if(!allowedCpus.empty()) {
+      m_nodeCpus.push_back(allowedCpus);
+    }
+  }
+#endif
+
+  if(m_nodeCpus.empty()) {
+    //Single node fallback
+    m_nodeCpus.push_back(std::vector<int>());
+  }
+}
+
+const NumaTopology& NumaTopology::getInstance() {
+  static NumaTopology instance;
+  return instance;
+}
+
+bool NumaTopology::pinCurrentThread(const int node) const {
+  if(!isNuma()) {
+    return true;
+  }
+
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  const std::vector<int> &nodeCpus = m_nodeCpus[node % getNbNodes()];
+  for(std::vector<int>::const_iterator it = nodeCpus.begin(); it != nodeCpus.end(); ++it) {
+    CPU_SET(*it, &cpus);
+  }
+
+  if(pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    std::cerr << "Cannot pin the thread to the NUMA node " << node << "!" << std::endl;
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void NumaTopology::runOnNode(const int node, const std::function<void()> &func) const {
+  if(!isNuma()) {
+    func();
+    return;
+  }
+
+  std::thread thread([&]() {
+    pinCurrentThread(node);
+    func();
+  });
+  thread.join();
+}
@@ -0,0 +1,258 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/ParameterSweep.hpp"
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+
+namespace {
+  double elapsedMs(const int64 start) {
+    return ((double) cv::getTickCount() - start) / cv::getTickFrequency() * 1000.0;
+  }
+
+  /*
+   * Run worker() on nbThreads threads and wait for them.
+   */
+  template<typename Worker>
+  void runWorkers(const int nbThreads, Worker worker) {
+    std::vector<std::thread> threads;
+    for(int cpt = 0; cpt < nbThreads; cpt++) {
+      threads.push_back(std::thread(worker));
+    }
+
+    for(std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it) {
+      it->join();
+    }
+  }
+
+  //Result of one configuration on one image
+  struct SampleResult_t {
+    int m_nbFound;
+    int m_nbDetections;
+    int m_nbTruePositives;
+    double m_time;
+
+    SampleResult_t() : m_nbFound(0), m_nbDetections(0), m_nbTruePositives(0), m_time(0.0) {
+    }
+  };
+}
+
+std::vector<SweepConfig_t> SweepGrid_t::getConfigs() const {
+  const SweepConfig_t defaultConfig;
+  std::vector<double> cannyThresholds = m_cannyThresholds.empty() ?
+      std::vector<double>(1, defaultConfig.m_cannyThreshold) : m_cannyThresholds;
+  std::vector<ChamferMatcher::MatchingType> matchingTypes = m_matchingTypes.empty() ?
+      std::vector<ChamferMatcher::MatchingType>(1, defaultConfig.m_matchingType) : m_matchingTypes;
+  std::vector<float> lambdas = m_lambdas.empty() ? std::vector<float>(1, defaultConfig.m_lambda) : m_lambdas;
+  std::vector<float> distanceThresholds = m_distanceThresholds.empty() ?
+      std::vector<float>(1, defaultConfig.m_distanceThresh) : m_distanceThresholds;
+
+  std::vector<SweepConfig_t> configs;
+  for(std::vector<double>::const_iterator it_canny = cannyThresholds.begin(); it_canny != cannyThresholds.end();
+      ++it_canny) {
+    for(std::vector<ChamferMatcher::MatchingType>::const_iterator it_type = matchingTypes.begin();
+        it_type != matchingTypes.end(); ++it_type) {
+      for(std::vector<float>::const_iterator it_lambda = lambdas.begin(); it_lambda != lambdas.end(); ++it_lambda) {
+        for(std::vector<float>::const_iterator it_thresh = distanceThresholds.begin();
+            it_thresh != distanceThresholds.end(); ++it_thresh) {
+          SweepConfig_t config;
+          config.m_cannyThreshold = *it_canny;
+          config.m_matchingType = *it_type;
+          config.m_lambda = *it_lambda;
+          config.m_distanceThresh = *it_thresh;
+          configs.push_back(config);
+        }
+      }
+    }
+  }
+
+  return configs;
+}
+
+ParameterSweep::ParameterSweep(const ChamferMatcher &prototype)
+  : m_prototype(prototype), m_chunkSize(64), m_minOverlap(0.5), m_multiScale(true), m_nbWorkers(0),
+    m_queryPreparationTime(0.0), m_templatePreparationTime(0.0), m_useGroupDetections(true), m_useOrientation(true) {
+}
+
+void ParameterSweep::evaluate(const std::vector<Detection_t> &detections, const std::vector<cv::Rect> &groundTruth,
+    const double minOverlap, int &nbFound, int &nbTruePositives) {
+  std::vector<bool> found(groundTruth.size(), false);
+  nbTruePositives = 0;
+
+  for(std::vector<Detection_t>::const_iterator it_det = detections.begin(); it_det != detections.end(); ++it_det) {
+    bool truePositive = false;
+
+    for(size_t cpt = 0; cpt < groundTruth.size(); cpt++) {
+      cv::Rect r_intersect = it_det->m_boundingBox & groundTruth[cpt];
+      double unionArea = it_det->m_boundingBox.area() + groundTruth[cpt].area() - r_intersect.area();
+      if(unionArea > 0 && r_intersect.area() / unionArea >= minOverlap) {
+        found[cpt] = true;
+        truePositive = true;
+      }
+    }
+
+    if(truePositive) {
+      nbTruePositives++;
+    }
+  }
+
+  nbFound = (int) std::count(found.begin(), found.end(), true);
+}
+
+bool ParameterSweep::run(const std::string &templateFilename, const std::vector<SweepSample_t> &samples,
+    const SweepGrid_t &grid, std::vector<SweepResult_t> &results) {
+  const std::vector<SweepConfig_t> configs = grid.getConfigs();
+  results.assign(configs.size(), SweepResult_t());
+  m_queryPreparationTime = 0.0;
+  m_templatePreparationTime = 0.0;
+
+  if(m_prototype.getUseCompactTemplates()) {
+    //The compact templates only keep the maps of the matching type of the prototype
+    for(std::vector<SweepConfig_t>::const_iterator it = configs.begin(); it != configs.end(); ++it) {
+      if(it->m_matchingType != m_prototype.getMatchingType()) {
+        std::cerr << "The compact templates cannot be swept over another matching type!" << std::endl;
+        return false;
+      }
+    }
+  }
+
+  const int nbThreads = m_nbWorkers > 0 ? m_nbWorkers : std::max(1, (int) std::thread::hardware_concurrency());
+  const bool halfResolution = m_prototype.getPyramidType() != ChamferMatcher::noPyramid;
+
+  //Key: configuration index - Value: detection latency of each image
+  std::vector<std::vector<double> > latencies(configs.size());
+
+  size_t firstConfig = 0;
+  while(firstConfig < configs.size()) {
+    //Configurations [firstConfig, endConfig) share the Canny threshold, hence the templates and the queries
+    const double cannyThreshold = configs[firstConfig].m_cannyThreshold;
+    size_t endConfig = firstConfig+1;
+    while(endConfig < configs.size() && configs[endConfig].m_cannyThreshold == cannyThreshold) {
+      endConfig++;
+    }
+
+    int64 t_templates = cv::getTickCount();
+    ChamferMatcher matcher = m_prototype;
+    matcher.setCannyThreshold(cannyThreshold);
+    matcher.loadTemplateData(templateFilename);
+    m_templatePreparationTime += elapsedMs(t_templates);
+
+    if(nbThreads > 1) {
+      //One detection per worker, the parallel loops of the matcher would oversubscribe the cores
+      matcher.setExecutor(SerialExecutor::getInstance());
+    }
+
+    if(matcher.getNbTemplates() == 0) {
+      std::cerr << "No template in: " << templateFilename << std::endl;
+      return false;
+    }
+
+    const int nbConfigs = (int) (endConfig - firstConfig);
+    for(size_t firstSample = 0; firstSample < samples.size(); firstSample += m_chunkSize) {
+      const int nbSamples = (int) std::min(samples.size() - firstSample, (size_t) m_chunkSize);
+
+      //Prepare the queries of the chunk once for all the configurations
+      int64 t_queries = cv::getTickCount();
+      std::vector<std::shared_ptr<const PreparedQuery_t> > preparedQueries(nbSamples);
+      std::atomic<int> nextSample(0);
+      runWorkers(std::min(nbThreads, nbSamples), [&]() {
+        for(int index = nextSample++; index < nbSamples; index = nextSample++) {
+          preparedQueries[index] = matcher.createPreparedQuery(samples[firstSample+index].m_img, halfResolution);
+        }
+      });
+      m_queryPreparationTime += elapsedMs(t_queries);
+
+      //One task per (configuration, image) to balance the threads even with a few configurations
+      std::vector<SampleResult_t> sampleResults(nbConfigs*nbSamples);
+      std::atomic<int> nextTask(0);
+      runWorkers(std::min(nbThreads, nbConfigs*nbSamples), [&]() {
+        ChamferMatcher worker_matcher = matcher;
+        DetectionWorkspace workspace;
+        std::vector<Detection_t> detections;
+
+        for(int task = nextTask++; task < nbConfigs*nbSamples; task = nextTask++) {
+          const SweepConfig_t &config = configs[firstConfig + task / nbSamples];
+          const int index = task % nbSamples;
+          if(samples[firstSample+index].m_img.empty()) {
+            continue;
+          }
+
+          worker_matcher.setMatchingType(config.m_matchingType);
+          detections.clear();
+
+          int64 t = cv::getTickCount();
+          DetectionQuery_t query(*preparedQueries[index], &workspace);
+          if(m_multiScale) {
+            worker_matcher.detectMultiScale(query, detections, m_useOrientation, config.m_distanceThresh,
+                config.m_lambda, 1.0f, 1.0f, true, m_useGroupDetections);
+          } else {
+            worker_matcher.detect(query, detections, m_useOrientation, config.m_distanceThresh, config.m_lambda,
+                1.0f, 1.0f, m_useGroupDetections);
+          }
+
+          SampleResult_t &result = sampleResults[task];
+          result.m_time = elapsedMs(t);
+          result.m_nbDetections = (int) detections.size();
+          evaluate(detections, samples[firstSample+index].m_groundTruth, m_minOverlap, result.m_nbFound,
+              result.m_nbTruePositives);
+        }
+      });
+
+      for(int task = 0; task < nbConfigs*nbSamples; task++) {
+        const size_t configIndex = firstConfig + task / nbSamples;
+        const SweepSample_t &sample = samples[firstSample + task % nbSamples];
+        if(sample.m_img.empty()) {
+          continue;
+        }
+
+        SweepResult_t &result = results[configIndex];
+        result.m_nbImages++;
+        result.m_nbGroundTruth += (int) sample.m_groundTruth.size();
+        result.m_nbFound += sampleResults[task].m_nbFound;
+        result.m_nbDetections += sampleResults[task].m_nbDetections;
+        result.m_nbTruePositives += sampleResults[task].m_nbTruePositives;
+        latencies[configIndex].push_back(sampleResults[task].m_time);
+      }
+    }
+
+    firstConfig = endConfig;
+  }
+
+  for(size_t cpt = 0; cpt < configs.size(); cpt++) {
+    SweepResult_t &result = results[cpt];
+    result.m_config = configs[cpt];
+
+    std::vector<double> &times = latencies[cpt];
+    if(!times.empty()) {
+      std::sort(times.begin(), times.end());
+      double sum = 0.0;
+      for(std::vector<double>::const_iterator it = times.begin(); it != times.end(); ++it) {
+        sum += *it;
+      }
+
+      result.m_meanTime = sum / times.size();
+      result.m_p95Time = times[std::min(times.size()-1, (size_t) (0.95 * times.size()))];
+      result.m_maxTime = times.back();
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,144 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/PerfCounters.hpp"
+
+#ifdef __linux__
+#include <cstring>
+#include <stdint.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+
+namespace {
+#ifdef __linux__
+  int openCounter(const PerfCounterValues_t::Counter counter) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    //Time enabled / running to scale the multiplexed counters
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch(counter) {
+    case PerfCounterValues_t::cyclesCounter:
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PerfCounterValues_t::instructionsCounter:
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PerfCounterValues_t::cacheMissesCounter:
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case PerfCounterValues_t::dtlbMissesCounter:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    case PerfCounterValues_t::branchMissesCounter:
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    default:
+      return -1;
+    }
+
+    //Calling thread, any CPU
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#endif
+}
+
+const char* PerfCounterValues_t::getCounterName(const Counter counter) {
+  switch(counter) {
+  case cyclesCounter:
+    return "cycles";
+  case instructionsCounter:
+    return "instructions";
+  case cacheMissesCounter:
+    return "llc_misses";
+  case dtlbMissesCounter:
+    return "dtlb_misses";
+  case branchMissesCounter:
+    return "branch_misses";
+  default:
+    return "?";
+  }
+}
+
+PerfCounters::PerfCounters() {
+  for(int i = 0; i < PerfCounterValues_t::nbCounters; i++) {
+#ifdef __linux__
+    m_fds[i] = openCounter((PerfCounterValues_t::Counter) i);
+#else
+    m_fds[i] = -1;
+#endif
+  }
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+  for(int i = 0; i < PerfCounterValues_t::nbCounters; i++) {
+    if(m_fds[i] >= 0) {
+      close(m_fds[i]);
+    }
+  }
+#endif
+}
+
+bool PerfCounters::isAvailable() const {
+  for(int i = 0; i < PerfCounterValues_t::nbCounters; i++) {
+    if(m_fds[i] >= 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool PerfCounters::isAvailable(const PerfCounterValues_t::Counter counter) const {
+  return m_fds[counter] >= 0;
+}
+
+void PerfCounters::read(PerfCounterValues_t &values) const {
+  values.clear();
+
+#ifdef __linux__
+  for(int i = 0; i < PerfCounterValues_t::nbCounters; i++) {
+    if(m_fds[i] < 0) {
+      continue;
+    }
+
+    //value, time enabled, time running
+    uint64_t data[3];
+    if(::read(m_fds[i], data, sizeof(data)) != (ssize_t) sizeof(data)) {
+      continue;
+    }
+
+    if(data[2] > 0) {
+      values.m_values[i] = (double) data[0] * ((double) data[1] / data[2]);
+    } else {
+      //Never scheduled on the PMU
+      values.m_values[i] = 0.0;
+    }
+  }
+#endif
+}
@@ -0,0 +1,169 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/PooledMatAllocator.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+
+
+namespace {
+  const size_t CACHE_LINE_SIZE = 64;
+  const size_t HUGE_PAGE_SIZE = 2*1024*1024;
+
+  uchar* allocateBuffer(const size_t size) {
+    const size_t alignment = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : CACHE_LINE_SIZE;
+
+    void *ptr = NULL;
+    if(posix_memalign(&ptr, alignment, size) != 0) {
+      return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if(size >= HUGE_PAGE_SIZE) {
+      //Only a hint, the kernel may ignore it (e.g. transparent huge pages disabled)
+      madvise(ptr, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    return static_cast<uchar*>(ptr);
+  }
+}
+
+PooledMatAllocator::PooledMatAllocator(const size_t maxCachedBytes)
+  : m_mapOfFreeBuffers(), m_cachedBytes(0), m_maxCachedBytes(maxCachedBytes), m_mutex() {
+}
+
+PooledMatAllocator::~PooledMatAllocator() {
+  releaseCachedBuffers();
+}
+
+cv::UMatData* PooledMatAllocator::allocate(int dims, const int* sizes, int type, void* data0, size_t* step,
+    AccessFlag_t, cv::UMatUsageFlags) const {
+  //Same step computation than the OpenCV default allocator
+  size_t total = CV_ELEM_SIZE(type);
+  for(int i = dims-1; i >= 0; i--) {
+    if(step) {
+      if(data0 && step[i] != CV_AUTOSTEP) {
+        total = step[i];
+      } else {
+        step[i] = total;
+      }
+    }
+    total *= sizes[i];
+  }
+
+  uchar *data = static_cast<uchar*>(data0);
+  if(data == NULL) {
+    const size_t capacity = roundSize(total);
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::map<size_t, std::vector<uchar*> >::iterator it = m_mapOfFreeBuffers.find(capacity);
+      if(it != m_mapOfFreeBuffers.end() && !it->second.empty()) {
+        data = it->second.back();
+        it->second.pop_back();
+        m_cachedBytes -= capacity;
+      }
+    }
+
+    if(data == NULL) {
+      data = allocateBuffer(capacity);
+      if(data == NULL) {
+        std::cerr << "Cannot allocate " << capacity << " bytes!" << std::endl;
+        throw std::bad_alloc();
+      }
+    }
+  }
+
+  cv::UMatData *u = new cv::UMatData(this);
+  u->data = u->origdata = data;
+  u->size = total;
+  if(data0) {
+    u->flags |= cv::UMatData::USER_ALLOCATED;
+  }
+
+  return u;
+}
+
+bool PooledMatAllocator::allocate(cv::UMatData* u, AccessFlag_t, cv::UMatUsageFlags) const {
+  return u != NULL;
+}
+
+void PooledMatAllocator::deallocate(cv::UMatData* u) const {
+  if(u == NULL) {
+    return;
+  }
+
+  CV_Assert(u->urefcount == 0);
+  CV_Assert(u->refcount == 0);
+
+  if(!(u->flags & cv::UMatData::USER_ALLOCATED)) {
+    const size_t capacity = roundSize(u->size);
+    bool cached = false;
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(m_cachedBytes + capacity <= m_maxCachedBytes) {
+        m_mapOfFreeBuffers[capacity].push_back(u->origdata);
+        m_cachedBytes += capacity;
+        cached = true;
+      }
+    }
+
+    if(!cached) {
+      free(u->origdata);
+    }
+    u->origdata = NULL;
+  }
+
+  delete u;
+}
+
+size_t PooledMatAllocator::getCachedBytes() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_cachedBytes;
+}
+
+PooledMatAllocator* PooledMatAllocator::getInstance() {
+  //Intentionally leaked: matrices may be released after the static destructors
+  static PooledMatAllocator *instance = new PooledMatAllocator;
+  return instance;
+}
+
+void PooledMatAllocator::releaseCachedBuffers() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for(std::map<size_t, std::vector<uchar*> >::iterator it = m_mapOfFreeBuffers.begin();
+      it != m_mapOfFreeBuffers.end(); ++it) {
+    for(std::vector<uchar*>::iterator it_buffer = it->second.begin(); it_buffer != it->second.end(); ++it_buffer) {
+      free(*it_buffer);
+    }
+  }
+
+  m_mapOfFreeBuffers.clear();
+  m_cachedBytes = 0;
+}
+
+/*
+ * Round the size to the alignment so that frames of close sizes share the same buffers.
+ */
+size_t PooledMatAllocator::roundSize(const size_t size) {
+  const size_t alignment = size >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : CACHE_LINE_SIZE;
+  return size == 0 ? alignment : (size + alignment - 1) / alignment * alignment;
+}
@@ -0,0 +1,97 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/QueryImageLoader.hpp"
+#include <iostream>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+
+QueryImageLoader::QueryImageLoader(const std::string &filename, const bool grayscale)
+  : m_filename(filename), m_buffer(), m_grayscale(grayscale), m_mapOfLevels() {
+}
+
+QueryImageLoader::QueryImageLoader(const std::vector<uchar> &buffer, const bool grayscale)
+  : m_filename(), m_buffer(buffer), m_grayscale(grayscale), m_mapOfLevels() {
+}
+
+QueryImageLoader::QueryImageLoader(const cv::Mat &img)
+  : m_filename(), m_buffer(), m_grayscale(img.channels() == 1), m_mapOfLevels() {
+  m_mapOfLevels[1] = img;
+}
+
+cv::Mat QueryImageLoader::decode(const int flags) const {
+  if(!m_filename.empty()) {
+    return cv::imread(m_filename, flags);
+  }
+
+  if(!m_buffer.empty()) {
+    return cv::imdecode(m_buffer, flags);
+  }
+
+  return cv::Mat();
+}
+
+const cv::Mat& QueryImageLoader::getImage(const int reduction) {
+  std::map<int, cv::Mat>::const_iterator it = m_mapOfLevels.find(reduction);
+  if(it != m_mapOfLevels.end()) {
+    return it->second;
+  }
+
+  cv::Mat &img = m_mapOfLevels[reduction];
+
+  if(reduction == 1) {
+    img = decode(m_grayscale ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR);
+    return img;
+  }
+
+  if(reduction != 2 && reduction != 4 && reduction != 8) {
+    std::cerr << "Reduction factor should be 1, 2, 4 or 8!" << std::endl;
+    return img;
+  }
+
+  //Decode directly at the reduced resolution when the full image has not been decoded yet
+  if(!isDecoded(1) || m_mapOfLevels[1].empty()) {
+    int flags = 0;
+    switch(reduction) {
+    case 2:
+      flags = m_grayscale ? cv::IMREAD_REDUCED_GRAYSCALE_2 : cv::IMREAD_REDUCED_COLOR_2;
+      break;
+    case 4:
+      flags = m_grayscale ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_COLOR_4;
+      break;
+    default:
+      flags = m_grayscale ? cv::IMREAD_REDUCED_GRAYSCALE_8 : cv::IMREAD_REDUCED_COLOR_8;
+      break;
+    }
+
+    img = decode(flags);
+    if(!img.empty()) {
+      return img;
+    }
+  }
+
+  //Fallback: downsample the previous level
+  const cv::Mat &previous = getImage(reduction/2);
+  cv::Mat &level = m_mapOfLevels[reduction];
+  if(!previous.empty()) {
+    cv::pyrDown(previous, level);
+  }
+
+  return level;
+}
@@ -0,0 +1,181 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/RetainedCostMaps.hpp"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <map>
+
+
+namespace {
+  //Same maximal number of detections per map as ChamferMatcher::extractDetections()
+  const size_t MAX_DETECTIONS_PER_MAP = 101;
+
+  //(cost, index of the location in raster order): ties are extracted in raster order as with cv::minMaxLoc
+  typedef std::pair<float, int> Candidate_t;
+}
+
+RetainedCostMaps::RetainedCostMaps(const float distanceThresh, const int stride)
+  : m_distanceThresh(distanceThresh), m_stride(std::max(1, std::min(stride, 16))), m_costMaps() {
+}
+
+void RetainedCostMaps::add(const int templateIndex, const int scale, const cv::Size &templateSize,
+    const cv::Mat &chamferMap) {
+  if(chamferMap.empty()) {
+    return;
+  }
+
+  RetainedCostMap_t costMap;
+  costMap.m_templateIndex = templateIndex;
+  costMap.m_scale = scale;
+  costMap.m_templateSize = templateSize;
+  costMap.m_mapSize = chamferMap.size();
+
+  int blockRows = (chamferMap.rows + m_stride - 1) / m_stride;
+  int blockCols = (chamferMap.cols + m_stride - 1) / m_stride;
+  costMap.m_blockCosts.create(blockRows, blockCols, CV_32F);
+  costMap.m_blockOffsets.create(blockRows, blockCols, CV_8U);
+
+  for(int bi = 0; bi < blockRows; bi++) {
+    float *ptr_costs = costMap.m_blockCosts.ptr<float>(bi);
+    uchar *ptr_offsets = costMap.m_blockOffsets.ptr<uchar>(bi);
+
+    for(int bj = 0; bj < blockCols; bj++) {
+      float minCost = std::numeric_limits<float>::max();
+      int minOffset = 0;
+
+      for(int dy = 0; dy < m_stride && bi*m_stride + dy < chamferMap.rows; dy++) {
+        const float *ptr_row = chamferMap.ptr<float>(bi*m_stride + dy);
+
+        for(int dx = 0; dx < m_stride && bj*m_stride + dx < chamferMap.cols; dx++) {
+          if(ptr_row[bj*m_stride + dx] < minCost) {
+            minCost = ptr_row[bj*m_stride + dx];
+            minOffset = dy*m_stride + dx;
+          }
+        }
+      }
+
+      ptr_costs[bj] = minCost;
+      ptr_offsets[bj] = (uchar) minOffset;
+    }
+  }
+
+  m_costMaps.push_back(costMap);
+}
+
+void RetainedCostMaps::detect(const float distanceThresh, std::vector<Detection_t> &detections,
+    const bool useGroupDetections, const double groupOverlap, const int topK) const {
+  detections.clear();
+  if(distanceThresh > m_distanceThresh) {
+    std::cerr << "Warning: threshold above the one of the detection (" << m_distanceThresh
+        << "), the rejected locations are missing!" << std::endl;
+  }
+
+  std::vector<Candidate_t> candidates;
+  std::vector<Detection_t> raw_detections, current_detections;
+  for(std::vector<RetainedCostMap_t>::const_iterator it = m_costMaps.begin(); it != m_costMaps.end(); ++it) {
+    candidates.clear();
+    for(int bi = 0; bi < it->m_blockCosts.rows; bi++) {
+      const float *ptr_costs = it->m_blockCosts.ptr<float>(bi);
+      const uchar *ptr_offsets = it->m_blockOffsets.ptr<uchar>(bi);
+
+      for(int bj = 0; bj < it->m_blockCosts.cols; bj++) {
+        if(ptr_costs[bj] < distanceThresh) {
+          int x = bj*m_stride + ptr_offsets[bj] % m_stride;
+          int y = bi*m_stride + ptr_offsets[bj] / m_stride;
+          candidates.push_back(Candidate_t(ptr_costs[bj], y*it->m_mapSize.width + x));
+        }
+      }
+    }
+
+    size_t nbDetections = std::min(candidates.size(), MAX_DETECTIONS_PER_MAP);
+    std::partial_sort(candidates.begin(), candidates.begin() + nbDetections, candidates.end());
+
+    raw_detections.clear();
+    for(size_t cpt = 0; cpt < nbDetections; cpt++) {
+      cv::Point pt(candidates[cpt].second % it->m_mapSize.width, candidates[cpt].second / it->m_mapSize.width);
+      raw_detections.push_back(Detection_t(cv::Rect(pt, it->m_templateSize), candidates[cpt].first, it->m_scale));
+    }
+
+    current_detections.clear();
+    if(useGroupDetections) {
+      ChamferMatcher::groupDetections(raw_detections, current_detections, groupOverlap);
+    } else {
+      current_detections = raw_detections;
+    }
+
+    for(std::vector<Detection_t>::iterator it_detection = current_detections.begin();
+        it_detection != current_detections.end(); ++it_detection) {
+      it_detection->m_templateIndex = it->m_templateIndex;
+    }
+
+    detections.insert(detections.end(), current_detections.begin(), current_detections.end());
+  }
+
+  //Sort detections by increasing cost
+  std::sort(detections.begin(), detections.end());
+
+  if(topK > 0) {
+    //Best detection of the topK best templates
+    std::vector<Detection_t> bestDetections;
+    std::map<int, bool> mapOfRetainedTemplates;
+    for(std::vector<Detection_t>::const_iterator it = detections.begin();
+        it != detections.end() && (int) bestDetections.size() < topK; ++it) {
+      if(mapOfRetainedTemplates.find(it->m_templateIndex) == mapOfRetainedTemplates.end()) {
+        mapOfRetainedTemplates[it->m_templateIndex] = true;
+        bestDetections.push_back(*it);
+      }
+    }
+
+    detections = bestDetections;
+  }
+}
+
+void RetainedCostMaps::getCostMap(const size_t index, cv::Mat &chamferMap) const {
+  if(index >= m_costMaps.size()) {
+    std::cerr << "Cost map index out of range!" << std::endl;
+    chamferMap.release();
+    return;
+  }
+
+  const RetainedCostMap_t &costMap = m_costMaps[index];
+  chamferMap.create(costMap.m_mapSize, CV_32F);
+  chamferMap.setTo(std::numeric_limits<float>::max());
+
+  for(int bi = 0; bi < costMap.m_blockCosts.rows; bi++) {
+    const float *ptr_costs = costMap.m_blockCosts.ptr<float>(bi);
+    const uchar *ptr_offsets = costMap.m_blockOffsets.ptr<uchar>(bi);
+
+    for(int bj = 0; bj < costMap.m_blockCosts.cols; bj++) {
+      int x = bj*m_stride + ptr_offsets[bj] % m_stride;
+      int y = bi*m_stride + ptr_offsets[bj] / m_stride;
+      chamferMap.ptr<float>(y)[x] = ptr_costs[bj];
+    }
+  }
+}
+
+size_t RetainedCostMaps::getMemorySize() const {
+  size_t size = 0;
+  for(std::vector<RetainedCostMap_t>::const_iterator it = m_costMaps.begin(); it != m_costMaps.end(); ++it) {
+    size += it->m_blockCosts.total() * it->m_blockCosts.elemSize() +
+        it->m_blockOffsets.total() * it->m_blockOffsets.elemSize();
+  }
+
+  return size;
+}
@@ -0,0 +1,105 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/TemplateCostReport.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+
+namespace {
+  bool moreTime(const TemplateCost_t &cost1, const TemplateCost_t &cost2) {
+    return cost1.m_time > cost2.m_time;
+  }
+}
+
+TemplateCostReport::TemplateCostReport() : m_mapOfCosts(), m_mutex() {
+}
+
+void TemplateCostReport::add(const int templateIndex, const int scale, const double nbWindows,
+    const double nbScoredWindows, const double nbPoints, const double time, const size_t nbDetections) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  TemplateCost_t &cost = m_mapOfCosts[std::pair<int, int>(templateIndex, scale)];
+  cost.m_templateIndex = templateIndex;
+  cost.m_scale = scale;
+  cost.m_nbCalls++;
+  cost.m_nbWindows += nbWindows;
+  cost.m_nbScoredWindows += nbScoredWindows;
+  cost.m_nbPoints += nbPoints;
+  cost.m_time += time;
+  cost.m_nbDetections += (long long) nbDetections;
+}
+
+void TemplateCostReport::clear() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_mapOfCosts.clear();
+}
+
+void TemplateCostReport::getCosts(std::vector<TemplateCost_t> &costs) const {
+  costs.clear();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(std::map<std::pair<int, int>, TemplateCost_t>::const_iterator it = m_mapOfCosts.begin();
+        it != m_mapOfCosts.end(); ++it) {
+      costs.push_back(it->second);
+    }
+  }
+
+  //Keep the (template, scale) order for the same time
+  std::stable_sort(costs.begin(), costs.end(), moreTime);
+}
+
+double TemplateCostReport::getTotalTime() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  double total = 0.0;
+  for(std::map<std::pair<int, int>, TemplateCost_t>::const_iterator it = m_mapOfCosts.begin();
+      it != m_mapOfCosts.end(); ++it) {
+    total += it->second.m_time;
+  }
+
+  return total;
+}
+
+bool TemplateCostReport::write(const std::string &filename) const {
+  std::ofstream file;
+  if(filename != "-") {
+    file.open(filename.c_str());
+    if(!file.is_open()) {
+      std::cerr << "File: " << filename << " cannot be opened !" << std::endl;
+      return false;
+    }
+  }
+  std::ostream &stream = filename == "-" ? std::cout : file;
+
+  std::vector<TemplateCost_t> costs;
+  getCosts(costs);
+  double totalTime = getTotalTime();
+
+  stream << "template\tscale\tcalls\twindows\tscored_windows\trejection_rate\tpoints\ttime_ms\ttime_share"
+      << "\tms_per_call\tdetections" << std::endl;
+  stream << std::fixed << std::setprecision(3);
+  for(std::vector<TemplateCost_t>::const_iterator it = costs.begin(); it != costs.end(); ++it) {
+    stream << it->m_templateIndex << "\t" << it->m_scale << "\t" << it->m_nbCalls << "\t" << it->m_nbWindows << "\t"
+        << it->m_nbScoredWindows << "\t" << it->getRejectionRate() << "\t" << it->m_nbPoints << "\t" << it->m_time
+        << "\t" << (totalTime > 0.0 ? it->m_time / totalTime : 0.0) << "\t"
+        << (it->m_nbCalls > 0 ? it->m_time / it->m_nbCalls : 0.0) << "\t" << it->m_nbDetections << std::endl;
+  }
+
+  return (bool) stream;
+}
@@ -0,0 +1,178 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/TemplateStore.hpp"
+
+
+TemplateStore::TemplateStore(const size_t maxMemory)
+  : m_maxMemory(maxMemory), m_mapOfTemplateImages(), m_mapOfTemplateRois(), m_entries(), m_mapOfEntries(),
+    m_scaleVector(), m_heldTemplates(), m_memorySize(0), m_nbHits(0), m_nbMisses(0), m_nbEvictions(0), m_mutex() {
+}
+
+void TemplateStore::clear() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries.clear();
+  m_mapOfEntries.clear();
+  m_heldTemplates.clear();
+  m_memorySize = 0;
+}
+
+bool TemplateStore::loadTemplateData(const std::string &filename) {
+  std::map<int, cv::Mat> mapOfTemplateImages;
+  std::map<int, std::pair<cv::Rect, cv::Rect> > mapOfTemplateRois;
+  if(!ChamferMatcher::readTemplateData(filename, mapOfTemplateImages, mapOfTemplateRois)) {
+    return false;
+  }
+
+  bool deepCopy = false;
+  setTemplateImages(mapOfTemplateImages, mapOfTemplateRois, deepCopy);
+  return true;
+}
+
+void TemplateStore::setTemplateImages(const std::map<int, cv::Mat> &mapOfTemplateImages,
+    const std::map<int, std::pair<cv::Rect, cv::Rect> > &mapOfTemplateRois, const bool deepCopy) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_mapOfTemplateImages.clear();
+  for(std::map<int, cv::Mat>::const_iterator it = mapOfTemplateImages.begin(); it != mapOfTemplateImages.end();
+      ++it) {
+    m_mapOfTemplateImages[it->first] = deepCopy ? it->second.clone() : it->second;
+  }
+  m_mapOfTemplateRois = mapOfTemplateRois;
+
+  m_entries.clear();
+  m_mapOfEntries.clear();
+  m_heldTemplates.clear();
+  m_memorySize = 0;
+}
+
+std::shared_ptr<const TemplateLibrary_t> TemplateStore::getLibrary(ChamferMatcher &matcher,
+    const std::vector<int> &templateIds) {
+  std::shared_ptr<TemplateLibrary_t> library(new TemplateLibrary_t);
+  std::map<int, cv::Mat> missingImages;
+  std::map<int, std::pair<cv::Rect, cv::Rect> > missingRois;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(std::vector<int>::const_iterator it = templateIds.begin(); it != templateIds.end(); ++it) {
+      std::map<int, cv::Mat>::const_iterator it_image = m_mapOfTemplateImages.find(*it);
+      std::map<int, std::pair<cv::Rect, cv::Rect> >::const_iterator it_roi = m_mapOfTemplateRois.find(*it);
+      if(it_image == m_mapOfTemplateImages.end() || it_roi == m_mapOfTemplateRois.end() ||
+          library->m_mapOfTemplateImages.find(*it) != library->m_mapOfTemplateImages.end()) {
+        continue;
+      }
+      library->m_mapOfTemplateImages[*it] = it_image->second;
+
+      std::map<int, std::list<Entry_t>::iterator>::iterator it_entry = m_mapOfEntries.find(*it);
+      if(it_entry != m_mapOfEntries.end()) {
+        m_entries.splice(m_entries.begin(), m_entries, it_entry->second);
+        library->m_mapOfTemplate_info[*it] = it_entry->second->m_templates;
+        m_nbHits++;
+      } else {
+        missingImages[*it] = it_image->second;
+        missingRois[*it] = it_roi->second;
+        m_nbMisses++;
+      }
+    }
+    library->m_scaleVector = m_scaleVector;
+  }
+
+  if(missingImages.empty()) {
+    return library;
+  }
+
+  //Prepared outside of the lock, two threads may prepare the same template
+  TemplateLibrary_t prepared;
+  bool deepCopy = false;
+  matcher.buildTemplateLibrary(missingImages, missingRois, deepCopy, prepared);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_scaleVector = prepared.m_scaleVector;
+  library->m_scaleVector = prepared.m_scaleVector;
+  for(std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it =
+      prepared.m_mapOfTemplate_info.begin(); it != prepared.m_mapOfTemplate_info.end(); ++it) {
+    std::map<int, std::list<Entry_t>::iterator>::iterator it_entry = m_mapOfEntries.find(it->first);
+    if(it_entry != m_mapOfEntries.end()) {
+      //Prepared meanwhile by another thread, share its copy
+      m_entries.splice(m_entries.begin(), m_entries, it_entry->second);
+      library->m_mapOfTemplate_info[it->first] = it_entry->second->m_templates;
+      continue;
+    }
+    library->m_mapOfTemplate_info[it->first] = it->second;
+
+    Entry_t entry;
+    entry.m_id = it->first;
+    entry.m_templates = it->second;
+    entry.m_memorySize = 0;
+    for(std::map<int, Template_info_t>::const_iterator it_scale = it->second->begin(); it_scale != it->second->end();
+        ++it_scale) {
+      entry.m_memorySize += it_scale->second.getMemorySize();
+    }
+
+    m_entries.push_front(entry);
+    m_mapOfEntries[it->first] = m_entries.begin();
+    m_memorySize += entry.m_memorySize;
+  }
+  evict();
+
+  return library;
+}
+
+void TemplateStore::getTemplateIds(std::vector<int> &templateIds) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  templateIds.clear();
+  for(std::map<int, cv::Mat>::const_iterator it = m_mapOfTemplateImages.begin(); it != m_mapOfTemplateImages.end();
+      ++it) {
+    templateIds.push_back(it->first);
+  }
+}
+
+size_t TemplateStore::size() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_entries.size();
+}
+
+/*
+ * Drop the least recently used templates above the memory cap, m_mutex must be locked.
+ * The evicted templates still used by a library are counted until they are released.
+ * The most recent template is kept even if it is larger than the cap.
+ */
+void TemplateStore::evict() {
+  for(std::list<std::pair<std::weak_ptr<const TemplateScales_t>, size_t> >::iterator it = m_heldTemplates.begin();
+      it != m_heldTemplates.end(); ) {
+    if(it->first.expired()) {
+      m_memorySize -= it->second;
+      it = m_heldTemplates.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  while(m_memorySize > m_maxMemory && m_entries.size() > 1) {
+    std::weak_ptr<const TemplateScales_t> templates = m_entries.back().m_templates;
+    size_t memorySize = m_entries.back().m_memorySize;
+    m_mapOfEntries.erase(m_entries.back().m_id);
+    m_entries.pop_back();
+    m_nbEvictions++;
+
+    if(templates.expired()) {
+      m_memorySize -= memorySize;
+    } else {
+      m_heldTemplates.push_back(std::make_pair(templates, memorySize));
+    }
+  }
+}
@@ -0,0 +1,107 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/TraceRecorder.hpp"
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <set>
+
+
+namespace {
+  std::atomic<int> g_nbThreads(0);
+  thread_local int t_threadId = -1;
+
+  //The names are string literals of the library, nothing to escape
+  void writeEvent(std::ostream &stream, const TraceEvent_t &event) {
+    stream << "{\"name\":\"" << event.m_name << "\",\"cat\":\"" << event.m_category << "\",\"ph\":\"X\",\"ts\":"
+        << event.m_start << ",\"dur\":" << event.m_duration << ",\"pid\":1,\"tid\":" << event.m_threadId;
+
+    if(event.m_nbArgs > 0) {
+      stream << ",\"args\":{";
+      for(int i = 0; i < event.m_nbArgs; i++) {
+        stream << (i > 0 ? "," : "") << "\"" << event.m_argNames[i] << "\":" << event.m_argValues[i];
+      }
+      stream << "}";
+    }
+    stream << "}";
+  }
+}
+
+TraceRecorder::TraceRecorder() : m_origin(std::chrono::steady_clock::now()), m_events(), m_mutex() {
+}
+
+void TraceRecorder::add(const TraceEvent_t &event) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_events.push_back(event);
+}
+
+void TraceRecorder::clear() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_events.clear();
+}
+
+size_t TraceRecorder::getNbEvents() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_events.size();
+}
+
+int TraceRecorder::getThreadId() {
+  if(t_threadId < 0) {
+    t_threadId = g_nbThreads++;
+  }
+
+  return t_threadId;
+}
+
+bool TraceRecorder::write(const std::string &filename) const {
+  std::ofstream file;
+  if(filename != "-") {
+    file.open(filename.c_str());
+    if(!file.is_open()) {
+      std::cerr << "File: " << filename << " cannot be opened !" << std::endl;
+      return false;
+    }
+  }
+  std::ostream &stream = filename == "-" ? std::cout : file;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+
+  //Name of the threads in the viewer
+  std::set<int> threadIds;
+  for(std::vector<TraceEvent_t>::const_iterator it = m_events.begin(); it != m_events.end(); ++it) {
+    threadIds.insert(it->m_threadId);
+  }
+
+  bool first = true;
+  for(std::set<int>::const_iterator it = threadIds.begin(); it != threadIds.end(); ++it) {
+    stream << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << *it
+        << ",\"args\":{\"name\":\"thread " << *it << "\"}}";
+    first = false;
+  }
+
+  for(std::vector<TraceEvent_t>::const_iterator it = m_events.begin(); it != m_events.end(); ++it) {
+    stream << (first ? "" : ",\n");
+    writeEvent(stream, *it);
+    first = false;
+  }
+  stream << std::endl << "]}" << std::endl;
+
+  return (bool) stream;
+}
@@ -23,6 +23,7 @@
 #include <vector>
 #include <iostream>
 #include <opencv2/core/core.hpp>
+#include "../../Chamfer/include/Executor.hpp"
 
 
 namespace hog {
@@ -99,6 +100,20 @@ public:
   	return m_useSpatialRejection;
   }
 
+  /*
+   * Executor of the parallel loops, NULL for Executor::getDefault(). The executor must outlive the detector.
+   */
+  inline void setExecutor(Executor *executor) {
+    m_executor = executor;
+  }
+
+  /*
+   * Maximal number of threads of a parallel loop (calling thread included), 0 for the concurrency of the executor.
+   */
+  inline void setMaxParallelism(const int nb) {
+    m_maxParallelism = nb > 0 ? nb : 0;
+  }
+
   void setTemplateImages(const std::map<int, cv::Mat> &mapOfTemplateImages);
 
   inline void setUseSpatialRejection(const bool use) {
@@ -113,6 +128,10 @@ private:
 
   std::vector<cv::Mat> calculateIntegralHOG(const cv::Mat &_in, const int _nbins);
 
+  inline Executor& getExecutor() const {
+    return m_executor != NULL ? *m_executor : *Executor::getDefault();
+  }
+
   void detect_impl(const Template_info_t &template_info, const Query_info_t &query_info, const int scale,
   		std::vector<Detection_t> &detections, const double distThresh, const int offsetX=5, const int offsetY=5);
 
@@ -121,6 +140,10 @@ private:
   std::map<int, Template_info_t> m_mapOfTemplateInfo;
   //! Spatial rejection
   bool m_useSpatialRejection;
+  //! Executor of the parallel loops (NULL for Executor::getDefault()).
+  Executor *m_executor;
+  //! Maximal number of threads of a parallel loop (0 for the concurrency of the executor).
+  int m_maxParallelism;
 };
 
 } //namespace hog
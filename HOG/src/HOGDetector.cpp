@@ -18,6 +18,7 @@
  *****************************************************************************/
 #include "../include/HOGDetector.hpp"
 #include <limits>
+#include <mutex>
 #include <opencv2/imgproc/imgproc.hpp>
 
 using namespace hog;
@@ -27,7 +28,8 @@ static bool my_isnan(double val) {
   return val != val;
 }
 
-HOGDetector::HOGDetector() : m_mapOfTemplateInfo(), m_useSpatialRejection(true) {
+HOGDetector::HOGDetector() : m_mapOfTemplateInfo(), m_useSpatialRejection(true), m_executor(NULL),
+    m_maxParallelism(0) {
 }
 
 //@url=https://avresearch.wordpress.com/2011/08/05/integral-histogram-for-fast-hog-feature-calculation/
@@ -310,34 +312,45 @@ void HOGDetector::detect_impl(const Template_info_t &template_info, const Query_
   }
 
 
-  int indexI = 0;
-#pragma omp parallel for private(query_hog, indexI)
-  for(int i = 0; i < matching_cost_map.rows; i += offsetY) {
-  	float *ptr_row = matching_cost_map.ptr<float>(i);
-  	const uchar *ptr_row_rejection = rejection_mask.ptr<uchar>(indexI);
+  //Row of the rejection mask of each computed row, as advanced by the serial loop
+  std::vector<int> rejectionRows;
+  for(int i = 0, indexI = 0; i < matching_cost_map.rows; i += offsetY) {
+    rejectionRows.push_back(indexI);
 
-    for(int j = 0, indexJ=0; j < matching_cost_map.cols; j += offsetX) {
-    	if(ptr_row_rejection[indexJ]) {
-      	query_roi.x = j;
-      	query_roi.y = i;
+    if( i >= (indexI+1)*rejection_height ) {
+    	indexI++;
+    }
+  }
 
-        calculateHOG_rect(query_hog, query_info.m_integralHOG, query_roi, nbins, nbCellX, nbCellY);
-        double dist = cv::compareHist(template_info.m_hog, query_hog, cv::HISTCMP_BHATTACHARYYA);
+  getExecutor().parallelFor(0, (int) rejectionRows.size(), [&](const int firstRow, const int lastRow) {
+    //Per thread ROI and descriptor
+    cv::Rect roi(0, 0, template_width, template_height);
+    cv::Mat hog(nbCellX*nbCellY*nbins, 1, CV_32F);
 
-        if(/*!isnan(dist)*/ !my_isnan(dist)) {
-          ptr_row[j] = (float) dist;
+    for(int row = firstRow; row < lastRow; row++) {
+      const int i = row*offsetY;
+      float *ptr_row = matching_cost_map.ptr<float>(i);
+      const uchar *ptr_row_rejection = rejection_mask.ptr<uchar>(rejectionRows[row]);
+
+      for(int j = 0, indexJ=0; j < matching_cost_map.cols; j += offsetX) {
+        if(ptr_row_rejection[indexJ]) {
+          roi.x = j;
+          roi.y = i;
+
+          calculateHOG_rect(hog, query_info.m_integralHOG, roi, nbins, nbCellX, nbCellY);
+          double dist = cv::compareHist(template_info.m_hog, hog, cv::HISTCMP_BHATTACHARYYA);
+
+          if(/*!isnan(dist)*/ !my_isnan(dist)) {
+            ptr_row[j] = (float) dist;
+          }
         }
-    	}
 
-      if( j >= (indexJ+1)*rejection_width ) {
-      	indexJ++;
+        if( j >= (indexJ+1)*rejection_width ) {
+          indexJ++;
+        }
       }
     }
-
-    if( i >= (indexI+1)*rejection_height ) {
-    	indexI++;
-    }
-  }
+  }, m_maxParallelism);
 
 
   double minVal, maxVal;
@@ -420,28 +433,31 @@ void HOGDetector::detectMultiScale(const cv::Mat &query_img, std::vector<Detecti
 
 
   //Detect for each template
+  std::mutex detectionsMutex;
   for(std::map<int, Template_info_t>::const_iterator it_tpl = m_mapOfTemplateInfo.begin();
   		it_tpl != m_mapOfTemplateInfo.end(); ++it_tpl) {
 
-#pragma omp parallel for
-  	for(int scale = minScale; scale <= maxScale; scale += scaleStep) {
-    	std::vector<Detection_t> current_detections;
+    //The scales run in parallel, the location loop of detect_impl (nested) runs on the thread of its scale
+    const int nbScales = (maxScale - minScale) / scaleStep + 1;
+    getExecutor().parallelFor(0, nbScales, [&](const int firstScale, const int lastScale) {
+      for(int index = firstScale; index < lastScale; index++) {
+        const int scale = minScale + index*scaleStep;
+        std::vector<Detection_t> current_detections;
 
-    	detect_impl(it_tpl->second, query_info, scale, current_detections, distThresh, offsetX, offsetY);
+        detect_impl(it_tpl->second, query_info, scale, current_detections, distThresh, offsetX, offsetY);
 
-    	//Set scale
-    	for(std::vector<Detection_t>::iterator it_detection = current_detections.begin();
-    			it_detection != current_detections.end(); ++it_detection) {
-    		it_detection->m_scale = scale;
-    		it_detection->m_templateIndex = it_tpl->first;
-    	}
+        //Set scale
+        for(std::vector<Detection_t>::iterator it_detection = current_detections.begin();
+            it_detection != current_detections.end(); ++it_detection) {
+          it_detection->m_scale = scale;
+          it_detection->m_templateIndex = it_tpl->first;
+        }
 
-#pragma omp critical
-    	{
-				//Append current detections
-				detections.insert(detections.end(), current_detections.begin(), current_detections.end());
-			}
-  	}
+        //Append current detections
+        std::lock_guard<std::mutex> lock(detectionsMutex);
+        detections.insert(detections.end(), current_detections.begin(), current_detections.end());
+      }
+    }, m_maxParallelism);
   }
 
   //Sort detections
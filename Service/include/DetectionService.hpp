@@ -0,0 +1,198 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __DetectionService_h__
+#define __DetectionService_h__
+
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../../Chamfer/include/Chamfer.hpp"
+
+
+namespace service {
+
+struct DetectionRequest_t {
+  enum ImageType {
+    //! The payload is a path to an image readable by the daemon.
+    imagePath,
+    //! The payload is an encoded image (JPEG, PNG, ...) to decode with cv::imdecode.
+    imageBytes
+  };
+
+  //! How to interpret m_imageData.
+  ImageType m_imageType;
+  //! Image path or encoded image bytes.
+  std::vector<uchar> m_imageData;
+  //! Name of the template library to use (empty for the default library).
+  std::string m_libraryName;
+  //! Call detectMultiScale instead of detect.
+  bool m_multiScale;
+  bool m_useOrientation;
+  float m_distanceThresh;
+  float m_lambda;
+  float m_weightForward;
+  float m_weightBackward;
+  bool m_useNonMaximaSuppression;
+  bool m_useGroupDetections;
+
+  DetectionRequest_t()
+  : m_imageType(imagePath), m_imageData(), m_libraryName(), m_multiScale(false), m_useOrientation(true),
+    m_distanceThresh(50.0f), m_lambda(5.0f), m_weightForward(1.0f), m_weightBackward(1.0f),
+    m_useNonMaximaSuppression(true), m_useGroupDetections(true) {
+  }
+};
+
+/*
+ * Wire protocol used between the daemon and its clients over a Unix domain socket.
+ * All the fields are written in the host byte order, as in ChamferMatcher::saveTemplateData.
+ *
+ * Request:  magic, version, image type, image data, library name, detection parameters.
+ * Response: status (+ error message), then one record per detection, then an end record
+ *           with the number of detections and the processing time.
+ */
+namespace protocol {
+  const int requestMagic = 0x524d4843; //"CHMR"
+  const int responseMagic = 0x414d4843; //"CHMA"
+  const int version = 1;
+
+  enum Status {
+    statusOk = 0,
+    statusBadRequest,
+    statusUnknownLibrary,
+    statusInvalidImage
+  };
+
+  enum RecordTag {
+    endRecord = 0,
+    detectionRecord = 1
+  };
+
+  bool readAll(const int fd, void *buffer, const size_t length);
+  bool writeAll(const int fd, const void *buffer, const size_t length);
+
+  bool readRequest(const int fd, DetectionRequest_t &request);
+  bool writeRequest(const int fd, const DetectionRequest_t &request);
+
+  bool readStatus(const int fd, int &status, std::string &message);
+  bool writeStatus(const int fd, const int status, const std::string &message="");
+
+  /*
+   * Read the next record of the response. Return false on I/O error.
+   * When the end record is read, isEnd is set to true and nbDetections / processingTime are filled.
+   */
+  bool readRecord(const int fd, Detection_t &detection, bool &isEnd, int &nbDetections, double &processingTime);
+  bool writeDetection(const int fd, const Detection_t &detection);
+  bool writeEnd(const int fd, const int nbDetections, const double processingTime);
+}
+
+class DetectionServer {
+public:
+  DetectionServer();
+  ~DetectionServer();
+
+  /*
+   * Load a template library saved with ChamferMatcher::saveTemplateData and keep it prepared
+   * (all the scales) for the lifetime of the server. The first loaded library is the default one.
+   */
+  bool addLibrary(const std::string &name, const std::string &filename, const double cannyThreshold=50.0,
+      const ChamferMatcher::MatchingType &matchingType=ChamferMatcher::edgeMatching);
+
+  /*
+   * Prepare the templates of the file and swap them into the library. The requests in progress finish
+   * with the previous templates, the library is kept unchanged if the file has no template.
+   */
+  bool reloadLibrary(const std::string &name, const std::string &filename);
+
+  inline size_t getNbLibraries() const {
+    return m_mapOfLibraries.size();
+  }
+
+  /*
+   * Bind the socket and serve the requests until stop() is called (or a SIGINT / SIGTERM is received).
+   * Each connection is served in its own thread and can send several requests.
+   */
+  bool run(const std::string &socketPath);
+
+  void stop();
+
+private:
+  struct Library_t {
+    //! Prepared templates.
+    ChamferMatcher m_matcher;
+    //! Buffers reused between the requests.
+    DetectionWorkspace m_workspace;
+    //! ChamferMatcher::detect is not reentrant.
+    std::mutex m_mutex;
+    //! Serialize the reloads (the detections are not blocked).
+    std::mutex m_reloadMutex;
+  };
+
+  void handleConnection(const int fd, const int connection);
+  void joinFinishedConnections();
+  int processRequest(const DetectionRequest_t &request, std::vector<Detection_t> &detections,
+      std::string &message);
+
+  //! Key: library name - Value: prepared library.
+  std::map<std::string, Library_t*> m_mapOfLibraries;
+  //! Name of the library used when the request does not specify one.
+  std::string m_defaultLibrary;
+  //! Listening socket.
+  int m_listenFd;
+  //! Sockets of the connected clients, shut down when the server stops.
+  std::set<int> m_clientFds;
+  //! Connections whose thread has returned, joined by the accept loop.
+  std::vector<int> m_finishedConnections;
+  //! Protect m_clientFds and m_finishedConnections.
+  std::mutex m_clientMutex;
+  //! Key: connection index - Value: thread of the connection, until it is joined.
+  std::map<int, std::thread> m_connectionThreads;
+  //! Set to false to leave the accept loop.
+  std::atomic<bool> m_running;
+};
+
+class DetectionClient {
+public:
+  DetectionClient();
+  ~DetectionClient();
+
+  bool connect(const std::string &socketPath);
+  void disconnect();
+
+  /*
+   * Send the request and read the detections streamed back by the daemon.
+   */
+  bool detect(const DetectionRequest_t &request, std::vector<Detection_t> &detections,
+      double &processingTime, std::string &errorMessage);
+
+  inline bool isConnected() const {
+    return m_fd >= 0;
+  }
+
+private:
+  //! Connected socket.
+  int m_fd;
+};
+
+} //namespace service
+
+#endif
@@ -0,0 +1,554 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include "../include/DetectionService.hpp"
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <opencv2/highgui/highgui.hpp>
+
+using namespace service;
+
+
+namespace {
+  //Limits to reject corrupted requests before allocating anything
+  const int maxImageDataLength = 256*1024*1024;
+  const int maxStringLength = 4096;
+
+  bool readInt(const int fd, int &value) {
+    return protocol::readAll(fd, &value, sizeof(value));
+  }
+
+  bool writeInt(const int fd, const int value) {
+    return protocol::writeAll(fd, &value, sizeof(value));
+  }
+
+  bool readFloat(const int fd, float &value) {
+    return protocol::readAll(fd, &value, sizeof(value));
+  }
+
+  bool writeFloat(const int fd, const float value) {
+    return protocol::writeAll(fd, &value, sizeof(value));
+  }
+
+  bool readString(const int fd, std::string &str) {
+    int length = 0;
+    if(!readInt(fd, length) || length < 0 || length > maxStringLength) {
+      return false;
+    }
+
+    str.resize(length);
+    return length == 0 || protocol::readAll(fd, &str[0], length);
+  }
+
+  bool writeString(const int fd, const std::string &str) {
+    return writeInt(fd, (int) str.length()) && protocol::writeAll(fd, str.data(), str.length());
+  }
+
+  bool fillSocketAddress(const std::string &socketPath, struct sockaddr_un &address) {
+    if(socketPath.empty() || socketPath.length() >= sizeof(address.sun_path)) {
+      std::cerr << "Invalid socket path: " << socketPath << std::endl;
+      return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path)-1);
+    return true;
+  }
+}
+
+bool protocol::readAll(const int fd, void *buffer, const size_t length) {
+  char *ptr = (char *) buffer;
+  size_t remaining = length;
+
+  while(remaining > 0) {
+    ssize_t nb = ::read(fd, ptr, remaining);
+    if(nb < 0 && errno == EINTR) {
+      continue;
+    }
+    if(nb <= 0) {
+      return false;
+    }
+
+    ptr += nb;
+    remaining -= nb;
+  }
+
+  return true;
+}
+
+bool protocol::writeAll(const int fd, const void *buffer, const size_t length) {
+  const char *ptr = (const char *) buffer;
+  size_t remaining = length;
+
+  while(remaining > 0) {
+    //MSG_NOSIGNAL: a client that went away must not kill the daemon with SIGPIPE
+    ssize_t nb = ::send(fd, ptr, remaining, MSG_NOSIGNAL);
+    if(nb < 0 && errno == EINTR) {
+      continue;
+    }
+    if(nb <= 0) {
+      return false;
+    }
+
+    ptr += nb;
+    remaining -= nb;
+  }
+
+  return true;
+}
+
+bool protocol::readRequest(const int fd, DetectionRequest_t &request) {
+  int magic = 0, requestVersion = 0;
+  if(!readInt(fd, magic) || !readInt(fd, requestVersion)) {
+    return false;
+  }
+
+  if(magic != requestMagic || requestVersion != version) {
+    std::cerr << "Invalid request header!" << std::endl;
+    return false;
+  }
+
+  int imageType = 0, dataLength = 0;
+  if(!readInt(fd, imageType) || !readInt(fd, dataLength) || dataLength < 0 || dataLength > maxImageDataLength) {
+    return false;
+  }
+  request.m_imageType = imageType == DetectionRequest_t::imageBytes ?
+      DetectionRequest_t::imageBytes : DetectionRequest_t::imagePath;
+
+  request.m_imageData.resize(dataLength);
+  if(dataLength > 0 && !readAll(fd, &request.m_imageData[0], dataLength)) {
+    return false;
+  }
+
+  if(!readString(fd, request.m_libraryName)) {
+    return false;
+  }
+
+  int multiScale = 0, useOrientation = 0, useNonMaximaSuppression = 0, useGroupDetections = 0;
+  if(!readInt(fd, multiScale) || !readInt(fd, useOrientation) || !readFloat(fd, request.m_distanceThresh) ||
+      !readFloat(fd, request.m_lambda) || !readFloat(fd, request.m_weightForward) ||
+      !readFloat(fd, request.m_weightBackward) || !readInt(fd, useNonMaximaSuppression) ||
+      !readInt(fd, useGroupDetections)) {
+    return false;
+  }
+
+  request.m_multiScale = multiScale != 0;
+  request.m_useOrientation = useOrientation != 0;
+  request.m_useNonMaximaSuppression = useNonMaximaSuppression != 0;
+  request.m_useGroupDetections = useGroupDetections != 0;
+
+  return true;
+}
+
+bool protocol::writeRequest(const int fd, const DetectionRequest_t &request) {
+  return writeInt(fd, requestMagic) && writeInt(fd, version) && writeInt(fd, (int) request.m_imageType) &&
+      writeInt(fd, (int) request.m_imageData.size()) &&
+      (request.m_imageData.empty() || writeAll(fd, &request.m_imageData[0], request.m_imageData.size())) &&
+      writeString(fd, request.m_libraryName) && writeInt(fd, request.m_multiScale) &&
+      writeInt(fd, request.m_useOrientation) && writeFloat(fd, request.m_distanceThresh) &&
+      writeFloat(fd, request.m_lambda) && writeFloat(fd, request.m_weightForward) &&
+      writeFloat(fd, request.m_weightBackward) && writeInt(fd, request.m_useNonMaximaSuppression) &&
+      writeInt(fd, request.m_useGroupDetections);
+}
+
+bool protocol::readStatus(const int fd, int &status, std::string &message) {
+  int magic = 0;
+  if(!readInt(fd, magic) || magic != responseMagic) {
+    return false;
+  }
+
+  if(!readInt(fd, status)) {
+    return false;
+  }
+
+  message.clear();
+  return status == statusOk || readString(fd, message);
+}
+
+bool protocol::writeStatus(const int fd, const int status, const std::string &message) {
+  return writeInt(fd, responseMagic) && writeInt(fd, status) && (status == statusOk || writeString(fd, message));
+}
+
+bool protocol::readRecord(const int fd, Detection_t &detection, bool &isEnd, int &nbDetections,
+    double &processingTime) {
+  int tag = 0;
+  if(!readInt(fd, tag)) {
+    return false;
+  }
+
+  isEnd = tag == endRecord;
+  if(isEnd) {
+    return readInt(fd, nbDetections) && readAll(fd, &processingTime, sizeof(processingTime));
+  }
+
+  int x = 0, y = 0, width = 0, height = 0;
+  if(!readInt(fd, x) || !readInt(fd, y) || !readInt(fd, width) || !readInt(fd, height) ||
+      !readFloat(fd, detection.m_chamferDist) || !readInt(fd, detection.m_scale) ||
+      !readInt(fd, detection.m_templateIndex)) {
+    return false;
+  }
+  detection.m_boundingBox = cv::Rect(x, y, width, height);
+
+  return true;
+}
+
+bool protocol::writeDetection(const int fd, const Detection_t &detection) {
+  return writeInt(fd, detectionRecord) && writeInt(fd, detection.m_boundingBox.x) &&
+      writeInt(fd, detection.m_boundingBox.y) && writeInt(fd, detection.m_boundingBox.width) &&
+      writeInt(fd, detection.m_boundingBox.height) && writeFloat(fd, detection.m_chamferDist) &&
+      writeInt(fd, detection.m_scale) && writeInt(fd, detection.m_templateIndex);
+}
+
+bool protocol::writeEnd(const int fd, const int nbDetections, const double processingTime) {
+  return writeInt(fd, endRecord) && writeInt(fd, nbDetections) &&
+      writeAll(fd, &processingTime, sizeof(processingTime));
+}
+
+
+DetectionServer::DetectionServer()
+  : m_mapOfLibraries(), m_defaultLibrary(), m_listenFd(-1), m_clientFds(), m_finishedConnections(),
+    m_clientMutex(), m_connectionThreads(), m_running(false) {
+}
+
+DetectionServer::~DetectionServer() {
+  stop();
+
+  for(std::map<std::string, Library_t*>::iterator it = m_mapOfLibraries.begin();
+      it != m_mapOfLibraries.end(); ++it) {
+    delete it->second;
+  }
+}
+
+bool DetectionServer::addLibrary(const std::string &name, const std::string &filename, const double cannyThreshold,
+    const ChamferMatcher::MatchingType &matchingType) {
+  if(m_mapOfLibraries.find(name) != m_mapOfLibraries.end()) {
+    std::cerr << "The library: " << name << " is already loaded!" << std::endl;
+    return false;
+  }
+
+  Library_t *library = new Library_t;
+  library->m_matcher.setCannyThreshold(cannyThreshold);
+  library->m_matcher.setMatchingType(matchingType);
+  //Prepare the templates at all the scales once for all
+  library->m_matcher.loadTemplateData(filename);
+
+  if(library->m_matcher.getNbTemplates() == 0) {
+    std::cerr << "No template in the library: " << filename << std::endl;
+    delete library;
+    return false;
+  }
+
+  if(m_mapOfLibraries.empty()) {
+    m_defaultLibrary = name;
+  }
+  m_mapOfLibraries[name] = library;
+
+  return true;
+}
+
+bool DetectionServer::reloadLibrary(const std::string &name, const std::string &filename) {
+  std::map<std::string, Library_t*>::const_iterator it_library = m_mapOfLibraries.find(name);
+  if(it_library == m_mapOfLibraries.end()) {
+    std::cerr << "Unknown library: " << name << std::endl;
+    return false;
+  }
+
+  Library_t *library = it_library->second;
+  std::lock_guard<std::mutex> lock(library->m_reloadMutex);
+
+  //Prepare the new templates with the same parameters, without blocking the detections
+  ChamferMatcher staging;
+  staging.setCannyThreshold(library->m_matcher.getCannyThreshold());
+  staging.setMatchingType(library->m_matcher.getMatchingType());
+  staging.loadTemplateData(filename);
+
+  if(staging.getNbTemplates() == 0) {
+    std::cerr << "No template in the library: " << filename << std::endl;
+    return false;
+  }
+
+  library->m_matcher.setTemplateLibrary(staging.getTemplateLibrary());
+
+  return true;
+}
+
+void DetectionServer::handleConnection(const int fd, const int connection) {
+  DetectionRequest_t request;
+
+  //A connection can send several requests, until the client closes it
+  while(m_running && protocol::readRequest(fd, request)) {
+    double t = (double) cv::getTickCount();
+
+    std::vector<Detection_t> detections;
+    std::string message;
+    int status = processRequest(request, detections, message);
+
+    t = ((double) cv::getTickCount() - t) / cv::getTickFrequency() * 1000.0;
+
+    if(!protocol::writeStatus(fd, status, message)) {
+      break;
+    }
+
+    if(status == protocol::statusOk) {
+      bool ok = true;
+      for(std::vector<Detection_t>::const_iterator it = detections.begin(); it != detections.end() && ok; ++it) {
+        ok = protocol::writeDetection(fd, *it);
+      }
+
+      if(!ok || !protocol::writeEnd(fd, (int) detections.size(), t)) {
+        break;
+      }
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_clientMutex);
+    m_clientFds.erase(fd);
+    m_finishedConnections.push_back(connection);
+  }
+  ::close(fd);
+}
+
+/*
+ * Join the threads of the closed connections, so that a long-running server does not keep them.
+ */
+void DetectionServer::joinFinishedConnections() {
+  std::vector<int> finishedConnections;
+  {
+    std::lock_guard<std::mutex> lock(m_clientMutex);
+    finishedConnections.swap(m_finishedConnections);
+  }
+
+  for(std::vector<int>::const_iterator it = finishedConnections.begin(); it != finishedConnections.end(); ++it) {
+    std::map<int, std::thread>::iterator it_thread = m_connectionThreads.find(*it);
+    if(it_thread != m_connectionThreads.end()) {
+      it_thread->second.join();
+      m_connectionThreads.erase(it_thread);
+    }
+  }
+}
+
+int DetectionServer::processRequest(const DetectionRequest_t &request, std::vector<Detection_t> &detections,
+    std::string &message) {
+  std::string name = request.m_libraryName.empty() ? m_defaultLibrary : request.m_libraryName;
+  std::map<std::string, Library_t*>::const_iterator it_library = m_mapOfLibraries.find(name);
+  if(it_library == m_mapOfLibraries.end()) {
+    message = "Unknown library: " + name;
+    return protocol::statusUnknownLibrary;
+  }
+
+  cv::Mat img_query;
+  if(request.m_imageType == DetectionRequest_t::imageBytes) {
+    if(!request.m_imageData.empty()) {
+      img_query = cv::imdecode(request.m_imageData, cv::IMREAD_COLOR);
+    }
+  } else {
+    std::string path(request.m_imageData.begin(), request.m_imageData.end());
+    img_query = cv::imread(path);
+  }
+
+  if(img_query.empty()) {
+    message = "Cannot read the query image!";
+    return protocol::statusInvalidImage;
+  }
+
+  Library_t *library = it_library->second;
+  std::lock_guard<std::mutex> lock(library->m_mutex);
+  DetectionQuery_t query(img_query, &library->m_workspace);
+  if(request.m_multiScale) {
+    library->m_matcher.detectMultiScale(query, detections, request.m_useOrientation, request.m_distanceThresh,
+        request.m_lambda, request.m_weightForward, request.m_weightBackward, request.m_useNonMaximaSuppression,
+        request.m_useGroupDetections);
+  } else {
+    library->m_matcher.detect(query, detections, request.m_useOrientation, request.m_distanceThresh,
+        request.m_lambda, request.m_weightForward, request.m_weightBackward, request.m_useGroupDetections);
+  }
+
+  return protocol::statusOk;
+}
+
+bool DetectionServer::run(const std::string &socketPath) {
+  if(m_mapOfLibraries.empty()) {
+    std::cerr << "No template library loaded!" << std::endl;
+    return false;
+  }
+
+  struct sockaddr_un address;
+  if(!fillSocketAddress(socketPath, address)) {
+    return false;
+  }
+
+  m_listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if(m_listenFd < 0) {
+    std::cerr << "Cannot create the socket: " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  //Remove a stale socket file left by a previous instance
+  ::unlink(socketPath.c_str());
+
+  if(::bind(m_listenFd, (struct sockaddr *) &address, sizeof(address)) < 0 || ::listen(m_listenFd, 16) < 0) {
+    std::cerr << "Cannot listen on: " << socketPath << " (" << strerror(errno) << ")" << std::endl;
+    ::close(m_listenFd);
+    m_listenFd = -1;
+    return false;
+  }
+
+  int nbConnections = 0;
+  m_running = true;
+  while(m_running) {
+    joinFinishedConnections();
+
+    //Poll with a timeout to regularly check if we have to stop
+    struct pollfd pfd;
+    pfd.fd = m_listenFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ret = ::poll(&pfd, 1, 200);
+    if(ret < 0 && errno != EINTR) {
+      std::cerr << "poll() failed: " << strerror(errno) << std::endl;
+      break;
+    }
+
+    if(ret > 0 && (pfd.revents & POLLIN)) {
+      int fd = ::accept(m_listenFd, NULL, NULL);
+      if(fd >= 0) {
+        {
+          std::lock_guard<std::mutex> lock(m_clientMutex);
+          m_clientFds.insert(fd);
+        }
+        m_connectionThreads[nbConnections] = std::thread(&DetectionServer::handleConnection, this, fd, nbConnections);
+        nbConnections++;
+      }
+    }
+  }
+  m_running = false;
+
+  //Wake up the connection threads blocked in read()
+  {
+    std::lock_guard<std::mutex> lock(m_clientMutex);
+    for(std::set<int>::const_iterator it = m_clientFds.begin(); it != m_clientFds.end(); ++it) {
+      ::shutdown(*it, SHUT_RDWR);
+    }
+  }
+
+  for(std::map<int, std::thread>::iterator it = m_connectionThreads.begin(); it != m_connectionThreads.end(); ++it) {
+    it->second.join();
+  }
+  m_connectionThreads.clear();
+  m_finishedConnections.clear();
+
+  ::close(m_listenFd);
+  m_listenFd = -1;
+  ::unlink(socketPath.c_str());
+
+  return true;
+}
+
+void DetectionServer::stop() {
+  m_running = false;
+}
+
+
+DetectionClient::DetectionClient() : m_fd(-1) {
+}
+
+DetectionClient::~DetectionClient() {
+  disconnect();
+}
+
+bool DetectionClient::connect(const std::string &socketPath) {
+  disconnect();
+
+  struct sockaddr_un address;
+  if(!fillSocketAddress(socketPath, address)) {
+    return false;
+  }
+
+  m_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if(m_fd < 0) {
+    std::cerr << "Cannot create the socket: " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  if(::connect(m_fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+    std::cerr << "Cannot connect to: " << socketPath << " (" << strerror(errno) << ")" << std::endl;
+    disconnect();
+    return false;
+  }
+
+  return true;
+}
+
+bool DetectionClient::detect(const DetectionRequest_t &request, std::vector<Detection_t> &detections,
+    double &processingTime, std::string &errorMessage) {
+  detections.clear();
+  errorMessage.clear();
+
+  if(!isConnected()) {
+    errorMessage = "Not connected!";
+    return false;
+  }
+
+  if(!protocol::writeRequest(m_fd, request)) {
+    errorMessage = "Cannot send the request!";
+    disconnect();
+    return false;
+  }
+
+  int status = protocol::statusOk;
+  if(!protocol::readStatus(m_fd, status, errorMessage)) {
+    errorMessage = "Cannot read the response!";
+    disconnect();
+    return false;
+  }
+
+  if(status != protocol::statusOk) {
+    return false;
+  }
+
+  bool isEnd = false;
+  int nbDetections = 0;
+  while(!isEnd) {
+    Detection_t detection;
+    if(!protocol::readRecord(m_fd, detection, isEnd, nbDetections, processingTime)) {
+      errorMessage = "Connection lost while reading the detections!";
+      disconnect();
+      return false;
+    }
+
+    if(!isEnd) {
+      detections.push_back(detection);
+    }
+  }
+
+  return nbDetections == (int) detections.size();
+}
+
+void DetectionClient::disconnect() {
+  if(m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+}
@@ -0,0 +1,108 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include "../Chamfer/include/DetectionWriter.hpp"
+
+
+int main() {
+  std::string binary_filename = "test-detection-writer.bin";
+  std::string ndjson_filename = "test-detection-writer.ndjson";
+  int nbFrames = 1000;
+
+  std::vector<DetectionRecord_t> records;
+  for(int frame = 0; frame < nbFrames; frame++) {
+    std::vector<Detection_t> detections;
+    for(int i = 0; i < frame % 5; i++) {
+      detections.push_back(Detection_t(cv::Rect(frame, i, 64+i, 48), 10.0f + i*0.5f, 100 + 10*i, i));
+    }
+
+    std::stringstream ss;
+    ss << "frame_\"" << frame << "\".png";
+    DetectionRecord_t record(ss.str(), frame, detections);
+    record.m_timings.push_back(std::pair<std::string, double>("detect", frame * 0.1));
+    records.push_back(record);
+  }
+
+  //Write
+  DetectionWriter binary_writer, ndjson_writer;
+  if(!binary_writer.open(binary_filename, DetectionWriter::binaryFormat) ||
+      !ndjson_writer.open(ndjson_filename, DetectionWriter::ndjsonFormat)) {
+    return EXIT_FAILURE;
+  }
+
+  double t = (double) cv::getTickCount();
+  for(std::vector<DetectionRecord_t>::const_iterator it = records.begin(); it != records.end(); ++it) {
+    binary_writer.write(*it);
+    ndjson_writer.write(*it);
+  }
+  t = ((double) cv::getTickCount() - t) / cv::getTickFrequency() * 1000.0;
+  std::cout << "Time to push " << nbFrames << " records in two writers=" << t << " ms" << std::endl;
+
+  binary_writer.close();
+  ndjson_writer.close();
+
+
+  //Read back the binary stream
+  std::ifstream binary_file(binary_filename.c_str(), std::ifstream::binary);
+  if(!DetectionWriter::readBinaryHeader(binary_file)) {
+    std::cerr << "Invalid binary header!" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  int nbErrors = 0, nbRecords = 0;
+  DetectionRecord_t record;
+  while(DetectionWriter::readBinaryRecord(binary_file, record)) {
+    const DetectionRecord_t &ref = records[nbRecords];
+
+    if(record.m_source != ref.m_source || record.m_frame != ref.m_frame ||
+        record.m_detections.size() != ref.m_detections.size() || record.m_timings.size() != ref.m_timings.size()) {
+      nbErrors++;
+    } else {
+      for(size_t i = 0; i < record.m_detections.size(); i++) {
+        if(record.m_detections[i].m_boundingBox != ref.m_detections[i].m_boundingBox ||
+            record.m_detections[i].m_chamferDist != ref.m_detections[i].m_chamferDist ||
+            record.m_detections[i].m_scale != ref.m_detections[i].m_scale ||
+            record.m_detections[i].m_templateIndex != ref.m_detections[i].m_templateIndex) {
+          nbErrors++;
+        }
+      }
+    }
+
+    nbRecords++;
+  }
+
+  //Count NDJSON lines
+  std::ifstream ndjson_file(ndjson_filename.c_str());
+  std::string line;
+  int nbLines = 0;
+  while(std::getline(ndjson_file, line)) {
+    nbLines++;
+  }
+
+  std::cout << "Binary records read=" << nbRecords << " ; errors=" << nbErrors << " ; NDJSON lines="
+      << nbLines << std::endl;
+
+  remove(binary_filename.c_str());
+  remove(ndjson_filename.c_str());
+
+  return (nbErrors == 0 && nbRecords == nbFrames && nbLines == nbFrames) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,209 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include "../Chamfer/include/Executor.hpp"
+
+
+namespace {
+  //Number of threads that called func, the chunks sleep so that the helpers can start
+  int countThreads(Executor &executor, const int nbIndexes, const int maxParallelism) {
+    std::mutex mutex;
+    std::set<std::thread::id> threadIds;
+    executor.parallelFor(0, nbIndexes, [&](int, int) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      std::lock_guard<std::mutex> lock(mutex);
+      threadIds.insert(std::this_thread::get_id());
+    }, maxParallelism);
+
+    return (int) threadIds.size();
+  }
+
+  //Each index of [begin, end) must be processed exactly once
+  bool checkCoverage(Executor &executor, const int begin, const int end, const int maxParallelism) {
+    std::vector<std::atomic<int> > counts(end - begin);
+    for(size_t cpt = 0; cpt < counts.size(); cpt++) {
+      counts[cpt] = 0;
+    }
+
+    std::atomic<bool> valid(true);
+    executor.parallelFor(begin, end, [&](int first, int last) {
+      if(first < begin || last > end || first >= last) {
+        valid = false;
+        return;
+      }
+
+      for(int index = first; index < last; index++) {
+        counts[index - begin]++;
+      }
+    }, maxParallelism);
+
+    for(size_t cpt = 0; cpt < counts.size(); cpt++) {
+      if(counts[cpt] != 1) {
+        return false;
+      }
+    }
+
+    return valid;
+  }
+
+  /*
+   * A chunk throws: parallelFor rethrows once no chunk runs anymore, and the executor (and the nesting state of
+   * the calling thread) can be used again.
+   */
+  bool checkThrow(Executor &executor, const int maxParallelism) {
+    std::atomic<int> running(0);
+    bool thrown = false;
+    try {
+      executor.parallelFor(0, 1000, [&](int first, int) {
+        running++;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        if(first == 0) {
+          running--;
+          throw std::runtime_error("chunk error");
+        }
+        running--;
+      }, maxParallelism);
+    } catch(const std::runtime_error &) {
+      thrown = running == 0;
+    }
+
+    if(!thrown) {
+      std::cerr << "The exception was not rethrown after the end of the chunks!" << std::endl;
+      return false;
+    }
+
+    //The nesting depth of the calling thread is restored: the next loop runs on several threads
+    if(executor.getConcurrency() > 1 && countThreads(executor, 64, 0) < 2) {
+      std::cerr << "The loop after the exception runs serially!" << std::endl;
+      return false;
+    }
+
+    return checkCoverage(executor, 0, 1000, 0);
+  }
+}
+
+int main() {
+  ThreadPoolExecutor executor(4);
+  int nbErrors = 0;
+
+  //Chunk coverage
+  int ranges[][2] = { {0, 1}, {0, 7}, {-50, 50}, {3, 1000}, {0, 100000} };
+  for(size_t cpt = 0; cpt < sizeof(ranges) / sizeof(ranges[0]); cpt++) {
+    for(int maxParallelism = 0; maxParallelism <= 5; maxParallelism++) {
+      if(!checkCoverage(executor, ranges[cpt][0], ranges[cpt][1], maxParallelism)) {
+        std::cerr << "Invalid coverage of [" << ranges[cpt][0] << ", " << ranges[cpt][1] << ") with maxParallelism="
+            << maxParallelism << std::endl;
+        nbErrors++;
+      }
+    }
+  }
+
+  //Empty range
+  bool called = false;
+  executor.parallelFor(5, 5, [&](int, int) {
+    called = true;
+  });
+  if(called) {
+    std::cerr << "func called on an empty range!" << std::endl;
+    nbErrors++;
+  }
+
+  //maxParallelism cap
+  for(int maxParallelism = 1; maxParallelism <= 4; maxParallelism++) {
+    int nbThreads = countThreads(executor, 64, maxParallelism);
+    std::cout << "maxParallelism=" << maxParallelism << " ; threads=" << nbThreads << std::endl;
+    if(nbThreads > maxParallelism) {
+      std::cerr << "More threads than maxParallelism!" << std::endl;
+      nbErrors++;
+    }
+  }
+
+  //Nested loop: runs on the thread of the outer chunk, in a single call
+  std::atomic<int> nbNestedErrors(0);
+  executor.parallelFor(0, 16, [&](int, int) {
+    std::thread::id outerId = std::this_thread::get_id();
+    int nbCalls = 0;
+    executor.parallelFor(0, 100, [&](int first, int last) {
+      nbCalls++;
+      if(std::this_thread::get_id() != outerId || first != 0 || last != 100) {
+        nbNestedErrors++;
+      }
+    });
+
+    if(nbCalls != 1) {
+      nbNestedErrors++;
+    }
+  });
+  if(nbNestedErrors > 0) {
+    std::cerr << "The nested loop did not run on the calling thread!" << std::endl;
+    nbErrors++;
+  }
+
+  //Throw path, parallel and serial
+  if(!checkThrow(executor, 0) || !checkThrow(executor, 1)) {
+    nbErrors++;
+  }
+
+  //Submit throws after one helper: the calling thread runs the remaining chunks, then rethrows
+  std::vector<std::thread> helpers;
+  CallbackExecutor failingExecutor([&](const std::function<void()> &task) {
+    if(!helpers.empty()) {
+      throw std::runtime_error("queue full");
+    }
+    helpers.push_back(std::thread(task));
+  }, 4);
+
+  std::vector<std::atomic<int> > counts(1000);
+  for(size_t cpt = 0; cpt < counts.size(); cpt++) {
+    counts[cpt] = 0;
+  }
+  bool submitThrown = false;
+  try {
+    failingExecutor.parallelFor(0, (int) counts.size(), [&](int first, int last) {
+      for(int index = first; index < last; index++) {
+        counts[index]++;
+      }
+    });
+  } catch(const std::runtime_error &) {
+    submitThrown = true;
+  }
+  for(std::vector<std::thread>::iterator it = helpers.begin(); it != helpers.end(); ++it) {
+    it->join();
+  }
+
+  if(!submitThrown) {
+    std::cerr << "The submit exception was not rethrown!" << std::endl;
+    nbErrors++;
+  }
+  for(size_t cpt = 0; cpt < counts.size(); cpt++) {
+    if(counts[cpt] != 1) {
+      std::cerr << "Invalid coverage when submit throws!" << std::endl;
+      nbErrors++;
+      break;
+    }
+  }
+
+  std::cout << "nbErrors=" << nbErrors << std::endl;
+  return nbErrors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,168 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+
+#include <opencv2/opencv.hpp>
+#include "../Chamfer/include/Chamfer.hpp"
+#include "../Chamfer/include/RetainedCostMaps.hpp"
+
+std::string DATA_LOCATION_PREFIX = DATA_DIR;
+
+
+namespace {
+  //Same order for the detections of equal cost
+  bool lessDetection(const Detection_t &d1, const Detection_t &d2) {
+    if(d1.m_chamferDist != d2.m_chamferDist) {
+      return d1.m_chamferDist < d2.m_chamferDist;
+    }
+    if(d1.m_templateIndex != d2.m_templateIndex) {
+      return d1.m_templateIndex < d2.m_templateIndex;
+    }
+    if(d1.m_boundingBox.y != d2.m_boundingBox.y) {
+      return d1.m_boundingBox.y < d2.m_boundingBox.y;
+    }
+    return d1.m_boundingBox.x < d2.m_boundingBox.x;
+  }
+
+  bool sameDetections(std::vector<Detection_t> detections1, std::vector<Detection_t> detections2) {
+    if(detections1.size() != detections2.size()) {
+      return false;
+    }
+
+    std::sort(detections1.begin(), detections1.end(), lessDetection);
+    std::sort(detections2.begin(), detections2.end(), lessDetection);
+    for(size_t cpt = 0; cpt < detections1.size(); cpt++) {
+      if(detections1[cpt].m_boundingBox != detections2[cpt].m_boundingBox ||
+          detections1[cpt].m_chamferDist != detections2[cpt].m_chamferDist ||
+          detections1[cpt].m_scale != detections2[cpt].m_scale ||
+          detections1[cpt].m_templateIndex != detections2[cpt].m_templateIndex) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  //The locations computed are on the step grid starting at origin
+  bool onGrid(const cv::Mat &chamferMap, const cv::Point &origin, const int step) {
+    for(int i = 0; i < chamferMap.rows; i++) {
+      const float *ptr_row = chamferMap.ptr<float>(i);
+      for(int j = 0; j < chamferMap.cols; j++) {
+        if(ptr_row[j] < std::numeric_limits<float>::max() &&
+            (i < origin.y || j < origin.x || (i - origin.y) % step != 0 || (j - origin.x) % step != 0)) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  bool sameMaps(const cv::Mat &map1, const cv::Mat &map2) {
+    return map1.size() == map2.size() && map1.type() == map2.type() && cv::countNonZero(map1 != map2) == 0;
+  }
+}
+
+int main() {
+  int nbErrors = 0;
+
+  //Chamfer map computed on the 5-step grid of a query ROI starting at (7, 3), the rest at the maximal cost
+  const cv::Rect queryROI(7, 3, 91, 64);
+  const int step = 5;
+  cv::Mat chamferMap(80, 110, CV_32F, cv::Scalar(std::numeric_limits<float>::max()));
+  cv::RNG rng(12345);
+  for(int i = queryROI.y; i < queryROI.y + queryROI.height; i += step) {
+    for(int j = queryROI.x; j < queryROI.x + queryROI.width; j += step) {
+      //Some locations rejected
+      chamferMap.at<float>(i, j) = rng.uniform(0, 10) == 0 ? std::numeric_limits<float>::max() :
+          rng.uniform(0.0f, 100.0f);
+    }
+  }
+
+  RetainedCostMaps retained(100.0f, step);
+  retained.add(1, 100, cv::Size(20, 15), chamferMap);
+
+  cv::Mat restoredMap;
+  retained.getCostMap(0, restoredMap);
+  if(!sameMaps(chamferMap, restoredMap)) {
+    std::cerr << "The retained map does not round-trip the Chamfer map!" << std::endl;
+    nbErrors++;
+  }
+  std::cout << "Chamfer map: " << chamferMap.total() * chamferMap.elemSize() << " bytes ; retained: "
+      << retained.getMemorySize() << " bytes" << std::endl;
+
+
+  //Detections of the matcher and detections extracted again from the retained maps
+  cv::Mat img_template = cv::imread(DATA_LOCATION_PREFIX + "Inria_logo_template.jpg");
+  cv::Mat img_query = cv::imread(DATA_LOCATION_PREFIX + "Inria_scene5.jpg");
+  if(img_template.empty() || img_query.empty()) {
+    std::cerr << "Cannot read the images!" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::map<int, cv::Mat> mapOfTemplates;
+  std::map<int, std::pair<cv::Rect, cv::Rect> > mapOfTemplateRois;
+  mapOfTemplates[1] = img_template;
+  mapOfTemplateRois[1] = std::pair<cv::Rect, cv::Rect>(cv::Rect(0,0,-1,-1),
+      cv::Rect(queryROI.x, queryROI.y, img_query.cols / 2, img_query.rows / 2));
+
+  ChamferMatcher chamfer(mapOfTemplates, mapOfTemplateRois);
+  chamfer.setCannyThreshold(70.0);
+  chamfer.setMatchingType(ChamferMatcher::edgeMatching);
+  chamfer.setRetainCostMaps(true);
+
+  const float distanceThreshold = 100.0f, lambda = 100.0f;
+  for(int group = 0; group < 2; group++) {
+    const bool useGroupDetections = group == 1;
+    DetectionWorkspace workspace;
+    std::vector<Detection_t> detections;
+    chamfer.detect(DetectionQuery_t(img_query, &workspace), detections, true, distanceThreshold, lambda, 1.0f,
+        1.0f, useGroupDetections);
+
+    std::shared_ptr<const RetainedCostMaps> costMaps = workspace.getRetainedCostMaps();
+    if(!costMaps || costMaps->getCostMaps().size() != 1) {
+      std::cerr << "The cost map was not retained!" << std::endl;
+      nbErrors++;
+      continue;
+    }
+
+    //Only the grid of the query ROI is computed
+    cv::Mat retainedMap;
+    costMaps->getCostMap(0, retainedMap);
+    if(!onGrid(retainedMap, queryROI.tl(), step)) {
+      std::cerr << "Location outside of the query ROI grid!" << std::endl;
+      nbErrors++;
+    }
+
+    std::vector<Detection_t> retainedDetections;
+    costMaps->detect(distanceThreshold, retainedDetections, useGroupDetections);
+    std::cout << "useGroupDetections=" << useGroupDetections << " ; detections=" << detections.size()
+        << " ; retained detections=" << retainedDetections.size() << std::endl;
+    if(!sameDetections(detections, retainedDetections)) {
+      std::cerr << "The retained maps do not give the detections of the matcher!" << std::endl;
+      nbErrors++;
+    }
+  }
+
+  std::cout << "nbErrors=" << nbErrors << std::endl;
+  return nbErrors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
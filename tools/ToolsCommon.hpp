@@ -0,0 +1,220 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#ifndef __ToolsCommon_h__
+#define __ToolsCommon_h__
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "../Chamfer/include/Chamfer.hpp"
+
+
+namespace tools {
+
+/*
+ * Time in ms since start (cv::getTickCount()).
+ */
+inline double elapsedMs(const int64 start) {
+  return ((double) cv::getTickCount() - start) / cv::getTickFrequency() * 1000.0;
+}
+
+inline bool parseMatchingType(const std::string &str, ChamferMatcher::MatchingType &type) {
+  if(str == "edge") {
+    type = ChamferMatcher::edgeMatching;
+  } else if(str == "edgeFB") {
+    type = ChamferMatcher::edgeForwardBackwardMatching;
+  } else if(str == "full") {
+    type = ChamferMatcher::fullMatching;
+  } else if(str == "mask") {
+    type = ChamferMatcher::maskMatching;
+  } else if(str == "maskFB") {
+    type = ChamferMatcher::forwardBackwardMaskMatching;
+  } else if(str == "line") {
+    type = ChamferMatcher::lineMatching;
+  } else if(str == "lineFB") {
+    type = ChamferMatcher::lineForwardBackwardMatching;
+  } else if(str == "lineIntegral") {
+    type = ChamferMatcher::lineIntegralMatching;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+inline bool isImageFile(const std::string &filename) {
+  std::string::size_type pos = filename.find_last_of('.');
+  if(pos == std::string::npos) {
+    return false;
+  }
+
+  std::string ext = filename.substr(pos+1);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+  return ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "bmp" || ext == "pgm" || ext == "ppm" ||
+      ext == "tif" || ext == "tiff";
+}
+
+inline bool isDirectory(const std::string &path) {
+  struct stat info;
+  return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+/*
+ * Append the images of the directory (not recursive), sorted by name.
+ */
+inline bool listImages(const std::string &directory, std::vector<std::string> &images) {
+  DIR *dir = opendir(directory.c_str());
+  if(dir == NULL) {
+    std::cerr << "Cannot open the directory: " << directory << std::endl;
+    return false;
+  }
+
+  std::vector<std::string> filenames;
+  struct dirent *entry;
+  while((entry = readdir(dir)) != NULL) {
+    std::string name = entry->d_name;
+    if(isImageFile(name)) {
+      filenames.push_back(directory + "/" + name);
+    }
+  }
+  closedir(dir);
+
+  std::sort(filenames.begin(), filenames.end());
+  images.insert(images.end(), filenames.begin(), filenames.end());
+
+  return true;
+}
+
+/*
+ * Append the paths listed in the file (one path per line, empty lines and lines starting with # are skipped).
+ */
+inline bool readFileList(const std::string &filename, std::vector<std::string> &images) {
+  std::ifstream file(filename.c_str());
+  if(!file.is_open()) {
+    std::cerr << "File: " << filename << " cannot be opened !" << std::endl;
+    return false;
+  }
+
+  std::string line;
+  while(std::getline(file, line)) {
+    if(!line.empty() && line[line.size()-1] == '\r') {
+      line.erase(line.size()-1);
+    }
+
+    if(!line.empty() && line[0] != '#') {
+      images.push_back(line);
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Run worker(index) on nbThreads threads and wait for them.
+ */
+template<typename Worker>
+void runWorkers(const int nbThreads, Worker worker) {
+  std::vector<std::thread> threads;
+  for(int cpt = 0; cpt < nbThreads; cpt++) {
+    threads.push_back(std::thread(worker, cpt));
+  }
+
+  for(std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it) {
+    it->join();
+  }
+}
+
+/*
+ * Bounded FIFO shared between producer and consumer threads.
+ * pop() returns false once the queue is closed and empty.
+ */
+template<typename T>
+class BlockingQueue {
+public:
+  explicit BlockingQueue(const size_t capacity) : m_capacity(capacity), m_queue(), m_mutex(), m_condition(),
+    m_closed(false) {
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closed = true;
+    }
+    m_condition.notify_all();
+  }
+
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(!m_closed && m_queue.empty()) {
+      m_condition.wait(lock);
+    }
+
+    if(m_queue.empty()) {
+      return false;
+    }
+
+    item = m_queue.front();
+    m_queue.pop_front();
+    lock.unlock();
+    m_condition.notify_all();
+
+    return true;
+  }
+
+  bool push(const T &item) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(!m_closed && m_queue.size() >= m_capacity) {
+      m_condition.wait(lock);
+    }
+
+    if(m_closed) {
+      return false;
+    }
+
+    m_queue.push_back(item);
+    lock.unlock();
+    m_condition.notify_all();
+
+    return true;
+  }
+
+private:
+  //! Maximal number of items.
+  size_t m_capacity;
+  //! Items.
+  std::deque<T> m_queue;
+  //! Protect m_queue and m_closed.
+  std::mutex m_mutex;
+  //! Signal a push / pop / close.
+  std::condition_variable m_condition;
+  //! No more push.
+  bool m_closed;
+};
+
+} //namespace tools
+
+#endif
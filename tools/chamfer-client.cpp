@@ -0,0 +1,122 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include "../Service/include/DetectionService.hpp"
+
+
+static void usage(const char *program) {
+  std::cout << "Usage: " << program << " --socket <path> [--library <name>] [--send-bytes] [--multiscale]"
+      << " [--threshold <dist>] [--lambda <lambda>] [--no-orientation] [--no-group] <image> [<image> ...]"
+      << std::endl;
+}
+
+int main(int argc, char **argv) {
+  std::string socketPath;
+  bool sendBytes = false;
+  service::DetectionRequest_t request;
+  std::vector<std::string> images;
+
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if(arg == "--socket" && i+1 < argc) {
+      socketPath = argv[++i];
+    } else if(arg == "--library" && i+1 < argc) {
+      request.m_libraryName = argv[++i];
+    } else if(arg == "--send-bytes") {
+      sendBytes = true;
+    } else if(arg == "--multiscale") {
+      request.m_multiScale = true;
+    } else if(arg == "--threshold" && i+1 < argc) {
+      request.m_distanceThresh = (float) atof(argv[++i]);
+    } else if(arg == "--lambda" && i+1 < argc) {
+      request.m_lambda = (float) atof(argv[++i]);
+    } else if(arg == "--no-orientation") {
+      request.m_useOrientation = false;
+    } else if(arg == "--no-group") {
+      request.m_useGroupDetections = false;
+    } else if(!arg.empty() && arg[0] != '-') {
+      images.push_back(arg);
+    } else {
+      usage(argv[0]);
+      return arg == "--help" || arg == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if(socketPath.empty() || images.empty()) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  service::DetectionClient client;
+  if(!client.connect(socketPath)) {
+    return EXIT_FAILURE;
+  }
+
+  int nbFailures = 0;
+  for(std::vector<std::string>::const_iterator it = images.begin(); it != images.end(); ++it) {
+    if(sendBytes) {
+      //Send the encoded image, the daemon does not need to access the file
+      std::ifstream file(it->c_str(), std::ifstream::binary);
+      if(!file.is_open()) {
+        std::cerr << "File: " << *it << " cannot be opened !" << std::endl;
+        nbFailures++;
+        continue;
+      }
+
+      request.m_imageType = service::DetectionRequest_t::imageBytes;
+      request.m_imageData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    } else {
+      request.m_imageType = service::DetectionRequest_t::imagePath;
+      request.m_imageData.assign(it->begin(), it->end());
+    }
+
+    double t = (double) cv::getTickCount();
+    std::vector<Detection_t> detections;
+    double processingTime = 0.0;
+    std::string errorMessage;
+    bool ok = client.detect(request, detections, processingTime, errorMessage);
+    t = ((double) cv::getTickCount() - t) / cv::getTickFrequency() * 1000.0;
+
+    if(!ok) {
+      std::cerr << *it << ": " << errorMessage << std::endl;
+      nbFailures++;
+
+      if(!client.isConnected()) {
+        break;
+      }
+      continue;
+    }
+
+    std::cout << *it << ": " << detections.size() << " detections ; processing time=" << processingTime
+        << " ms ; round trip=" << t << " ms" << std::endl;
+    for(std::vector<Detection_t>::const_iterator it_detection = detections.begin();
+        it_detection != detections.end(); ++it_detection) {
+      std::cout << "  template=" << it_detection->m_templateIndex << " ; scale=" << it_detection->m_scale
+          << " ; dist=" << it_detection->m_chamferDist << " ; bb=" << it_detection->m_boundingBox.x << ","
+          << it_detection->m_boundingBox.y << " " << it_detection->m_boundingBox.width << "x"
+          << it_detection->m_boundingBox.height << std::endl;
+    }
+  }
+
+  return nbFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
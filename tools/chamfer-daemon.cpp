@@ -0,0 +1,130 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include "../Service/include/DetectionService.hpp"
+#include "ToolsCommon.hpp"
+
+
+static service::DetectionServer *g_server = NULL;
+static volatile std::sig_atomic_t g_reload = 0;
+
+static void signalHandler(int) {
+  if(g_server != NULL) {
+    g_server->stop();
+  }
+}
+
+static void reloadHandler(int) {
+  g_reload = 1;
+}
+
+static void usage(const char *program) {
+  std::cout << "Usage: " << program << " --socket <path> --library <name>=<template_data_file> [--library ...]"
+      << " [--canny <threshold>] [--matching edge|edgeFB|full|mask|maskFB|line|lineFB|lineIntegral]" << std::endl
+      << "Send SIGHUP to reload the template data files without interrupting the requests." << std::endl;
+}
+
+int main(int argc, char **argv) {
+  std::string socketPath;
+  std::vector<std::pair<std::string, std::string> > libraries;
+  double cannyThreshold = 50.0;
+  ChamferMatcher::MatchingType matchingType = ChamferMatcher::edgeMatching;
+
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if(arg == "--socket" && i+1 < argc) {
+      socketPath = argv[++i];
+    } else if(arg == "--library" && i+1 < argc) {
+      std::string value = argv[++i];
+      size_t pos = value.find('=');
+      if(pos == std::string::npos) {
+        libraries.push_back(std::pair<std::string, std::string>(value, value));
+      } else {
+        libraries.push_back(std::pair<std::string, std::string>(value.substr(0, pos), value.substr(pos+1)));
+      }
+    } else if(arg == "--canny" && i+1 < argc) {
+      cannyThreshold = atof(argv[++i]);
+    } else if(arg == "--matching" && i+1 < argc) {
+      if(!tools::parseMatchingType(argv[++i], matchingType)) {
+        std::cerr << "Unknown matching type: " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else {
+      usage(argv[0]);
+      return arg == "--help" || arg == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if(socketPath.empty() || libraries.empty()) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  service::DetectionServer server;
+  for(std::vector<std::pair<std::string, std::string> >::const_iterator it = libraries.begin();
+      it != libraries.end(); ++it) {
+    double t = (double) cv::getTickCount();
+    if(!server.addLibrary(it->first, it->second, cannyThreshold, matchingType)) {
+      return EXIT_FAILURE;
+    }
+    t = ((double) cv::getTickCount() - t) / cv::getTickFrequency() * 1000.0;
+    std::cout << "Library " << it->first << " prepared in " << t << " ms" << std::endl;
+  }
+
+  g_server = &server;
+  signal(SIGINT, signalHandler);
+  signal(SIGTERM, signalHandler);
+  signal(SIGHUP, reloadHandler);
+
+  //The libraries are prepared aside and swapped in, the requests in progress are not blocked
+  std::atomic<bool> serving(true);
+  std::thread reloader([&]() {
+    while(serving) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      if(!g_reload) {
+        continue;
+      }
+      g_reload = 0;
+
+      for(std::vector<std::pair<std::string, std::string> >::const_iterator it = libraries.begin();
+          it != libraries.end(); ++it) {
+        double t = (double) cv::getTickCount();
+        if(server.reloadLibrary(it->first, it->second)) {
+          t = ((double) cv::getTickCount() - t) / cv::getTickFrequency() * 1000.0;
+          std::cout << "Library " << it->first << " reloaded in " << t << " ms" << std::endl;
+        }
+      }
+    }
+  });
+
+  std::cout << "Listening on: " << socketPath << std::endl;
+  bool ok = server.run(socketPath);
+  g_server = NULL;
+
+  serving = false;
+  reloader.join();
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
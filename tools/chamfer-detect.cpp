@@ -0,0 +1,597 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <opencv2/highgui/highgui.hpp>
+#include "../Chamfer/include/Chamfer.hpp"
+#include "../Chamfer/include/DetectionWriter.hpp"
+#include "../Chamfer/include/Executor.hpp"
+#include "../Chamfer/include/NumaTopology.hpp"
+#include "../Chamfer/include/PooledMatAllocator.hpp"
+#include "../Chamfer/include/TemplateCostReport.hpp"
+#include "../Chamfer/include/TemplateStore.hpp"
+#include "../Chamfer/include/TraceRecorder.hpp"
+#include "ToolsCommon.hpp"
+
+
+namespace {
+  struct Job_t {
+    //! Index in the list of images.
+    int m_index;
+    //! Image path.
+    std::string m_path;
+    //! Decoded image.
+    cv::Mat m_img;
+    //! Encoded image, decoded by the worker at the needed pyramid levels (--pyramid).
+    std::vector<uchar> m_buffer;
+    //! Decode time in ms.
+    double m_decodeTime;
+
+    Job_t() : m_index(-1), m_path(), m_img(), m_buffer(), m_decodeTime(0.0) {
+    }
+  };
+
+  struct Stats_t {
+    std::atomic<int> m_nbImages;
+    std::atomic<int> m_nbFailures;
+    //! Images whose detection was stopped by --budget.
+    std::atomic<int> m_nbIncomplete;
+    std::atomic<long long> m_nbDetections;
+    //! Accumulated times in microseconds (std::atomic<double> has no fetch_add).
+    std::atomic<long long> m_decodeTime;
+    std::atomic<long long> m_detectTime;
+    std::atomic<long long> m_waitTime;
+
+    Stats_t() : m_nbImages(0), m_nbFailures(0), m_nbIncomplete(0), m_nbDetections(0), m_decodeTime(0), m_detectTime(0),
+      m_waitTime(0) {
+    }
+  };
+
+  bool readFile(const std::string &filename, std::vector<uchar> &buffer) {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if(!file.is_open()) {
+      return false;
+    }
+
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !buffer.empty();
+  }
+
+  void usage(const char *program) {
+    std::cout << "Usage: " << program << " --templates <template_data_file> [options] <image|directory> ..." << std::endl
+        << "  --list <file>          file with one image path per line" << std::endl
+        << "  --output <file>        detections output (default: - for stdout)" << std::endl
+        << "  --format binary|ndjson output format (default: ndjson)" << std::endl
+        << "  --io-threads <n>       decoding threads (default: 2)" << std::endl
+        << "  --workers <n>          detection threads (default: number of cores)" << std::endl
+        << "  --prefetch <n>         maximal number of decoded images waiting (default: 2 x workers)" << std::endl
+        << "  --multiscale           use detectMultiScale" << std::endl
+        << "  --scales <min> <max> <step>" << std::endl
+        << "  --top-k <k>            only the best detection of the k best templates" << std::endl
+        << "  --scale-pruning        skip the intermediate scale locations that cannot match (--point-set-scaling)" << std::endl
+        << "  --template-groups      scan the templates of the same size together, location by location" << std::endl
+        << "  --point-set-scaling    score all the scales from the template points at 100% (--multiscale, edge)" << std::endl
+        << "  --compact-templates    keep only the template data read by the matching type" << std::endl
+        << "  --canny <threshold>    --matching edge|edgeFB|full|mask|maskFB|line|lineFB|lineIntegral" << std::endl
+        << "  --threshold <dist>     --lambda <lambda>     --no-orientation     --no-group" << std::endl
+        << "  --grayscale            decode the images in grayscale" << std::endl
+        << "  --pyramid              reject on the half resolution (pyramid1), decoded directly at 1/2;" << std::endl
+        << "                         the full resolution is decoded only if a location is not rejected" << std::endl
+        << "  --pooled-allocator     reuse aligned (huge pages for the large planes) buffers across the images" << std::endl
+        << "  --numa                 pin the workers round robin on the NUMA nodes, one copy of the templates" << std::endl
+        << "                         per node (no effect on a single node machine)" << std::endl
+        << "  --budget <ms>          detection time budget per image, the best detections found so far are output" << std::endl
+        << "  --trace <file>         write the spans of the detection stages and jobs of each thread" << std::endl
+        << "                         (Chrome trace-event JSON: chrome://tracing, Perfetto UI)" << std::endl
+        << "  --cost-report <file>   write the windows, rejection rate, points, time and detections of each" << std::endl
+        << "                         (template, scale), by decreasing time" << std::endl
+        << "  --template-memory <MB> keep at most this size of prepared templates, the others are prepared again" << std::endl
+        << "                         when needed; the images are detected batch of templates by batch" << std::endl
+        << "  --template-batch <n>   number of templates per batch with --template-memory (default: 16)" << std::endl
+        << "  --image-batch <n>      number of images detected on a batch of templates before the next batch," << std::endl
+        << "                         with --template-memory (default: 64)" << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string templateFilename, outputFilename = "-", traceFilename, costReportFilename;
+  DetectionWriter::FormatType format = DetectionWriter::ndjsonFormat;
+  std::vector<std::string> images;
+  int nbIOThreads = 2, nbWorkers = (int) std::thread::hardware_concurrency(), prefetch = -1;
+  int scaleMin = 50, scaleMax = 200, scaleStep = 10;
+  bool multiScale = false, useOrientation = true, useGroupDetections = true, grayscale = false, pyramid = false;
+  bool scalePruning = false, pooledAllocator = false, templateGroups = false, numa = false;
+  bool pointSetScaling = false, compactTemplates = false;
+  int topK = 0, templateBatch = 16, imageBatch = 64;
+  double templateMemory = -1.0;
+  float distanceThresh = 50.0f, lambda = 5.0f;
+  double cannyThreshold = 50.0, budget = -1.0;
+  ChamferMatcher::MatchingType matchingType = ChamferMatcher::edgeMatching;
+
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if(arg == "--templates" && i+1 < argc) {
+      templateFilename = argv[++i];
+    } else if(arg == "--list" && i+1 < argc) {
+      if(!tools::readFileList(argv[++i], images)) {
+        return EXIT_FAILURE;
+      }
+    } else if(arg == "--output" && i+1 < argc) {
+      outputFilename = argv[++i];
+    } else if(arg == "--format" && i+1 < argc) {
+      std::string value = argv[++i];
+      format = value == "binary" ? DetectionWriter::binaryFormat : DetectionWriter::ndjsonFormat;
+    } else if(arg == "--io-threads" && i+1 < argc) {
+      nbIOThreads = std::max(1, atoi(argv[++i]));
+    } else if(arg == "--workers" && i+1 < argc) {
+      nbWorkers = std::max(1, atoi(argv[++i]));
+    } else if(arg == "--prefetch" && i+1 < argc) {
+      prefetch = std::max(1, atoi(argv[++i]));
+    } else if(arg == "--multiscale") {
+      multiScale = true;
+    } else if(arg == "--scales" && i+3 < argc) {
+      scaleMin = atoi(argv[++i]);
+      scaleMax = atoi(argv[++i]);
+      scaleStep = atoi(argv[++i]);
+    } else if(arg == "--top-k" && i+1 < argc) {
+      topK = std::max(0, atoi(argv[++i]));
+    } else if(arg == "--scale-pruning") {
+      scalePruning = true;
+    } else if(arg == "--canny" && i+1 < argc) {
+      cannyThreshold = atof(argv[++i]);
+    } else if(arg == "--matching" && i+1 < argc) {
+      if(!tools::parseMatchingType(argv[++i], matchingType)) {
+        std::cerr << "Unknown matching type: " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if(arg == "--threshold" && i+1 < argc) {
+      distanceThresh = (float) atof(argv[++i]);
+    } else if(arg == "--lambda" && i+1 < argc) {
+      lambda = (float) atof(argv[++i]);
+    } else if(arg == "--no-orientation") {
+      useOrientation = false;
+    } else if(arg == "--no-group") {
+      useGroupDetections = false;
+    } else if(arg == "--grayscale") {
+      grayscale = true;
+    } else if(arg == "--pyramid") {
+      pyramid = true;
+    } else if(arg == "--point-set-scaling") {
+      pointSetScaling = true;
+    } else if(arg == "--compact-templates") {
+      compactTemplates = true;
+    } else if(arg == "--template-groups") {
+      templateGroups = true;
+    } else if(arg == "--pooled-allocator") {
+      pooledAllocator = true;
+    } else if(arg == "--numa") {
+      numa = true;
+    } else if(arg == "--budget" && i+1 < argc) {
+      budget = atof(argv[++i]);
+    } else if(arg == "--trace" && i+1 < argc) {
+      traceFilename = argv[++i];
+    } else if(arg == "--cost-report" && i+1 < argc) {
+      costReportFilename = argv[++i];
+    } else if(arg == "--template-memory" && i+1 < argc) {
+      templateMemory = std::max(0.0, atof(argv[++i]));
+    } else if(arg == "--template-batch" && i+1 < argc) {
+      templateBatch = std::max(1, atoi(argv[++i]));
+    } else if(arg == "--image-batch" && i+1 < argc) {
+      imageBatch = std::max(1, atoi(argv[++i]));
+    } else if(!arg.empty() && arg[0] != '-') {
+      if(tools::isDirectory(arg)) {
+        if(!tools::listImages(arg, images)) {
+          return EXIT_FAILURE;
+        }
+      } else {
+        images.push_back(arg);
+      }
+    } else {
+      usage(argv[0]);
+      return arg == "--help" || arg == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if(templateFilename.empty() || images.empty()) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if(numa && templateMemory >= 0.0) {
+    std::cerr << "--numa and --template-memory cannot be combined!" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  nbWorkers = std::max(1, nbWorkers);
+  if(prefetch < 0) {
+    prefetch = 2*nbWorkers;
+  }
+
+  //Load and prepare the template library once
+  int64 t_start = cv::getTickCount();
+  ChamferMatcher matcher;
+  matcher.setCannyThreshold(cannyThreshold);
+  matcher.setMatchingType(matchingType);
+  matcher.setUseScalePruning(scalePruning);
+  matcher.setUseTemplateGroups(templateGroups);
+  matcher.setUseCompactTemplates(compactTemplates);
+  matcher.setTopK(topK);
+  if(nbWorkers > 1) {
+    //Parallelism comes from the workers, avoid the oversubscription by the parallel loops of the matcher
+    matcher.setExecutor(SerialExecutor::getInstance());
+  }
+  if(pooledAllocator) {
+    matcher.setMatAllocator(PooledMatAllocator::getInstance());
+  }
+  if(pyramid) {
+    matcher.setRejectionType(ChamferMatcher::gridDescriptorRejection);
+    matcher.setPyramidType(ChamferMatcher::pyramid1);
+  }
+  matcher.setScale(scaleMin, scaleMax, scaleStep);
+  if(pointSetScaling) {
+    matcher.setUsePointSetScaling(true);
+  }
+
+  //With --template-memory, the templates are prepared by the workers when they need them
+  std::unique_ptr<TemplateStore> store;
+  std::vector<int> templateIds;
+  if(templateMemory >= 0.0) {
+    store.reset(new TemplateStore((size_t) (templateMemory * 1024.0 * 1024.0)));
+    store->loadTemplateData(templateFilename);
+    store->getTemplateIds(templateIds);
+  } else {
+    matcher.loadTemplateData(templateFilename);
+  }
+
+  if(store ? templateIds.empty() : matcher.getNbTemplates() == 0) {
+    std::cerr << "No template in: " << templateFilename << std::endl;
+    return EXIT_FAILURE;
+  }
+  double prepareTime = tools::elapsedMs(t_start);
+
+  size_t templateMemorySize = 0;
+  const std::shared_ptr<const TemplateLibrary_t> library = matcher.getTemplateLibrary();
+  for(std::map<int, std::shared_ptr<const TemplateScales_t> >::const_iterator it_tpl =
+      library->m_mapOfTemplate_info.begin(); it_tpl != library->m_mapOfTemplate_info.end(); ++it_tpl) {
+    for(std::map<int, Template_info_t>::const_iterator it_scale = it_tpl->second->begin();
+        it_scale != it_tpl->second->end(); ++it_scale) {
+      templateMemorySize += it_scale->second.getMemorySize();
+    }
+  }
+
+  //Shared by the copies of the matcher in the workers
+  TraceRecorder traceRecorder;
+  if(!traceFilename.empty()) {
+    matcher.setTraceRecorder(&traceRecorder);
+  }
+  TemplateCostReport costReport;
+  if(!costReportFilename.empty()) {
+    matcher.setCostReport(&costReport);
+  }
+
+  DetectionWriter writer;
+  if(!writer.open(outputFilename, format)) {
+    return EXIT_FAILURE;
+  }
+
+
+  Stats_t stats;
+  std::atomic<int> nextImage(0);
+  tools::BlockingQueue<Job_t> queue(prefetch);
+  int64 t_process = cv::getTickCount();
+
+  //Decoding threads
+  std::vector<std::thread> ioThreads;
+  for(int cpt = 0; cpt < nbIOThreads; cpt++) {
+    ioThreads.push_back(std::thread([&]() {
+      for(int index = nextImage++; index < (int) images.size(); index = nextImage++) {
+        Job_t job;
+        job.m_index = index;
+        job.m_path = images[index];
+
+        int64 t = cv::getTickCount();
+        if(pyramid) {
+          //Only read the file, the worker decodes the pyramid levels it needs
+          readFile(job.m_path, job.m_buffer);
+        } else {
+          job.m_img = cv::imread(job.m_path, grayscale ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR);
+        }
+        job.m_decodeTime = tools::elapsedMs(t);
+        stats.m_decodeTime += (long long) (job.m_decodeTime * 1000.0);
+
+        if(!queue.push(job)) {
+          break;
+        }
+      }
+    }));
+  }
+
+  //One copy of the templates per NUMA node, written by a thread of the node
+  const NumaTopology &topology = NumaTopology::getInstance();
+  std::vector<std::shared_ptr<const TemplateLibrary_t> > nodeLibraries;
+  if(numa) {
+    for(int node = 0; node < topology.getNbNodes(); node++) {
+      nodeLibraries.push_back(matcher.createTemplateLibraryReplica(node));
+    }
+    std::cerr << "NUMA nodes: " << topology.getNbNodes() << std::endl;
+  }
+
+  //Detection threads, each with its own copy of the prepared matcher (the cv::Mat are shared, not copied)
+  std::vector<std::thread> workers;
+  for(int cpt = 0; cpt < nbWorkers && !store; cpt++) {
+    workers.push_back(std::thread([&, cpt]() {
+      ChamferMatcher worker_matcher = matcher;
+      if(numa) {
+        //Pinned before the workspace is written: the query planes are allocated on the node of the worker
+        int node = topology.getWorkerNode(cpt);
+        topology.pinCurrentThread(node);
+        worker_matcher.setTemplateLibrary(nodeLibraries[node]);
+      }
+      DetectionWorkspace workspace;
+      Job_t job;
+
+      int64 t_wait = cv::getTickCount();
+      while(queue.pop(job)) {
+        stats.m_waitTime += (long long) (tools::elapsedMs(t_wait) * 1000.0);
+
+        DetectionRecord_t record;
+        record.m_source = job.m_path;
+        record.m_frame = job.m_index;
+
+        if(job.m_img.empty() && job.m_buffer.empty()) {
+          std::cerr << "Cannot read: " << job.m_path << std::endl;
+          stats.m_nbFailures++;
+        } else {
+          int64 t = cv::getTickCount();
+          QueryImageLoader query_loader = job.m_buffer.empty() ? QueryImageLoader(job.m_img) :
+              QueryImageLoader(job.m_buffer, grayscale);
+          //Without --budget, the detection is never interrupted
+          std::unique_ptr<DetectionDeadline> deadline(budget >= 0.0 ? new DetectionDeadline(budget) : NULL);
+          DetectionQuery_t query(query_loader, &workspace, deadline.get());
+          bool complete = true;
+          if(multiScale) {
+            complete = worker_matcher.detectMultiScale(query, record.m_detections, useOrientation, distanceThresh,
+                lambda, 1.0f, 1.0f, true, useGroupDetections);
+          } else {
+            complete = worker_matcher.detect(query, record.m_detections, useOrientation, distanceThresh, lambda,
+                1.0f, 1.0f, useGroupDetections);
+          }
+
+          if(!complete) {
+            stats.m_nbIncomplete++;
+          }
+          double detectTime = tools::elapsedMs(t);
+          stats.m_detectTime += (long long) (detectTime * 1000.0);
+          stats.m_nbDetections += (long long) record.m_detections.size();
+
+          //With --pyramid, the decoding is part of the detection time
+          record.m_timings.push_back(std::pair<std::string, double>(pyramid ? "read" : "decode", job.m_decodeTime));
+          record.m_timings.push_back(std::pair<std::string, double>("detect", detectTime));
+        }
+
+        writer.write(record);
+        stats.m_nbImages++;
+
+        //Release the image before waiting for the next one
+        job = Job_t();
+        t_wait = cv::getTickCount();
+      }
+    }));
+  }
+
+  if(store) {
+    //With --template-memory, the images are detected by chunks of --image-batch images: each worker detects all
+    //the images of the chunk on a batch of templates, then takes the next batch. A batch is fetched from the
+    //store once per chunk instead of once per image, and the store is walked in order once per chunk.
+    workers.push_back(std::thread([&]() {
+      const int nbBatches = (int) ((templateIds.size() + templateBatch - 1) / templateBatch);
+      const bool halfResolution = matcher.getPyramidType() != ChamferMatcher::noPyramid;
+      std::vector<Job_t> chunk;
+      bool hasJobs = true;
+
+      while(hasJobs) {
+        chunk.clear();
+        Job_t job;
+        int64 t_wait = cv::getTickCount();
+        while((int) chunk.size() < imageBatch && (hasJobs = queue.pop(job))) {
+          chunk.push_back(job);
+        }
+        stats.m_waitTime += (long long) (tools::elapsedMs(t_wait) * 1000.0);
+        const int nbImages = (int) chunk.size();
+        if(nbImages == 0) {
+          break;
+        }
+
+        //Prepare the queries once for all the batches
+        std::vector<std::shared_ptr<const PreparedQuery_t> > preparedQueries(nbImages);
+        std::vector<double> detectTimes(nbImages, 0.0);
+        std::atomic<int> nextImage(0);
+        tools::runWorkers(std::min(nbWorkers, nbImages), [&](const int) {
+          ChamferMatcher worker_matcher = matcher;
+          for(int index = nextImage++; index < nbImages; index = nextImage++) {
+            int64 t = cv::getTickCount();
+            cv::Mat img = chunk[index].m_buffer.empty() ? chunk[index].m_img :
+                QueryImageLoader(chunk[index].m_buffer, grayscale).getImage(1);
+            if(!img.empty()) {
+              preparedQueries[index] = worker_matcher.createPreparedQuery(img, halfResolution);
+            }
+            detectTimes[index] = tools::elapsedMs(t);
+          }
+        });
+
+        //Key: batch * nbImages + image index
+        std::vector<std::vector<Detection_t> > batchDetections(nbBatches * nbImages);
+        std::vector<double> batchTimes(nbBatches * nbImages, 0.0);
+        std::vector<char> batchComplete(nbBatches * nbImages, 1);
+        //With --budget, detection time of each image summed over the batches
+        std::vector<double> spentTimes(nbImages, 0.0);
+        std::mutex budgetMutex;
+        std::atomic<int> nextBatch(0);
+        tools::runWorkers(std::min(nbWorkers, nbBatches), [&](const int) {
+          //Both pin the library of the last batch, released with the chunk
+          ChamferMatcher worker_matcher = matcher;
+          DetectionWorkspace workspace;
+
+          for(int batch = nextBatch++; batch < nbBatches; batch = nextBatch++) {
+            std::vector<int> batchIds(templateIds.begin() + batch * templateBatch,
+                templateIds.begin() + std::min(templateIds.size(), (size_t) (batch + 1) * templateBatch));
+            worker_matcher.setTemplateLibrary(store->getLibrary(worker_matcher, batchIds));
+
+            for(int index = 0; index < nbImages; index++) {
+              if(!preparedQueries[index]) {
+                continue;
+              }
+
+              double remainingTime = budget;
+              if(budget >= 0.0) {
+                std::lock_guard<std::mutex> lock(budgetMutex);
+                remainingTime -= spentTimes[index];
+              }
+              const int slot = batch * nbImages + index;
+              if(budget >= 0.0 && remainingTime <= 0.0) {
+                batchComplete[slot] = 0;
+                continue;
+              }
+
+              int64 t = cv::getTickCount();
+              std::unique_ptr<DetectionDeadline> deadline(budget >= 0.0 ? new DetectionDeadline(remainingTime) :
+                  NULL);
+              DetectionQuery_t query(*preparedQueries[index], &workspace, deadline.get());
+              bool complete = true;
+              if(multiScale) {
+                complete = worker_matcher.detectMultiScale(query, batchDetections[slot], useOrientation,
+                    distanceThresh, lambda, 1.0f, 1.0f, true, useGroupDetections);
+              } else {
+                complete = worker_matcher.detect(query, batchDetections[slot], useOrientation, distanceThresh,
+                    lambda, 1.0f, 1.0f, useGroupDetections);
+              }
+              batchComplete[slot] = complete ? 1 : 0;
+              batchTimes[slot] = tools::elapsedMs(t);
+
+              if(budget >= 0.0) {
+                std::lock_guard<std::mutex> lock(budgetMutex);
+                spentTimes[index] += batchTimes[slot];
+              }
+            }
+          }
+        });
+
+        for(int index = 0; index < nbImages; index++) {
+          const Job_t &current = chunk[index];
+          DetectionRecord_t record;
+          record.m_source = current.m_path;
+          record.m_frame = current.m_index;
+
+          if(!preparedQueries[index]) {
+            std::cerr << "Cannot read: " << current.m_path << std::endl;
+            stats.m_nbFailures++;
+          } else {
+            bool complete = true;
+            double detectTime = detectTimes[index];
+            for(int batch = 0; batch < nbBatches; batch++) {
+              const int slot = batch * nbImages + index;
+              record.m_detections.insert(record.m_detections.end(), batchDetections[slot].begin(),
+                  batchDetections[slot].end());
+              complete = complete && batchComplete[slot];
+              detectTime += batchTimes[slot];
+            }
+
+            if(nbBatches > 1 && useGroupDetections) {
+              //Group the detections of the different batches
+              std::vector<Detection_t> groupedDetections;
+              ChamferMatcher::groupDetections(record.m_detections, groupedDetections);
+              record.m_detections = groupedDetections;
+            }
+            if(!complete) {
+              stats.m_nbIncomplete++;
+            }
+            stats.m_detectTime += (long long) (detectTime * 1000.0);
+            stats.m_nbDetections += (long long) record.m_detections.size();
+
+            record.m_timings.push_back(std::pair<std::string, double>(pyramid ? "read" : "decode",
+                current.m_decodeTime));
+            record.m_timings.push_back(std::pair<std::string, double>("detect", detectTime));
+          }
+
+          writer.write(record);
+          stats.m_nbImages++;
+        }
+      }
+    }));
+  }
+
+  for(std::vector<std::thread>::iterator it = ioThreads.begin(); it != ioThreads.end(); ++it) {
+    it->join();
+  }
+  queue.close();
+
+  for(std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it) {
+    it->join();
+  }
+
+  double processTime = tools::elapsedMs(t_process);
+  int64 t_flush = cv::getTickCount();
+  writer.close();
+  double flushTime = tools::elapsedMs(t_flush);
+
+
+  //Report on stderr, stdout may contain the detections
+  int nbImages = stats.m_nbImages;
+  std::cerr << "Images: " << nbImages << " (" << stats.m_nbFailures << " failures) ; detections: "
+      << stats.m_nbDetections << std::endl;
+  if(budget >= 0.0) {
+    std::cerr << "Incomplete detections (budget " << budget << " ms): " << stats.m_nbIncomplete << std::endl;
+  }
+  std::cerr << "Template preparation: " << prepareTime << " ms" << std::endl;
+  if(!store) {
+    std::cerr << "Template memory: " << (templateMemorySize / (1024.0 * 1024.0)) << " MB" << std::endl;
+  }
+  std::cerr << "Processing: " << processTime << " ms ; " << (nbImages * 1000.0 / processTime) << " images/s"
+      << " (" << nbIOThreads << " I/O threads, " << nbWorkers << " workers)" << std::endl;
+  if(nbImages > 0) {
+    std::cerr << "Per image: decode=" << (stats.m_decodeTime / 1000.0 / nbImages) << " ms ; detect="
+        << (stats.m_detectTime / 1000.0 / nbImages) << " ms ; worker wait="
+        << (stats.m_waitTime / 1000.0 / nbImages) << " ms" << std::endl;
+  }
+  std::cerr << "Output flush: " << flushTime << " ms" << std::endl;
+  if(store) {
+    std::cerr << "Template store: " << store->getNbHits() << " hits ; " << store->getNbMisses() << " misses ; "
+        << store->getNbEvictions() << " evictions ; " << (store->getMemorySize() / (1024.0 * 1024.0)) << " / "
+        << (store->getMaxMemory() / (1024.0 * 1024.0)) << " MB" << std::endl;
+  }
+
+  if(!traceFilename.empty()) {
+    if(!traceRecorder.write(traceFilename)) {
+      return EXIT_FAILURE;
+    }
+    std::cerr << "Trace: " << traceRecorder.getNbEvents() << " spans in " << traceFilename << std::endl;
+  }
+
+  if(!costReportFilename.empty() && !costReport.write(costReportFilename)) {
+    return EXIT_FAILURE;
+  }
+
+  return stats.m_nbFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,371 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "../Chamfer/include/Chamfer.hpp"
+#include "../Chamfer/include/Executor.hpp"
+#include "../Chamfer/include/PerfCounters.hpp"
+#include "ToolsCommon.hpp"
+
+
+namespace {
+  /*
+   * Stage timings and wall time of the workload at one thread count, in ms per image.
+   */
+  struct ScalingPoint_t {
+    int m_nbThreads;
+    StageTimings_t m_timings;
+    double m_wallTime;
+
+    ScalingPoint_t() : m_nbThreads(1), m_timings(), m_wallTime(0.0) {
+    }
+  };
+
+  struct DetectionOptions_t {
+    bool m_multiScale;
+    bool m_useOrientation;
+    bool m_useGroupDetections;
+    float m_distanceThresh;
+    float m_lambda;
+
+    DetectionOptions_t() : m_multiScale(false), m_useOrientation(true), m_useGroupDetections(true),
+      m_distanceThresh(50.0f), m_lambda(5.0f) {
+    }
+  };
+
+  /*
+   * Detect repeat times in each image with nbThreads threads for the parallel loops of the matcher.
+   * The hardware counters (if not NULL) are read around the stages, in ScalingPoint_t::m_timings (not divided).
+   */
+  ScalingPoint_t runWorkload(ChamferMatcher &matcher, const std::vector<cv::Mat> &images, const int nbThreads,
+      const int repeat, const DetectionOptions_t &options, const PerfCounters *counters=NULL) {
+    ThreadPoolExecutor executor(nbThreads);
+    matcher.setExecutor(&executor);
+
+    ScalingPoint_t point;
+    point.m_nbThreads = nbThreads;
+    DetectionWorkspace workspace;
+    workspace.m_stageTimings.setPerfCounters(counters);
+    std::vector<Detection_t> detections;
+
+    int64 t_start = cv::getTickCount();
+    for(int cpt = 0; cpt < repeat; cpt++) {
+      for(std::vector<cv::Mat>::const_iterator it = images.begin(); it != images.end(); ++it) {
+        DetectionQuery_t query(*it, &workspace);
+        if(options.m_multiScale) {
+          matcher.detectMultiScale(query, detections, options.m_useOrientation, options.m_distanceThresh,
+              options.m_lambda, 1.0f, 1.0f, true, options.m_useGroupDetections);
+        } else {
+          matcher.detect(query, detections, options.m_useOrientation, options.m_distanceThresh, options.m_lambda,
+              1.0f, 1.0f, options.m_useGroupDetections);
+        }
+        point.m_timings.add(workspace.m_stageTimings);
+      }
+    }
+    point.m_wallTime = tools::elapsedMs(t_start);
+
+    //The executor is destroyed at the end of the scope
+    matcher.setExecutor(NULL);
+
+    int nbDetections = std::max(1, repeat * (int) images.size());
+    for(int i = 0; i < StageTimings_t::nbStages; i++) {
+      point.m_timings.m_times[i] /= nbDetections;
+    }
+    point.m_wallTime /= nbDetections;
+
+    return point;
+  }
+
+  /*
+   * Strong scaling (fixed workload): speedup S = T1/Tp, efficiency S/p and Karp-Flatt serial fraction
+   * (1/S - 1/p) / (1 - 1/p).
+   * Weak scaling (workload proportional to p): scaled speedup S = p*T1/Tp, efficiency T1/Tp and
+   * Gustafson serial fraction (p - S) / (p - 1).
+   */
+  void printRow(const char *mode, const char *stage, const int p, const double t1, const double tp,
+      const bool weak) {
+    double speedup = tp > 0.0 ? (weak ? p * t1 / tp : t1 / tp) : 0.0;
+    double efficiency = weak ? (tp > 0.0 ? t1 / tp : 0.0) : speedup / p;
+
+    std::cout << mode << "\t" << p << "\t" << stage << "\t" << tp << "\t" << speedup << "\t" << efficiency << "\t";
+    if(p > 1 && speedup > 0.0) {
+      double serialFraction = weak ? (p - speedup) / (p - 1.0) : (1.0/speedup - 1.0/p) / (1.0 - 1.0/p);
+      std::cout << serialFraction;
+    } else {
+      std::cout << "-";
+    }
+    std::cout << std::endl;
+  }
+
+  void printCurve(const char *mode, const std::vector<ScalingPoint_t> &points, const bool weak) {
+    if(points.empty()) {
+      return;
+    }
+
+    const ScalingPoint_t &reference = points.front();
+    for(std::vector<ScalingPoint_t>::const_iterator it = points.begin(); it != points.end(); ++it) {
+      for(int i = 0; i < StageTimings_t::nbStages; i++) {
+        StageTimings_t::Stage stage = (StageTimings_t::Stage) i;
+        printRow(mode, StageTimings_t::getStageName(stage), it->m_nbThreads, reference.m_timings.m_times[i],
+            it->m_timings.m_times[i], weak);
+      }
+      printRow(mode, "total", it->m_nbThreads, reference.m_wallTime, it->m_wallTime, weak);
+    }
+  }
+
+  /*
+   * Counters of each stage in total, per image, per query pixel prepared and per template window scored.
+   */
+  void printCounters(const StageTimings_t &timings, const int nbDetections) {
+    std::cout << "stage\tcounter\ttotal\tper_image\tper_pixel\tper_window" << std::endl;
+    for(int i = 0; i < StageTimings_t::nbStages; i++) {
+      for(int j = 0; j < PerfCounterValues_t::nbCounters; j++) {
+        double value = timings.m_counters[i].m_values[j];
+        std::cout << StageTimings_t::getStageName((StageTimings_t::Stage) i) << "\t"
+            << PerfCounterValues_t::getCounterName((PerfCounterValues_t::Counter) j) << "\t";
+        if(value < 0.0) {
+          //Not available on this machine or stage never run
+          std::cout << "-\t-\t-\t-" << std::endl;
+          continue;
+        }
+
+        std::cout << value << "\t" << value / std::max(1, nbDetections) << "\t";
+        if(timings.m_nbPixels > 0.0) {
+          std::cout << value / timings.m_nbPixels;
+        } else {
+          std::cout << "-";
+        }
+        std::cout << "\t";
+        if(timings.m_nbWindows > 0.0) {
+          std::cout << value / timings.m_nbWindows;
+        } else {
+          std::cout << "-";
+        }
+        std::cout << std::endl;
+      }
+    }
+  }
+
+  void usage(const char *program) {
+    std::cout << "Usage: " << program << " --templates <template_data_file> [options] <image|directory> ..." << std::endl
+        << "  --list <file>          file with one image path per line" << std::endl
+        << "  --threads <n>          maximal number of threads, measured at 1, 2, 4, ... n (default: number of cores)"
+        << std::endl
+        << "  --repeat <n>           detections per image and thread count (default: 3)" << std::endl
+        << "  --strong-only          --weak-only" << std::endl
+        << "  --counters             single thread run with the hardware counters (Linux perf_event_open) of each"
+        << std::endl
+        << "                         stage: cycles, instructions, LLC, dTLB and branch misses" << std::endl
+        << "  --multiscale           use detectMultiScale" << std::endl
+        << "  --scales <min> <max> <step>" << std::endl
+        << "  --top-k <k>            only the best detection of the k best templates" << std::endl
+        << "  --scale-pruning        --template-groups     --point-set-scaling" << std::endl
+        << "  --canny <threshold>    --matching edge|edgeFB|full|mask|maskFB|line|lineFB|lineIntegral" << std::endl
+        << "  --threshold <dist>     --lambda <lambda>     --no-orientation     --no-group" << std::endl
+        << "  --grayscale            decode the images in grayscale" << std::endl
+        << "  --pyramid              reject on the half resolution (pyramid1)" << std::endl
+        << "Weak scaling: at p threads, each image is enlarged by sqrt(p) in both dimensions (p times the locations)."
+        << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string templateFilename;
+  std::vector<std::string> filenames;
+  int maxThreads = (int) std::thread::hardware_concurrency(), repeat = 3;
+  int scaleMin = 50, scaleMax = 200, scaleStep = 10, topK = 0;
+  bool strong = true, weak = true, counters = false, grayscale = false, pyramid = false;
+  bool scalePruning = false, templateGroups = false, pointSetScaling = false;
+  double cannyThreshold = 50.0;
+  ChamferMatcher::MatchingType matchingType = ChamferMatcher::edgeMatching;
+  DetectionOptions_t options;
+
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if(arg == "--templates" && i+1 < argc) {
+      templateFilename = argv[++i];
+    } else if(arg == "--list" && i+1 < argc) {
+      if(!tools::readFileList(argv[++i], filenames)) {
+        return EXIT_FAILURE;
+      }
+    } else if(arg == "--threads" && i+1 < argc) {
+      maxThreads = std::max(1, atoi(argv[++i]));
+    } else if(arg == "--repeat" && i+1 < argc) {
+      repeat = std::max(1, atoi(argv[++i]));
+    } else if(arg == "--strong-only") {
+      weak = false;
+    } else if(arg == "--weak-only") {
+      strong = false;
+    } else if(arg == "--counters") {
+      counters = true;
+    } else if(arg == "--multiscale") {
+      options.m_multiScale = true;
+    } else if(arg == "--scales" && i+3 < argc) {
+      scaleMin = atoi(argv[++i]);
+      scaleMax = atoi(argv[++i]);
+      scaleStep = atoi(argv[++i]);
+    } else if(arg == "--top-k" && i+1 < argc) {
+      topK = std::max(0, atoi(argv[++i]));
+    } else if(arg == "--scale-pruning") {
+      scalePruning = true;
+    } else if(arg == "--template-groups") {
+      templateGroups = true;
+    } else if(arg == "--point-set-scaling") {
+      pointSetScaling = true;
+    } else if(arg == "--canny" && i+1 < argc) {
+      cannyThreshold = atof(argv[++i]);
+    } else if(arg == "--matching" && i+1 < argc) {
+      if(!tools::parseMatchingType(argv[++i], matchingType)) {
+        std::cerr << "Unknown matching type: " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if(arg == "--threshold" && i+1 < argc) {
+      options.m_distanceThresh = (float) atof(argv[++i]);
+    } else if(arg == "--lambda" && i+1 < argc) {
+      options.m_lambda = (float) atof(argv[++i]);
+    } else if(arg == "--no-orientation") {
+      options.m_useOrientation = false;
+    } else if(arg == "--no-group") {
+      options.m_useGroupDetections = false;
+    } else if(arg == "--grayscale") {
+      grayscale = true;
+    } else if(arg == "--pyramid") {
+      pyramid = true;
+    } else if(!arg.empty() && arg[0] != '-') {
+      if(tools::isDirectory(arg)) {
+        if(!tools::listImages(arg, filenames)) {
+          return EXIT_FAILURE;
+        }
+      } else {
+        filenames.push_back(arg);
+      }
+    } else {
+      usage(argv[0]);
+      return arg == "--help" || arg == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if(templateFilename.empty() || filenames.empty()) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  //Fixed workload decoded once, the decoding is not part of the measure
+  std::vector<cv::Mat> images;
+  for(std::vector<std::string>::const_iterator it = filenames.begin(); it != filenames.end(); ++it) {
+    cv::Mat img = cv::imread(*it, grayscale ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR);
+    if(img.empty()) {
+      std::cerr << "Cannot read: " << *it << std::endl;
+      return EXIT_FAILURE;
+    }
+    images.push_back(img);
+  }
+
+  ChamferMatcher matcher;
+  matcher.setCannyThreshold(cannyThreshold);
+  matcher.setMatchingType(matchingType);
+  matcher.setUseScalePruning(scalePruning);
+  matcher.setUseTemplateGroups(templateGroups);
+  matcher.setUsePointSetScaling(pointSetScaling);
+  matcher.setTopK(topK);
+  if(pyramid) {
+    matcher.setRejectionType(ChamferMatcher::gridDescriptorRejection);
+    matcher.setPyramidType(ChamferMatcher::pyramid1);
+  }
+  matcher.setScale(scaleMin, scaleMax, scaleStep);
+  matcher.loadTemplateData(templateFilename);
+
+  if(matcher.getNbTemplates() == 0) {
+    std::cerr << "No template in: " << templateFilename << std::endl;
+    return EXIT_FAILURE;
+  }
+  matcher.setUseStageTimings(true);
+
+  //1, 2, 4, ... and the maximal number of threads
+  std::vector<int> threadCounts;
+  for(int nb = 1; nb < maxThreads; nb *= 2) {
+    threadCounts.push_back(nb);
+  }
+  threadCounts.push_back(maxThreads);
+
+  //Warm up: allocations, caches
+  runWorkload(matcher, std::vector<cv::Mat>(1, images.front()), 1, 1, options);
+
+  int64 t_start = cv::getTickCount();
+  std::vector<ScalingPoint_t> strongPoints, weakPoints;
+  for(std::vector<int>::const_iterator it = threadCounts.begin(); it != threadCounts.end(); ++it) {
+    if(strong) {
+      strongPoints.push_back(runWorkload(matcher, images, *it, repeat, options));
+      std::cerr << "Strong scaling, " << *it << " threads: " << strongPoints.back().m_wallTime << " ms/image"
+          << std::endl;
+    }
+
+    if(weak) {
+      //p times the locations: the per-location loops have the same work per thread, the per-template ones do not
+      double factor = std::sqrt((double) *it);
+      std::vector<cv::Mat> scaledImages;
+      for(std::vector<cv::Mat>::const_iterator it_img = images.begin(); it_img != images.end(); ++it_img) {
+        cv::Mat scaledImg;
+        if(*it > 1) {
+          cv::resize(*it_img, scaledImg, cv::Size(), factor, factor, cv::INTER_LINEAR);
+        } else {
+          scaledImg = *it_img;
+        }
+        scaledImages.push_back(scaledImg);
+      }
+
+      weakPoints.push_back(runWorkload(matcher, scaledImages, *it, repeat, options));
+      std::cerr << "Weak scaling, " << *it << " threads: " << weakPoints.back().m_wallTime << " ms/image"
+          << std::endl;
+    }
+  }
+
+
+  //Table on stdout, one line per (mode, threads, stage)
+  std::cout << "mode\tthreads\tstage\tms_per_image\tspeedup\tefficiency\tserial_fraction" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+  printCurve("strong", strongPoints, false);
+  printCurve("weak", weakPoints, true);
+
+  if(counters) {
+    //Counters of the calling thread: one thread, the parallel loops run inline
+    PerfCounters perfCounters;
+    if(perfCounters.isAvailable()) {
+      ScalingPoint_t point = runWorkload(matcher, images, 1, repeat, options, &perfCounters);
+      std::cout << std::endl;
+      printCounters(point.m_timings, repeat * (int) images.size());
+    } else {
+      std::cerr << "Hardware counters not available (not Linux, perf_event_paranoid or no PMU), only the times"
+          << " are reported" << std::endl;
+    }
+  }
+
+  //Report on stderr
+  std::cerr << "Images: " << images.size() << " ; repeat: " << repeat << " ; templates: " << matcher.getNbTemplates()
+      << std::endl;
+  std::cerr << "Benchmark: " << tools::elapsedMs(t_start) << " ms" << std::endl;
+
+  return EXIT_SUCCESS;
+}
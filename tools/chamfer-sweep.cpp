@@ -0,0 +1,247 @@
+/****************************************************************************
+ *
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * See the file LICENSE.txt at the root directory of this source
+ * distribution for additional information about the GNU GPL.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ *****************************************************************************/
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <opencv2/highgui/highgui.hpp>
+#include "../Chamfer/include/Chamfer.hpp"
+#include "../Chamfer/include/Executor.hpp"
+#include "../Chamfer/include/ParameterSweep.hpp"
+#include "ToolsCommon.hpp"
+
+
+namespace {
+  const char* matchingTypeName(const ChamferMatcher::MatchingType &type) {
+    switch(type) {
+    case ChamferMatcher::edgeMatching:
+      return "edge";
+    case ChamferMatcher::edgeForwardBackwardMatching:
+      return "edgeFB";
+    case ChamferMatcher::fullMatching:
+      return "full";
+    case ChamferMatcher::maskMatching:
+      return "mask";
+    case ChamferMatcher::forwardBackwardMaskMatching:
+      return "maskFB";
+    case ChamferMatcher::lineMatching:
+      return "line";
+    case ChamferMatcher::lineForwardBackwardMatching:
+      return "lineFB";
+    case ChamferMatcher::lineIntegralMatching:
+      return "lineIntegral";
+    default:
+      return "?";
+    }
+  }
+
+  /*
+   * Split a comma separated list of numbers.
+   */
+  template<typename T>
+  bool parseList(const std::string &str, std::vector<T> &values) {
+    std::istringstream stream(str);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+      std::istringstream item_stream(item);
+      T value;
+      if(!(item_stream >> value)) {
+        std::cerr << "Invalid value: " << item << std::endl;
+        return false;
+      }
+      values.push_back(value);
+    }
+
+    return !values.empty();
+  }
+
+  /*
+   * Dataset file: one image per line followed by its ground truth boxes (x y width height ...),
+   * empty lines and lines starting with # are skipped.
+   */
+  bool readDataset(const std::string &filename, const bool grayscale, std::vector<SweepSample_t> &samples) {
+    std::vector<std::string> lines;
+    if(!tools::readFileList(filename, lines)) {
+      return false;
+    }
+
+    for(std::vector<std::string>::const_iterator it = lines.begin(); it != lines.end(); ++it) {
+      std::istringstream stream(*it);
+      SweepSample_t sample;
+      stream >> sample.m_path;
+
+      cv::Rect r;
+      while(stream >> r.x >> r.y >> r.width >> r.height) {
+        sample.m_groundTruth.push_back(r);
+      }
+
+      sample.m_img = cv::imread(sample.m_path, grayscale ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR);
+      if(sample.m_img.empty()) {
+        std::cerr << "Cannot read: " << sample.m_path << std::endl;
+        return false;
+      }
+
+      samples.push_back(sample);
+    }
+
+    return true;
+  }
+
+  void usage(const char *program) {
+    std::cout << "Usage: " << program << " --templates <template_data_file> --dataset <file> [options]" << std::endl
+        << "  --dataset <file>       one image per line: <path> [x y width height]..." << std::endl
+        << "  --canny <t1,t2,...>    Canny thresholds (templates and queries are prepared once per value)" << std::endl
+        << "  --matching <m1,...>    edge|edgeFB|full|mask|maskFB|line|lineFB|lineIntegral" << std::endl
+        << "  --lambda <l1,l2,...>   --threshold <d1,d2,...>" << std::endl
+        << "  --workers <n>          threads (default: number of cores)" << std::endl
+        << "  --chunk <n>            images prepared in memory at the same time (default: 64)" << std::endl
+        << "  --single-scale         use detect instead of detectMultiScale" << std::endl
+        << "  --scales <min> <max> <step>" << std::endl
+        << "  --top-k <k>            only the best detection of the k best templates" << std::endl
+        << "  --pyramid              reject on the half resolution (pyramid1)" << std::endl
+        << "  --min-overlap <iou>    intersection over union to match a ground truth box (default: 0.5)" << std::endl
+        << "  --no-orientation       --no-group            --grayscale" << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string templateFilename, datasetFilename;
+  SweepGrid_t grid;
+  int nbWorkers = (int) std::thread::hardware_concurrency(), chunkSize = 64;
+  int scaleMin = 50, scaleMax = 200, scaleStep = 10, topK = 0;
+  bool multiScale = true, useOrientation = true, useGroupDetections = true, grayscale = false, pyramid = false;
+  double minOverlap = 0.5;
+
+  for(int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+
+    if(arg == "--templates" && i+1 < argc) {
+      templateFilename = argv[++i];
+    } else if(arg == "--dataset" && i+1 < argc) {
+      datasetFilename = argv[++i];
+    } else if(arg == "--canny" && i+1 < argc) {
+      if(!parseList(argv[++i], grid.m_cannyThresholds)) {
+        return EXIT_FAILURE;
+      }
+    } else if(arg == "--matching" && i+1 < argc) {
+      std::istringstream stream(argv[++i]);
+      std::string name;
+      while(std::getline(stream, name, ',')) {
+        ChamferMatcher::MatchingType type;
+        if(!tools::parseMatchingType(name, type)) {
+          std::cerr << "Unknown matching type: " << name << std::endl;
+          return EXIT_FAILURE;
+        }
+        grid.m_matchingTypes.push_back(type);
+      }
+    } else if(arg == "--lambda" && i+1 < argc) {
+      if(!parseList(argv[++i], grid.m_lambdas)) {
+        return EXIT_FAILURE;
+      }
+    } else if(arg == "--threshold" && i+1 < argc) {
+      if(!parseList(argv[++i], grid.m_distanceThresholds)) {
+        return EXIT_FAILURE;
+      }
+    } else if(arg == "--workers" && i+1 < argc) {
+      nbWorkers = std::max(1, atoi(argv[++i]));
+    } else if(arg == "--chunk" && i+1 < argc) {
+      chunkSize = std::max(1, atoi(argv[++i]));
+    } else if(arg == "--single-scale") {
+      multiScale = false;
+    } else if(arg == "--scales" && i+3 < argc) {
+      scaleMin = atoi(argv[++i]);
+      scaleMax = atoi(argv[++i]);
+      scaleStep = atoi(argv[++i]);
+    } else if(arg == "--top-k" && i+1 < argc) {
+      topK = std::max(0, atoi(argv[++i]));
+    } else if(arg == "--pyramid") {
+      pyramid = true;
+    } else if(arg == "--min-overlap" && i+1 < argc) {
+      minOverlap = atof(argv[++i]);
+    } else if(arg == "--no-orientation") {
+      useOrientation = false;
+    } else if(arg == "--no-group") {
+      useGroupDetections = false;
+    } else if(arg == "--grayscale") {
+      grayscale = true;
+    } else {
+      usage(argv[0]);
+      return arg == "--help" || arg == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if(templateFilename.empty() || datasetFilename.empty()) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int64 t_start = cv::getTickCount();
+  std::vector<SweepSample_t> samples;
+  if(!readDataset(datasetFilename, grayscale, samples)) {
+    return EXIT_FAILURE;
+  }
+  double decodeTime = tools::elapsedMs(t_start);
+
+  ChamferMatcher prototype;
+  prototype.setTopK(topK);
+  if(nbWorkers > 1) {
+    //Parallelism comes from the sweep threads, avoid the oversubscription by the parallel loops of the matcher
+    prototype.setExecutor(SerialExecutor::getInstance());
+  }
+  if(pyramid) {
+    prototype.setRejectionType(ChamferMatcher::gridDescriptorRejection);
+    prototype.setPyramidType(ChamferMatcher::pyramid1);
+  }
+  prototype.setScale(scaleMin, scaleMax, scaleStep);
+
+  ParameterSweep sweep(prototype);
+  sweep.setNbWorkers(nbWorkers);
+  sweep.setChunkSize(chunkSize);
+  sweep.setMultiScale(multiScale);
+  sweep.setMinOverlap(minOverlap);
+  sweep.setUseOrientation(useOrientation);
+  sweep.setUseGroupDetections(useGroupDetections);
+
+  int64 t_sweep = cv::getTickCount();
+  std::vector<SweepResult_t> results;
+  if(!sweep.run(templateFilename, samples, grid, results)) {
+    return EXIT_FAILURE;
+  }
+  double sweepTime = tools::elapsedMs(t_sweep);
+
+
+  //Table on stdout, one line per configuration
+  std::cout << "canny\tmatching\tlambda\tthreshold\trecall\tprecision\tdetections\tmean_ms\tp95_ms\tmax_ms" << std::endl;
+  std::cout << std::fixed << std::setprecision(3);
+  for(std::vector<SweepResult_t>::const_iterator it = results.begin(); it != results.end(); ++it) {
+    std::cout << it->m_config.m_cannyThreshold << "\t" << matchingTypeName(it->m_config.m_matchingType) << "\t"
+        << it->m_config.m_lambda << "\t" << it->m_config.m_distanceThresh << "\t" << it->getRecall() << "\t"
+        << it->getPrecision() << "\t" << it->m_nbDetections << "\t" << it->m_meanTime << "\t" << it->m_p95Time
+        << "\t" << it->m_maxTime << std::endl;
+  }
+
+  //Report on stderr
+  std::cerr << "Images: " << samples.size() << " ; configurations: " << results.size() << std::endl;
+  std::cerr << "Decoding: " << decodeTime << " ms ; template preparation: " << sweep.getTemplatePreparationTime()
+      << " ms ; query preparation: " << sweep.getQueryPreparationTime() << " ms" << std::endl;
+  std::cerr << "Sweep: " << sweepTime << " ms (" << nbWorkers << " workers)" << std::endl;
+
+  return EXIT_SUCCESS;
+}